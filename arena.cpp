@@ -0,0 +1,72 @@
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include "./arena.hpp"
+
+using namespace pl0;
+
+const size_t Arena::chunk_size;
+const size_t Arena::large_size;
+
+static void *allocate_block(size_t size) {
+  void *block = std::malloc(size);
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  return block;
+}
+
+Arena::~Arena() {
+  while (chunks != nullptr) {
+    Header *prev = chunks->prev;
+    std::free(chunks);
+    chunks = prev;
+  }
+  while (large != nullptr) {
+    Header *next = large->next;
+    std::free(large);
+    large = next;
+  }
+}
+
+void *Arena::allocate_slow(size_t size, size_t align) {
+  // malloc aligns for every fundamental type, and a Header keeps that.
+  static_assert(sizeof(Header) % alignof(std::max_align_t) == 0,
+                "blocks after a Header should stay aligned");
+  assert(align <= alignof(std::max_align_t));
+
+  if (size >= large_size) {
+    Header *block =
+        static_cast<Header *>(allocate_block(sizeof(Header) + size));
+    block->prev = nullptr;
+    block->next = large;
+    if (large != nullptr) {
+      large->prev = block;
+    }
+    large = block;
+    return block + 1;
+  }
+
+  // The rest of the current chunk is given up.
+  Header *chunk = static_cast<Header *>(allocate_block(chunk_size));
+  chunk->prev = chunks;
+  chunks = chunk;
+  head = reinterpret_cast<char *>(chunk + 1);
+  limit = reinterpret_cast<char *>(chunk) + chunk_size;
+  return allocate(size, align);
+}
+
+void Arena::free_large(void *block) {
+  Header *header = static_cast<Header *>(block) - 1;
+  if (header->prev != nullptr) {
+    header->prev->next = header->next;
+  } else {
+    large = header->next;
+  }
+  if (header->next != nullptr) {
+    header->next->prev = header->prev;
+  }
+  std::free(header);
+}
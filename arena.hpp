@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pl0 {
+// Bump allocator for data that lives as long as one compilation: the syntax
+// tree, the symbol table and the compiler's work lists. Small blocks are cut
+// from chunks and never freed one by one. A large block, such as the buffer
+// of a long vector, gets an allocation of its own that is freed as soon as
+// the vector moves to a bigger one. What is left goes at once when the arena
+// is destroyed.
+class Arena {
+public:
+  Arena() {}
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  ~Arena();
+
+  void *allocate(size_t size, size_t align) {
+    if (size < large_size) {
+      uintptr_t at =
+          (reinterpret_cast<uintptr_t>(head) + align - 1) & ~(align - 1);
+      if (at + size <= reinterpret_cast<uintptr_t>(limit)) {
+        head = reinterpret_cast<char *>(at + size);
+        return reinterpret_cast<void *>(at);
+      }
+    }
+    return allocate_slow(size, align);
+  }
+
+  void deallocate(void *block, size_t size) {
+    if (size >= large_size) {
+      free_large(block);
+    }
+  }
+
+private:
+  // Chunks are kept in a list, large blocks in a doubly linked one.
+  struct Header {
+    Header *prev;
+    Header *next;
+  };
+
+  void *allocate_slow(size_t size, size_t align);
+  void free_large(void *block);
+
+private:
+  static const size_t chunk_size = 64 * 1024;
+  static const size_t large_size = 8 * 1024;
+
+  char *head = nullptr;
+  char *limit = nullptr;
+  Header *chunks = nullptr;
+  Header *large = nullptr;
+};
+
+// Standard allocator over an Arena, for containers whose contents die with
+// the compilation.
+template <typename T> class ArenaAllocator {
+public:
+  using value_type = T;
+
+  ArenaAllocator(Arena &arena) : arena(&arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *block, size_t n) {
+    arena->deallocate(block, n * sizeof(T));
+  }
+
+  template <typename U> bool operator==(const ArenaAllocator<U> &other) const {
+    return arena == other.arena;
+  }
+  template <typename U> bool operator!=(const ArenaAllocator<U> &other) const {
+    return arena != other.arena;
+  }
+
+private:
+  template <typename U> friend class ArenaAllocator;
+
+  Arena *arena;
+};
+
+template <typename T> using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+} // namespace pl0
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "./arena.hpp"
+#include "./interner.hpp"
+#include "./token.hpp"
+
+namespace pl0 {
+// Syntax tree shared by the bytecode compiler and the LLVM front end, so
+// that a source file is lexed and parsed once. Nodes live in one vector and
+// refer to each other by index; the children of a Begin or a Call are a
+// range of Ast::lists. All of it is allocated from the Arena of the
+// compilation. Names are already resolved: a constant is replaced by
+// its value, a variable by its frame level and address, and a callee by its
+// index in Ast::functions.
+namespace ast {
+using NodeId = uint32_t;
+
+enum class Kind : uint8_t {
+  // Expressions
+  Number,   // value
+  Variable, // at frame level ref, address value
+  Call,     // of functions[ref]; arguments in lists[first, first + size)
+  Unary,    // op is Minus or Odd; operand first
+  Binary,   // op is Plus to Div or Equal to GreaterEqual; first, second
+
+  // Statements
+  Assign,  // expression first to the variable at level ref, address value
+  Begin,   // statements in lists[first, first + size)
+  If,      // condition first, then statement second
+  While,   // condition first, body second
+  Return,  // expression first
+  Write,   // expression first
+  Writeln,
+  Empty,
+};
+
+struct Node {
+  Kind kind;
+  TokenType op;
+  uint32_t ref;
+  NodeId first;
+  union {
+    NodeId second;
+    uint32_t size;
+  };
+  long long value;
+};
+static_assert(sizeof(Node) == 24, "Node should stay three words");
+
+struct Range {
+  uint32_t first = 0;
+  uint32_t size = 0;
+};
+
+struct Function {
+  Symbol name;
+  uint32_t level; // of its own frame; main's is 0
+  uint32_t params;
+  uint32_t locals;
+  NodeId body;
+  Range nested; // functions declared in it, in lists
+  Range names;  // in Ast::names: the parameters, then the locals
+
+  // Position of the variable at frame address addr in names.
+  size_t slot(long long addr) const {
+    return addr < 0 ? addr + params : params + addr - 2;
+  }
+};
+
+class Ast {
+public:
+  explicit Ast(Arena &arena)
+      : nodes(arena), functions(arena), lists(arena), names(arena) {}
+
+  const Node &node(NodeId id) const { return nodes[id]; }
+  const Function &function(size_t id) const { return functions[id]; }
+  const uint32_t *list(uint32_t first) const { return &lists[first]; }
+
+public:
+  ArenaVector<Node> nodes;
+  // functions[0] is main; the others follow in the order they are declared.
+  ArenaVector<Function> functions;
+  ArenaVector<uint32_t> lists;
+  ArenaVector<Symbol> names;
+};
+} // namespace ast
+} // namespace pl0
@@ -0,0 +1,90 @@
+#include <exception>
+#include <memory>
+#include <mutex>
+
+#include "./batch.hpp"
+#include "./bytecode_file.hpp"
+#include "./compiler.hpp"
+#include "./ir.hpp"
+#include "./peephole.hpp"
+#include "./work_pool.hpp"
+
+using namespace pl0;
+
+static bool ends_with(const std::string &str, const std::string &suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static void execute(const std::string &path, const BatchOptions &options,
+                    Output &output) {
+  if (ends_with(path, ".plzc")) {
+    MappedBytecode mapped(path);
+    VM vm(mapped.code(), output, options.dispatch);
+    vm.eval();
+    return;
+  }
+  Program program;
+  FunctionTable functions;
+  {
+    Compiler compiler(path);
+    program = compiler.compile();
+    functions = compiler.functions();
+  }
+  if (options.optimize) {
+    program = inline_calls(program, functions, options.inline_budget);
+    if (options.middle_end) {
+      program = optimize_ir(program, functions);
+    }
+    program = peephole(program, &functions);
+  }
+  Bytecode code = decode(program, functions);
+  VM vm(code, output, options.dispatch);
+  vm.eval();
+}
+
+BatchResult pl0::run_job(const std::string &path, const BatchOptions &options) {
+  BatchResult result;
+  result.path = path;
+  // The compiler and VM report errors by throwing C strings, the lexer
+  // std::string for files it can not open.
+  try {
+    Output output(result.output);
+    execute(path, options, output);
+  } catch (const char *msg) {
+    result.error = msg;
+  } catch (const std::string &msg) {
+    result.error = msg;
+  } catch (const std::exception &e) {
+    result.error = e.what();
+  }
+  return result;
+}
+
+size_t pl0::run_batch(const std::vector<std::string> &paths,
+                      const BatchOptions &options,
+                      const std::function<void(const BatchResult &)> &report) {
+  std::vector<BatchResult> results(paths.size());
+  std::unique_ptr<bool[]> done(new bool[paths.size()]());
+  std::mutex mutex;
+  size_t next = 0; // first job not reported yet
+  size_t failed = 0;
+
+  WorkStealingPool pool(options.threads);
+  pool.run(paths.size(), [&](size_t i) {
+    BatchResult result = run_job(paths[i], options);
+    std::lock_guard<std::mutex> lock(mutex);
+    results[i] = std::move(result);
+    done[i] = true;
+    // Whoever completes the oldest outstanding job reports it and every
+    // finished job after it, then drops their output.
+    for (; next < paths.size() && done[next]; next++) {
+      if (!results[next].ok()) {
+        failed++;
+      }
+      report(results[next]);
+      results[next] = BatchResult();
+    }
+  });
+  return failed;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "./inliner.hpp"
+#include "./vm.hpp"
+
+namespace pl0 {
+struct BatchOptions {
+  bool optimize = false;
+  bool middle_end = false; // with optimize
+  size_t inline_budget = default_inline_budget; // with optimize
+  Dispatch dispatch = VM::default_dispatch();
+  unsigned threads = 0; // 0: one per hardware thread
+};
+
+struct BatchResult {
+  std::string path;
+  std::string output; // everything the program wrote, up to any error
+  std::string error;  // empty if the job succeeded
+  bool ok() const { return error.empty(); }
+};
+
+// Compiles and runs each of paths (.plz sources or .plzc files) on a
+// WorkStealingPool. Every job has its own Compiler, VM and output buffer,
+// and a failing job only records its error. report is called once per job,
+// in the order of paths, as soon as the job and all jobs before it are
+// done; calls are serialized. Returns the number of failed jobs.
+size_t run_batch(const std::vector<std::string> &paths,
+                 const BatchOptions &options,
+                 const std::function<void(const BatchResult &)> &report);
+
+// Runs one job on the calling thread.
+BatchResult run_job(const std::string &path, const BatchOptions &options);
+} // namespace pl0
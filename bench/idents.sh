@@ -0,0 +1,29 @@
+#!/bin/sh
+# Symbol table scaling: compiles programs declaring N global variables and
+# assigning each one from the previous, and prints the compile time per N.
+#
+#   sh bench/idents.sh [PL0] [N...]
+set -e
+pl0=${1:-./build/pl0}
+[ $# -gt 0 ] && shift
+sizes=${*:-"1000 10000 100000"}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+for n in $sizes; do
+  awk -v n="$n" 'BEGIN {
+    printf "var v0"
+    for (i = 1; i < n; i++) printf ", v%d", i
+    print ";"
+    print "begin"
+    print "  v0 := 1;"
+    for (i = 1; i < n; i++) printf "  v%d := v%d + 1;\n", i, i - 1
+    printf "  write v%d\n", n - 1
+    print "end"
+  }' > "$dir/idents$n.plz"
+
+  start=$(date +%s%N)
+  "$pl0" -o "$dir/idents$n.plzc" "$dir/idents$n.plz"
+  end=$(date +%s%N)
+  echo "$n identifiers: $(( (end - start) / 1000000 )) ms"
+done
@@ -0,0 +1,39 @@
+#!/bin/sh
+# Parallel LLVM codegen scaling: compiles a program with N functions to an
+# object file with llvmpl0 -O2 -j J and prints the wall time per J.
+#
+#   sh bench/llvm_jobs.sh [LLVMPL0] [N]
+set -e
+llvmpl0=${1:-./build/llvmpl0}
+n=${2:-5000}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# Every function has a loop and some arithmetic, so optimization and
+# instruction selection dominate over parsing.
+awk -v n="$n" 'BEGIN {
+  for (i = 0; i < n; i++) {
+    printf "function f%d(a, b)\n", i
+    print "var s, k;"
+    print "begin"
+    print "  s := 0; k := 0;"
+    print "  while k < a do"
+    print "  begin"
+    printf "    if odd k then s := s + k * %d - b;\n", i + 3
+    printf "    if k / %d > b then s := s - k / %d;\n", i % 7 + 1, i % 5 + 2
+    print "    k := k + 1"
+    print "  end;"
+    print "  return s"
+    print "end;"
+  }
+  print "begin"
+  print "  write f0(10, 1)"
+  print "end"
+}' > "$dir/many.plz"
+
+for jobs in 1 2 4 8; do
+  start=$(date +%s%N)
+  "$llvmpl0" -O2 -j "$jobs" -c -o "$dir/many.o" "$dir/many.plz"
+  end=$(date +%s%N)
+  echo "-j $jobs: $(( (end - start) / 1000000 )) ms"
+done
@@ -0,0 +1,381 @@
+// Runtime benchmark across the backends. Every workload in the corpus is
+// compiled once per engine (to a .plzc file for the VM engines, to an
+// executable for LLVM) and then run repeatedly; only the runs are timed.
+// Results go to stdout as JSON, a summary table to stderr. The exit status is
+// 1 if any engine failed, including one whose compiler is missing; use
+// --engines to leave such engines out.
+//
+//   pl0bench [--repeat N] [--warmup N] [--engines=a,b,...] [--json FILE]
+//            [--pl0 PATH] [--llvmpl0 PATH] [FILE.plz...]
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+struct Engine {
+  std::string name;
+  std::string backend; // "vm" or "llvm"
+  std::string opt;     // optimization level as passed to the compiler
+  std::vector<std::string> compile; // + input and output paths
+  std::vector<std::string> run;     // + compiled path, unless native
+  bool native;                      // the compiled file is run directly
+};
+
+struct Result {
+  std::string workload;
+  const Engine *engine;
+  std::vector<double> times; // ms
+  bool ok = true;
+  std::string error;
+};
+
+struct Process {
+  int status = -1;
+  std::string output;
+  double ms = 0;
+};
+
+// Runs argv with stdout captured and stderr passed through.
+static Process run_process(const std::vector<std::string> &argv) {
+  Process process;
+  int fds[2];
+  if (pipe(fds) != 0) {
+    return process;
+  }
+  std::vector<char *> args;
+  for (const auto &arg : argv) {
+    args.push_back(const_cast<char *>(arg.c_str()));
+  }
+  args.push_back(nullptr);
+
+  auto start = std::chrono::steady_clock::now();
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    execv(args[0], args.data());
+    _exit(127);
+  }
+  close(fds[1]);
+  if (pid < 0) {
+    close(fds[0]);
+    return process;
+  }
+  char buf[4096];
+  ssize_t size;
+  while ((size = read(fds[0], buf, sizeof(buf))) != 0) {
+    if (size < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    process.output.append(buf, size);
+  }
+  close(fds[0]);
+  int status;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+  }
+  auto end = std::chrono::steady_clock::now();
+  process.status = status;
+  process.ms = std::chrono::duration<double, std::milli>(end - start).count();
+  return process;
+}
+
+static bool succeeded(const Process &process) {
+  return WIFEXITED(process.status) && WEXITSTATUS(process.status) == 0;
+}
+
+static std::vector<std::string> concat(std::vector<std::string> args,
+                                       const std::vector<std::string> &more) {
+  args.insert(args.end(), more.begin(), more.end());
+  return args;
+}
+
+static std::vector<Engine> engines(const std::string &pl0,
+                                   const std::string &llvmpl0) {
+  std::vector<Engine> list;
+  const char *vm_opts[] = {"O0", "O1"};
+  for (const char *opt : vm_opts) {
+    std::vector<std::string> compile = {pl0};
+    if (std::string(opt) == "O1") {
+      compile.push_back("-O");
+    }
+    compile.push_back("-o");
+    list.push_back({std::string("switch-") + opt, "vm", opt, compile,
+                    {pl0, "--dispatch=switch"}, false});
+    list.push_back({std::string("threaded-") + opt, "vm", opt, compile,
+                    {pl0, "--dispatch=threaded"}, false});
+    list.push_back({std::string("jit-") + opt, "vm", opt, compile,
+                    {pl0, "--jit"}, false});
+    list.push_back({std::string("tiered-") + opt, "vm", opt, compile,
+                    {pl0, "--tiered"}, false});
+  }
+  const char *llvm_opts[] = {"O0", "O1", "O2", "O3"};
+  for (const char *opt : llvm_opts) {
+    list.push_back({std::string("llvm-") + opt, "llvm", opt,
+                    {llvmpl0, std::string("-") + opt, "--emit=exe", "-o"},
+                    {},
+                    true});
+  }
+  return list;
+}
+
+static std::vector<std::string> default_corpus() {
+  std::vector<std::string> files;
+  if (DIR *dir = opendir(PL0_BENCH_CORPUS)) {
+    while (struct dirent *entry = readdir(dir)) {
+      std::string name = entry->d_name;
+      if (name.size() > 4 && name.compare(name.size() - 4, 4, ".plz") == 0) {
+        files.push_back(std::string(PL0_BENCH_CORPUS) + "/" + name);
+      }
+    }
+    closedir(dir);
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+static std::string workload_name(const std::string &path) {
+  size_t slash = path.find_last_of('/');
+  std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+  size_t dot = name.find_last_of('.');
+  return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+static double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  size_t n = values.size();
+  return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+static double mean(const std::vector<double> &values) {
+  double sum = 0;
+  for (double v : values) {
+    sum += v;
+  }
+  return sum / values.size();
+}
+
+// Sample variance.
+static double variance(const std::vector<double> &values) {
+  if (values.size() < 2) {
+    return 0;
+  }
+  double m = mean(values), sum = 0;
+  for (double v : values) {
+    sum += (v - m) * (v - m);
+  }
+  return sum / (values.size() - 1);
+}
+
+static std::string json_string(const std::string &str) {
+  std::string out = "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+static void print_json(std::ostream &out, const std::vector<Result> &results,
+                       int repeat, int warmup) {
+  out << "{\"repeat\":" << repeat << ",\"warmup\":" << warmup
+      << ",\"unit\":\"ms\",\"results\":[";
+  const char *sep = "\n";
+  for (const auto &r : results) {
+    out << sep << "{\"workload\":" << json_string(r.workload)
+        << ",\"engine\":" << json_string(r.engine->name)
+        << ",\"backend\":" << json_string(r.engine->backend)
+        << ",\"opt\":" << json_string(r.engine->opt)
+        << ",\"ok\":" << (r.ok ? "true" : "false");
+    if (!r.times.empty()) {
+      out << ",\"runs\":" << r.times.size() << ",\"median\":" << median(r.times)
+          << ",\"mean\":" << mean(r.times)
+          << ",\"variance\":" << variance(r.times)
+          << ",\"min\":" << *std::min_element(r.times.begin(), r.times.end())
+          << ",\"max\":" << *std::max_element(r.times.begin(), r.times.end())
+          << ",\"times\":[";
+      for (size_t i = 0; i < r.times.size(); i++) {
+        out << (i ? "," : "") << r.times[i];
+      }
+      out << ']';
+    }
+    if (!r.error.empty()) {
+      out << ",\"error\":" << json_string(r.error);
+    }
+    out << '}';
+    sep = ",\n";
+  }
+  out << "\n]}\n";
+}
+
+static void print_table(std::ostream &out, const std::vector<Result> &results) {
+  out << std::left << std::setw(12) << "workload" << std::setw(14) << "engine"
+      << std::right << std::setw(12) << "median ms" << std::setw(12)
+      << "stddev ms" << "  status\n";
+  out << std::fixed << std::setprecision(2);
+  for (const auto &r : results) {
+    out << std::left << std::setw(12) << r.workload << std::setw(14)
+        << r.engine->name << std::right;
+    if (r.times.empty()) {
+      out << std::setw(12) << "-" << std::setw(12) << "-";
+    } else {
+      out << std::setw(12) << median(r.times) << std::setw(12)
+          << std::sqrt(variance(r.times));
+    }
+    out << "  " << (r.ok ? "ok" : r.error) << '\n';
+  }
+}
+
+static void usage(const char *name) {
+  std::cerr << "usage: " << name
+            << " [--repeat N] [--warmup N] [--engines=a,b,...] [--json FILE]"
+               " [--pl0 PATH] [--llvmpl0 PATH] [FILE.plz...]"
+            << std::endl;
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  int repeat = 5;
+  int warmup = 1;
+  std::string pl0 = PL0_BIN;
+  std::string llvmpl0 = LLVMPL0_BIN;
+  std::string json_path;
+  std::vector<std::string> selected;
+  std::vector<std::string> files;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--repeat" && i + 1 < argc) {
+      repeat = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--warmup" && i + 1 < argc) {
+      warmup = std::max(0, std::atoi(argv[++i]));
+    } else if (arg == "--pl0" && i + 1 < argc) {
+      pl0 = argv[++i];
+    } else if (arg == "--llvmpl0" && i + 1 < argc) {
+      llvmpl0 = argv[++i];
+    } else if (arg == "--json" && i + 1 < argc) {
+      json_path = argv[++i];
+    } else if (arg.compare(0, 10, "--engines=") == 0) {
+      std::stringstream list(arg.substr(10));
+      std::string name;
+      while (std::getline(list, name, ',')) {
+        selected.push_back(name);
+      }
+    } else if (arg[0] == '-') {
+      usage(argv[0]);
+    } else {
+      files.push_back(arg);
+    }
+  }
+  if (files.empty()) {
+    files = default_corpus();
+  }
+  if (files.empty()) {
+    std::cerr << "error: no workloads" << std::endl;
+    return 1;
+  }
+
+  char dir_template[] = "/tmp/pl0bench.XXXXXX";
+  if (mkdtemp(dir_template) == nullptr) {
+    std::cerr << "error: cannot create a temporary directory" << std::endl;
+    return 1;
+  }
+  const std::string dir = dir_template;
+
+  std::vector<Engine> all = engines(pl0, llvmpl0);
+  std::vector<Result> results;
+  for (const auto &file : files) {
+    const std::string workload = workload_name(file);
+    std::string expected;
+    bool have_expected = false;
+    for (const auto &engine : all) {
+      if (!selected.empty() && std::find(selected.begin(), selected.end(),
+                                         engine.name) == selected.end()) {
+        continue;
+      }
+      std::cerr << workload << " " << engine.name << "..." << std::endl;
+      Result result;
+      result.workload = workload;
+      result.engine = &engine;
+
+      const std::string compiled = dir + "/" + workload + "-" + engine.name +
+                                   (engine.native ? "" : ".plzc");
+      Process build = run_process(concat(engine.compile, {compiled, file}));
+      if (!succeeded(build)) {
+        result.ok = false;
+        result.error = "compile failed";
+        results.push_back(result);
+        continue;
+      }
+      const std::vector<std::string> command =
+          engine.native ? std::vector<std::string>{compiled}
+                        : concat(engine.run, {compiled});
+
+      for (int i = 0; i < warmup + repeat && result.ok; i++) {
+        Process run = run_process(command);
+        if (!succeeded(run)) {
+          result.ok = false;
+          result.error = "run failed";
+        } else if (have_expected && run.output != expected) {
+          result.ok = false;
+          result.error = "wrong output";
+        } else {
+          expected = run.output;
+          have_expected = true;
+          if (i >= warmup) {
+            result.times.push_back(run.ms);
+          }
+        }
+      }
+      unlink(compiled.c_str());
+      results.push_back(result);
+    }
+  }
+  rmdir(dir.c_str());
+
+  print_table(std::cerr, results);
+  if (json_path.empty()) {
+    print_json(std::cout, results, repeat, warmup);
+  } else {
+    std::ofstream json(json_path);
+    print_json(json, results, repeat, warmup);
+    if (!json) {
+      std::cerr << "error: cannot write " << json_path << std::endl;
+      return 1;
+    }
+  }
+  size_t failed = 0;
+  for (const auto &r : results) {
+    if (!r.ok) {
+      failed++;
+    }
+  }
+  if (failed != 0) {
+    std::cerr << "error: " << failed << " of " << results.size()
+              << " runs failed" << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,226 @@
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "./bytecode_file.hpp"
+
+using namespace pl0;
+
+static const char magic[4] = {'P', 'L', 'Z', 'C'};
+static const uint32_t version = 6;
+static const uint32_t byte_order_mark = 0x01020304;
+
+uint64_t pl0::hash_bytes(const void *data, size_t size) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// The identity of /proc/self/exe: a rebuilt or replaced pl0 is a new file,
+// or at least has a new modification time.
+uint64_t pl0::compiler_id() {
+  static const uint64_t id = [] {
+    struct stat st;
+    if (stat("/proc/self/exe", &st) != 0) {
+      return uint64_t(0);
+    }
+    const uint64_t fields[] = {
+        uint64_t(st.st_dev), uint64_t(st.st_ino), uint64_t(st.st_size),
+        uint64_t(st.st_mtim.tv_sec), uint64_t(st.st_mtim.tv_nsec)};
+    uint64_t hash = hash_bytes(fields, sizeof(fields));
+    return hash != 0 ? hash : 1;
+  }();
+  return id;
+}
+
+static size_t align(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+template <typename T>
+static void put(std::vector<uint8_t> &image, size_t offset, const T &value) {
+  memcpy(&image[offset], &value, sizeof(value));
+}
+
+static void write_all(int fd, const uint8_t *data, size_t size) {
+  while (size > 0) {
+    ssize_t written = ::write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw "cannot write bytecode file";
+    }
+    data += written;
+    size -= written;
+  }
+}
+
+void pl0::write_bytecode(const std::string &path, CodeView code,
+                         const FunctionTable &functions, uint64_t source_hash,
+                         uint32_t flags) {
+  std::string names;
+  std::vector<FunctionRecord> records;
+  for (const auto &func : functions) {
+    FunctionRecord record = {};
+    record.name_offset = names.size();
+    record.name_size = func.name.size();
+    record.entry = func.entry;
+    record.end = func.end;
+    record.level = func.level;
+    record.params = func.params;
+    records.push_back(record);
+    names += func.name;
+  }
+
+  BytecodeHeader header = {};
+  memcpy(header.magic, magic, sizeof(magic));
+  header.version = version;
+  header.byte_order = byte_order_mark;
+  header.flags = flags;
+  header.source_hash = source_hash;
+  header.compiler = compiler_id();
+  header.code_offset = align(sizeof(BytecodeHeader), alignof(Code));
+  header.code_count = code.size();
+  header.function_offset =
+      align(header.code_offset + code.size() * sizeof(Code),
+            alignof(FunctionRecord));
+  header.function_count = records.size();
+  header.names_offset =
+      header.function_offset + records.size() * sizeof(FunctionRecord);
+  header.names_size = names.size();
+
+  std::vector<uint8_t> image(header.names_offset + names.size());
+  memcpy(&image[header.code_offset], code.data(), code.size() * sizeof(Code));
+  for (size_t i = 0; i < records.size(); i++) {
+    put(image, header.function_offset + i * sizeof(FunctionRecord),
+        records[i]);
+  }
+  memcpy(&image[header.names_offset], names.data(), names.size());
+  header.checksum = hash_bytes(&image[sizeof(BytecodeHeader)],
+                               image.size() - sizeof(BytecodeHeader));
+  put(image, 0, header);
+
+  // Write a private temporary file and rename it into place. The counter
+  // keeps threads of one process writing the same path apart.
+  static std::atomic<unsigned> serial(0);
+  std::string temp = path + ".tmp." + std::to_string(getpid()) + "." +
+                     std::to_string(serial++);
+  int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw "cannot create bytecode file";
+  }
+  try {
+    write_all(fd, image.data(), image.size());
+  } catch (...) {
+    close(fd);
+    unlink(temp.c_str());
+    throw;
+  }
+  close(fd);
+  if (rename(temp.c_str(), path.c_str()) != 0) {
+    unlink(temp.c_str());
+    throw "cannot create bytecode file";
+  }
+}
+
+MappedBytecode::MappedBytecode(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw "cannot open bytecode file";
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(BytecodeHeader)) {
+    close(fd);
+    throw "not a bytecode file";
+  }
+  length = st.st_size;
+  // Shared and read-only: every process running this file uses the same
+  // page cache pages.
+  void *mapped = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    throw "cannot map bytecode file";
+  }
+  base = static_cast<const uint8_t *>(mapped);
+  head = reinterpret_cast<const BytecodeHeader *>(base);
+
+  try {
+    verify();
+  } catch (...) {
+    munmap(const_cast<uint8_t *>(base), length);
+    throw;
+  }
+}
+
+MappedBytecode::~MappedBytecode() {
+  munmap(const_cast<uint8_t *>(base), length);
+}
+
+CodeView MappedBytecode::code() const {
+  return CodeView(reinterpret_cast<const Code *>(at(head->code_offset)),
+                  head->code_count);
+}
+
+FunctionTable MappedBytecode::functions() const {
+  FunctionTable functions;
+  for (size_t i = 0; i < head->function_count; i++) {
+    FunctionRecord record;
+    memcpy(&record, at(head->function_offset + i * sizeof(FunctionRecord)),
+           sizeof(record));
+    const char *name =
+        reinterpret_cast<const char *>(at(head->names_offset)) +
+        record.name_offset;
+    functions.push_back({std::string(name, record.name_size), record.entry,
+                         record.end, record.level, record.params});
+  }
+  return functions;
+}
+
+// Whether count items of size bytes at offset lie inside a file of length.
+static bool in_bounds(uint64_t offset, uint64_t count, uint64_t size,
+                      uint64_t length) {
+  return offset <= length && count <= (length - offset) / size;
+}
+
+void MappedBytecode::verify() const {
+  if (memcmp(head->magic, magic, sizeof(magic)) != 0) {
+    throw "not a bytecode file";
+  }
+  if (head->version != version || head->byte_order != byte_order_mark) {
+    throw "unsupported bytecode file version";
+  }
+  if (head->code_offset % alignof(Code) != 0 ||
+      !in_bounds(head->code_offset, head->code_count, sizeof(Code), length) ||
+      !in_bounds(head->function_offset, head->function_count,
+                 sizeof(FunctionRecord), length) ||
+      !in_bounds(head->names_offset, head->names_size, 1, length)) {
+    throw "truncated bytecode file";
+  }
+  if (hash_bytes(at(sizeof(BytecodeHeader)),
+                 length - sizeof(BytecodeHeader)) != head->checksum) {
+    throw "bytecode file checksum mismatch";
+  }
+
+  // The VM and the JIT trust their code, so reject anything they could not
+  // run safely.
+  for (size_t i = 0; i < head->function_count; i++) {
+    FunctionRecord record;
+    memcpy(&record, at(head->function_offset + i * sizeof(FunctionRecord)),
+           sizeof(record));
+    if (record.name_offset + uint64_t(record.name_size) > head->names_size) {
+      throw "invalid function table in bytecode file";
+    }
+  }
+  check_code(code(), functions());
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "./code.hpp"
+
+namespace pl0 {
+// On-disk image of decoded bytecode (.plzc). The Code array is stored exactly
+// as the VM runs it, so a mapped file executes in place and processes
+// running the same file share its pages.
+//
+//   BytecodeHeader
+//   Code[code_count]            at code_offset, 16-byte aligned
+//   FunctionRecord[function_count] at function_offset
+//   function names              at names_offset, not NUL terminated
+//
+// The checksum covers everything after the header. Files are only portable
+// between hosts with the same byte order and Code layout. compiler names the
+// build of pl0 that wrote the file, so that the compile cache can tell code
+// from an older compiler apart.
+struct BytecodeHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order; // byte_order_mark as written by the producer
+  uint32_t flags;      // BytecodeFlags the code was compiled with
+  uint64_t source_hash;
+  uint64_t compiler; // compiler_id() of the writer
+  uint64_t checksum;
+  uint64_t code_offset;
+  uint64_t code_count;
+  uint64_t function_offset;
+  uint64_t function_count;
+  uint64_t names_offset;
+  uint64_t names_size;
+};
+
+struct FunctionRecord {
+  uint32_t name_offset;
+  uint32_t name_size;
+  uint32_t entry;
+  uint32_t end;
+  uint16_t level;
+  uint16_t params;
+};
+
+enum BytecodeFlags : uint32_t {
+  Optimized = 1, // peephole pass applied
+  MiddleEnd = 2, // and the SSA middle end
+};
+
+// FNV-1a, used for both source hashes and file checksums.
+uint64_t hash_bytes(const void *data, size_t size);
+
+// Identifies the running pl0 executable: it changes whenever pl0 is rebuilt.
+// 0 if it cannot be told.
+uint64_t compiler_id();
+
+// Writes a .plzc file. The file appears under path atomically, so a reader
+// never maps a half written one.
+void write_bytecode(const std::string &path, CodeView code,
+                    const FunctionTable &functions, uint64_t source_hash,
+                    uint32_t flags);
+
+// A read-only mapping of a .plzc file. The constructor checks the header,
+// the checksum and the code itself with check_code(), and throws if anything
+// is off.
+class MappedBytecode {
+public:
+  explicit MappedBytecode(const std::string &path);
+  ~MappedBytecode();
+  MappedBytecode(const MappedBytecode &) = delete;
+  MappedBytecode &operator=(const MappedBytecode &) = delete;
+
+  const BytecodeHeader &header() const { return *head; }
+  CodeView code() const;
+  FunctionTable functions() const;
+
+private:
+  void verify() const;
+  const uint8_t *at(uint64_t offset) const { return base + offset; }
+
+private:
+  const uint8_t *base = nullptr;
+  size_t length = 0;
+  const BytecodeHeader *head = nullptr;
+};
+} // namespace pl0
@@ -0,0 +1,675 @@
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+#include "./code.hpp"
+
+using namespace pl0;
+
+static int32_t narrow(long long value) {
+  if (value < std::numeric_limits<int32_t>::min() ||
+      value > std::numeric_limits<int32_t>::max()) {
+    throw "operand does not fit the decoded format";
+  }
+  return static_cast<int32_t>(value);
+}
+
+static uint16_t narrow_level(long long level) {
+  if (level < 0 || level > std::numeric_limits<uint16_t>::max()) {
+    throw "nesting level does not fit the decoded format";
+  }
+  return static_cast<uint16_t>(level);
+}
+
+static uint16_t narrow_params(long long params) {
+  if (params < 0 || params > std::numeric_limits<uint16_t>::max()) {
+    throw "parameter count does not fit the decoded format";
+  }
+  return static_cast<uint16_t>(params);
+}
+
+// The form of Load or Store (op) that reaches the variable at (level, addr)
+// from a function at level own.
+static Code variable(Instruction op, long long own, long long level,
+                     long long addr) {
+  Code c = {};
+  if (own < 0) {
+    throw "variable used outside of a function";
+  }
+  if (level == own) {
+    c.op = op == Instruction::Load ? Instruction::LoadLocal
+                                   : Instruction::StoreLocal;
+  } else if (level == 0) {
+    c.op = op == Instruction::Load ? Instruction::LoadGlobal
+                                   : Instruction::StoreGlobal;
+  } else if (level < own) {
+    c.op = op;
+    c.level = narrow_level(level);
+  } else {
+    throw "variable of a function that does not enclose it";
+  }
+  c.addr = narrow(addr);
+  return c;
+}
+
+static Code make(Instruction op) {
+  Code c = {};
+  c.op = op;
+  return c;
+}
+
+// Follows a call target through the Jmp over nested functions.
+static size_t call_target(CodeView code, size_t addr) {
+  for (int i = 0; i < 16 && code[addr].op == Instruction::Jmp; i++) {
+    addr = code[addr].addr;
+  }
+  return addr;
+}
+
+// The enclosing function of each, the next one listed at a lower level, or
+// functions.size() for main.
+static std::vector<size_t> parents(const FunctionTable &functions) {
+  std::vector<size_t> parent(functions.size(), functions.size());
+  std::vector<size_t> open;
+  for (size_t f = functions.size(); f-- > 0;) {
+    while (!open.empty() &&
+           functions[open.back()].level >= functions[f].level) {
+      open.pop_back();
+    }
+    if (!open.empty()) {
+      parent[f] = open.back();
+    }
+    open.push_back(f);
+  }
+  return parent;
+}
+
+// The function whose frame holds the variables of level for code in f.
+static size_t owner(const FunctionTable &functions,
+                    const std::vector<size_t> &parent, size_t f,
+                    size_t level) {
+  while (f != functions.size() && functions[f].level > level) {
+    f = parent[f];
+  }
+  if (f == functions.size() || functions[f].level != level) {
+    throw "variable of a function that does not enclose it";
+  }
+  return f;
+}
+
+// Which functions have their variables used through the display by a
+// function nested in them.
+static std::vector<bool> find_reached(CodeView code,
+                                      const FunctionTable &functions,
+                                      const std::vector<size_t> &parent) {
+  std::vector<bool> reached(functions.size(), false);
+  for (size_t f = 0; f < functions.size(); f++) {
+    for (size_t i = functions[f].entry; i < functions[f].end; i++) {
+      const Code &c = code[i];
+      if (c.op == Instruction::Load || c.op == Instruction::Store) {
+        reached[owner(functions, parent, f, c.level)] = true;
+      }
+    }
+  }
+  return reached;
+}
+
+// Clears the level of Call, Ret and TailCall (both of its levels) wherever
+// the function whose frame they push or pop is not reached through the
+// display: no function nested in it uses its variables, so display entries
+// for its level are never read.
+static void skip_display(Bytecode &code, const FunctionTable &functions) {
+  const size_t none = functions.size();
+  const std::vector<bool> reached =
+      find_reached(code, functions, parents(functions));
+  std::vector<size_t> function_at(code.size(), none);
+  for (size_t f = 0; f < functions.size(); f++) {
+    function_at[functions[f].entry] = f;
+  }
+
+  auto callee = [&](size_t addr) {
+    size_t f = function_at[call_target(code, addr)];
+    if (f == none) {
+      throw "call to an unknown function";
+    }
+    return f;
+  };
+  for (size_t f = 0; f < functions.size(); f++) {
+    for (size_t i = functions[f].entry; i < functions[f].end; i++) {
+      Code &c = code[i];
+      switch (c.op) {
+      case Instruction::Call:
+        if (!reached[callee(c.addr)]) {
+          c.level = 0;
+        }
+        break;
+      case Instruction::Ret:
+        if (!reached[f]) {
+          c.level = 0;
+        }
+        break;
+      case Instruction::TailCall:
+        if (!reached[callee(c.addr)]) {
+          c.level = 0;
+        }
+        if (!reached[f]) {
+          c.caller.level = 0;
+        }
+        break;
+      default:
+        break;
+      }
+    }
+  }
+}
+
+Bytecode pl0::decode(const Program &program, FunctionTable &functions) {
+  // Program offset -> index in the decoded vector, for code addresses.
+  std::vector<int32_t> index_at(program.size() + 1, -1);
+  Bytecode code;
+  code.reserve(program.size() / 2 + 1);
+
+  size_t f = 0; // the function the instruction is in, if any
+  for (size_t i = 0; i < program.size();) {
+    while (f < functions.size() && functions[f].end <= i) {
+      f++;
+    }
+    const long long own = f < functions.size() && functions[f].entry <= i
+                              ? static_cast<long long>(functions[f].level)
+                              : -1;
+    index_at[i] = narrow(code.size());
+
+    Code c = {};
+    c.op = static_cast<Instruction>(program[i++]);
+    const long long *operand = &program[i];
+    i += operand_size(c.op);
+
+    // Code addresses stay Program offsets until every index is known.
+    switch (c.op) {
+    case Instruction::Load:
+    case Instruction::Store:
+      code.push_back(variable(c.op, own, operand[0], operand[1]));
+      continue;
+    case Instruction::Ret:
+      c.level = narrow_level(operand[0]);
+      c.addr = narrow(operand[1]);
+      break;
+    case Instruction::Call:
+      c.level = narrow_level(operand[0]);
+      c.addr = narrow(operand[1]);
+      break;
+    case Instruction::TailCall:
+      c.level = narrow_level(operand[0]);
+      c.addr = narrow(operand[1]);
+      c.caller.level = narrow_level(operand[2]);
+      c.caller.params = narrow_params(operand[3]);
+      c.caller.args = narrow(operand[4]);
+      break;
+    case Instruction::Literal:
+      c.value = operand[0];
+      break;
+    case Instruction::Ict:
+      c.addr = narrow(operand[0]);
+      break;
+    case Instruction::Jmp:
+    case Instruction::Jpc:
+      c.addr = narrow(operand[0]);
+      break;
+    case Instruction::LoadOp:
+      c.sub = static_cast<Instruction>(operand[2]);
+      if (operand[0] != own) {
+        code.push_back(
+            variable(Instruction::Load, own, operand[0], operand[1]));
+        code.push_back(make(c.sub));
+        continue;
+      }
+      c.addr = narrow(operand[1]);
+      break;
+    case Instruction::LiteralOp:
+      c.value = operand[0];
+      c.sub = static_cast<Instruction>(operand[1]);
+      break;
+    case Instruction::LoadLoadOp:
+      c.sub = static_cast<Instruction>(operand[4]);
+      if (operand[0] != own) {
+        code.push_back(
+            variable(Instruction::Load, own, operand[0], operand[1]));
+        if (operand[2] == own) {
+          Code op = make(Instruction::LoadOp);
+          op.addr = narrow(operand[3]);
+          op.sub = c.sub;
+          code.push_back(op);
+        } else {
+          code.push_back(
+              variable(Instruction::Load, own, operand[2], operand[3]));
+          code.push_back(make(c.sub));
+        }
+        continue;
+      }
+      if (operand[2] != own) {
+        code.push_back(
+            variable(Instruction::Load, own, operand[0], operand[1]));
+        code.push_back(
+            variable(Instruction::Load, own, operand[2], operand[3]));
+        code.push_back(make(c.sub));
+        continue;
+      }
+      c.addr = narrow(operand[1]);
+      c.rhs = narrow(operand[3]);
+      break;
+    case Instruction::CompareJump:
+      c.sub = static_cast<Instruction>(operand[0]);
+      c.addr = narrow(operand[1]);
+      break;
+    case Instruction::LiteralCompareJump:
+      c.value = operand[0];
+      c.sub = static_cast<Instruction>(operand[1]);
+      c.addr = narrow(operand[2]);
+      break;
+    case Instruction::LoadLoadCompareJump:
+      c.sub = static_cast<Instruction>(operand[4]);
+      c.addr = narrow(operand[5]);
+      if (operand[0] != own || operand[2] != own) {
+        Code jump = make(Instruction::CompareJump);
+        jump.sub = c.sub;
+        jump.addr = c.addr;
+        code.push_back(
+            variable(Instruction::Load, own, operand[0], operand[1]));
+        code.push_back(
+            variable(Instruction::Load, own, operand[2], operand[3]));
+        code.push_back(jump);
+        continue;
+      }
+      c.vars.lhs = narrow(operand[1]);
+      c.vars.rhs = narrow(operand[3]);
+      break;
+    case Instruction::LoadAddStore:
+      if (operand[0] != own) {
+        Code add = make(Instruction::LiteralOp);
+        add.value = operand[2];
+        add.sub = Instruction::Add;
+        code.push_back(
+            variable(Instruction::Load, own, operand[0], operand[1]));
+        code.push_back(add);
+        code.push_back(
+            variable(Instruction::Store, own, operand[0], operand[1]));
+        continue;
+      }
+      c.addr = narrow(operand[1]);
+      c.value = operand[2];
+      break;
+    default:
+      break;
+    }
+    code.push_back(c);
+  }
+  index_at[program.size()] = narrow(code.size());
+
+  auto target = [&](long long pos) {
+    if (pos < 0 || pos > static_cast<long long>(program.size()) ||
+        index_at[pos] < 0) {
+      throw "jump into the middle of an instruction";
+    }
+    return index_at[pos];
+  };
+  for (auto &c : code) {
+    if (c.op == Instruction::Jmp || c.op == Instruction::Jpc ||
+        c.op == Instruction::Call || c.op == Instruction::TailCall ||
+        c.op == Instruction::CompareJump ||
+        c.op == Instruction::LiteralCompareJump ||
+        c.op == Instruction::LoadLoadCompareJump) {
+      c.addr = target(c.addr);
+    }
+  }
+  for (auto &func : functions) {
+    func.entry = target(func.entry);
+    func.end = target(func.end);
+  }
+
+  // Falling off the end, or returning from main, lands on this Halt.
+  Code halt = {};
+  halt.op = Instruction::Halt;
+  code.push_back(halt);
+
+  skip_display(code, functions);
+  return code;
+}
+
+void pl0::print_program(CodeView code) {
+  for (size_t i = 0; i < code.size(); i++) {
+    const Code &c = code[i];
+    std::cout << i << ": " << c.op;
+    switch (c.op) {
+    case Instruction::Load:
+    case Instruction::Store:
+    case Instruction::Call:
+    case Instruction::Ret:
+      std::cout << ' ' << c.level << ' ' << c.addr;
+      break;
+    case Instruction::Literal:
+      std::cout << ' ' << c.value;
+      break;
+    case Instruction::Ict:
+    case Instruction::Jmp:
+    case Instruction::Jpc:
+    case Instruction::LoadLocal:
+    case Instruction::StoreLocal:
+    case Instruction::LoadGlobal:
+    case Instruction::StoreGlobal:
+      std::cout << ' ' << c.addr;
+      break;
+    case Instruction::LoadOp:
+      std::cout << ' ' << c.addr << ' ' << c.sub;
+      break;
+    case Instruction::LiteralOp:
+      std::cout << ' ' << c.value << ' ' << c.sub;
+      break;
+    case Instruction::LoadLoadOp:
+      std::cout << ' ' << c.addr << ' ' << c.rhs << ' ' << c.sub;
+      break;
+    case Instruction::CompareJump:
+      std::cout << ' ' << c.sub << ' ' << c.addr;
+      break;
+    case Instruction::LiteralCompareJump:
+      std::cout << ' ' << c.value << ' ' << c.sub << ' ' << c.addr;
+      break;
+    case Instruction::LoadLoadCompareJump:
+      std::cout << ' ' << c.vars.lhs << ' ' << c.vars.rhs << ' ' << c.sub
+                << ' ' << c.addr;
+      break;
+    case Instruction::LoadAddStore:
+      std::cout << ' ' << c.addr << ' ' << c.value;
+      break;
+    case Instruction::TailCall:
+      std::cout << ' ' << c.level << ' ' << c.addr << ' ' << c.caller.level
+                << ' ' << c.caller.params << ' ' << c.caller.args;
+      break;
+    default:
+      break;
+    }
+    std::cout << std::endl;
+  }
+}
+
+size_t pl0::display_size(CodeView code) {
+  size_t size = 1;
+  for (const auto &c : code) {
+    size = std::max<size_t>(size, c.level + 1);
+    if (c.op == Instruction::TailCall) {
+      size = std::max<size_t>(size, c.caller.level + 1);
+    }
+  }
+  return size;
+}
+
+// Largest frame check_code() accepts, in slots after the two links.
+static const int32_t max_locals = 1 << 20;
+
+void pl0::check_code(CodeView code, const FunctionTable &functions) {
+  const size_t none = functions.size();
+  if (code.size() == 0 || code[code.size() - 1].op != Instruction::Halt) {
+    throw "code does not end in Halt";
+  }
+  if (functions.empty() || functions.back().level != 0 ||
+      functions.back().params != 0) {
+    throw "code has no main function";
+  }
+  size_t end = 0;
+  for (size_t f = 0; f < functions.size(); f++) {
+    const Function &func = functions[f];
+    if (func.entry < end || func.entry >= func.end ||
+        func.end >= code.size() || (func.level == 0) != (f == none - 1)) {
+      throw "invalid function table";
+    }
+    end = func.end;
+  }
+  const std::vector<size_t> parent = parents(functions);
+  for (size_t f = 0; f + 1 < functions.size(); f++) {
+    if (functions[parent[f]].level + 1 != functions[f].level) {
+      throw "invalid function nesting";
+    }
+  }
+
+  // Every jump target is an index into code, so call targets can be
+  // followed.
+  for (const auto &c : code) {
+    if (c.op > Instruction::Halt) {
+      throw "invalid instruction";
+    }
+    if (target_operand(c.op) >= 0 &&
+        (c.addr < 0 || static_cast<size_t>(c.addr) >= code.size())) {
+      throw "jump out of the code";
+    }
+    bool valid = true;
+    switch (c.op) {
+    case Instruction::CompareJump:
+    case Instruction::LiteralCompareJump:
+    case Instruction::LoadLoadCompareJump:
+      valid = is_compare(c.sub);
+      break;
+    case Instruction::LoadOp:
+    case Instruction::LiteralOp:
+    case Instruction::LoadLoadOp:
+      valid = is_binary_op(c.sub);
+      break;
+    default:
+      break;
+    }
+    if (!valid) {
+      throw "invalid operator";
+    }
+  }
+
+  std::vector<size_t> function_at(code.size(), none);
+  std::vector<int32_t> locals(functions.size());
+  for (size_t f = 0; f < functions.size(); f++) {
+    const Code &ict = code[functions[f].entry];
+    if (ict.op != Instruction::Ict || ict.addr < 0 || ict.addr > max_locals) {
+      throw "function does not start with a valid Ict";
+    }
+    function_at[functions[f].entry] = f;
+    locals[f] = ict.addr;
+  }
+  if (function_at[call_target(code, 0)] != none - 1) {
+    throw "code does not start with main";
+  }
+  const std::vector<bool> reached = find_reached(code, functions, parent);
+
+  // Parameters are at -params..-1 and locals from 2, after the links.
+  auto check_variable = [&](size_t f, int32_t addr) {
+    const long long params = functions[f].params;
+    if (!(addr < 0 && addr >= -params) &&
+        !(addr >= 2 && addr < 2 + locals[f])) {
+      throw "variable outside of its frame";
+    }
+  };
+  // The level a Call, Ret or TailCall of f must carry.
+  auto display_level = [&](size_t f) {
+    return reached[f] ? functions[f].level : 0;
+  };
+  // A function nested in caller or in one of its enclosing functions, or
+  // with tail false in one of its enclosing functions only.
+  auto callee = [&](size_t caller, int32_t addr, bool tail) {
+    const size_t g = function_at[call_target(code, addr)];
+    if (g == none || g == none - 1) {
+      throw "call to an unknown function";
+    }
+    size_t scope = tail ? parent[caller] : caller;
+    while (scope != none && scope != parent[g]) {
+      scope = parent[scope];
+    }
+    if (scope == none) {
+      throw "call to a function out of scope";
+    }
+    return g;
+  };
+
+  // Operand stack depth before each instruction, or -1 if not reached yet:
+  // every path must agree, and no instruction may take more than there is.
+  std::vector<long long> depth(code.size(), -1);
+  for (size_t f = 0; f < functions.size(); f++) {
+    const Function &func = functions[f];
+    std::vector<size_t> work;
+    auto flow = [&](size_t i, long long d) {
+      if (i == func.end && code[i].op == Instruction::Halt) {
+        return; // main's body ends in the Halt at its end
+      }
+      if (i <= func.entry || i >= func.end) {
+        throw "control leaves its function";
+      }
+      if (depth[i] < 0) {
+        depth[i] = d;
+        work.push_back(i);
+      } else if (depth[i] != d) {
+        throw "operand stack depth differs between paths";
+      }
+    };
+    flow(func.entry + 1, 0);
+    while (!work.empty()) {
+      const size_t i = work.back();
+      work.pop_back();
+      const Code &c = code[i];
+      long long d = depth[i];
+      auto take = [&](long long count) {
+        if (d < count) {
+          throw "operand stack underflow";
+        }
+        d -= count;
+      };
+      bool next = true;
+      switch (c.op) {
+      case Instruction::Load:
+      case Instruction::Store:
+        if (c.level == 0 || c.level >= func.level) {
+          throw "variable of a function that does not enclose it";
+        }
+        check_variable(owner(functions, parent, f, c.level), c.addr);
+        if (c.op == Instruction::Load) {
+          d++;
+        } else {
+          take(1);
+        }
+        break;
+      case Instruction::LoadLocal:
+      case Instruction::StoreLocal:
+        check_variable(f, c.addr);
+        if (c.op == Instruction::LoadLocal) {
+          d++;
+        } else {
+          take(1);
+        }
+        break;
+      case Instruction::LoadGlobal:
+      case Instruction::StoreGlobal:
+        check_variable(none - 1, c.addr);
+        if (c.op == Instruction::LoadGlobal) {
+          d++;
+        } else {
+          take(1);
+        }
+        break;
+      case Instruction::Call: {
+        const size_t g = callee(f, c.addr, false);
+        if (c.level != display_level(g)) {
+          throw "call with a wrong display level";
+        }
+        take(functions[g].params);
+        d++;
+        break;
+      }
+      case Instruction::Ret:
+        if (c.level != display_level(f) ||
+            c.addr != static_cast<int32_t>(func.params)) {
+          throw "return that does not match its function";
+        }
+        take(1);
+        next = false;
+        break;
+      case Instruction::TailCall: {
+        const size_t g = callee(f, c.addr, true);
+        if (c.level != display_level(g) ||
+            c.caller.level != display_level(f) ||
+            c.caller.params != func.params ||
+            c.caller.args != static_cast<int32_t>(functions[g].params)) {
+          throw "tail call that does not match its functions";
+        }
+        take(c.caller.args);
+        next = false;
+        break;
+      }
+      case Instruction::Literal:
+        d++;
+        break;
+      case Instruction::Ict:
+        throw "Ict inside a function body";
+      case Instruction::Jmp:
+        flow(c.addr, d);
+        next = false;
+        break;
+      case Instruction::Jpc:
+        take(1);
+        flow(c.addr, d);
+        break;
+      case Instruction::Neg:
+      case Instruction::Odd:
+        take(1);
+        d++;
+        break;
+      case Instruction::Add:
+      case Instruction::Sub:
+      case Instruction::Mul:
+      case Instruction::Div:
+      case Instruction::Eq:
+      case Instruction::Neq:
+      case Instruction::Less:
+      case Instruction::LessEq:
+      case Instruction::Greater:
+      case Instruction::GreaterEq:
+        take(2);
+        d++;
+        break;
+      case Instruction::Write:
+        take(1);
+        break;
+      case Instruction::Writeln:
+        break;
+      case Instruction::LoadOp:
+        check_variable(f, c.addr);
+        take(1);
+        d++;
+        break;
+      case Instruction::LiteralOp:
+        take(1);
+        d++;
+        break;
+      case Instruction::LoadLoadOp:
+        check_variable(f, c.addr);
+        check_variable(f, c.rhs);
+        d++;
+        break;
+      case Instruction::CompareJump:
+        take(2);
+        flow(c.addr, d);
+        break;
+      case Instruction::LoadAddStore:
+        check_variable(f, c.addr);
+        break;
+      case Instruction::LiteralCompareJump:
+        take(1);
+        flow(c.addr, d);
+        break;
+      case Instruction::LoadLoadCompareJump:
+        check_variable(f, c.vars.lhs);
+        check_variable(f, c.vars.rhs);
+        flow(c.addr, d);
+        break;
+      case Instruction::Halt:
+        next = false;
+        break;
+      }
+      if (next) {
+        flow(i + 1, d);
+      }
+    }
+  }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "./instruction.hpp"
+
+namespace pl0 {
+// One decoded instruction. The VM runs a vector of these, built once from
+// Program, instead of re-reading 8-byte operand slots on every dispatch.
+// Code addresses are indices into that vector, which always ends in Halt.
+//
+// Variables of the current frame are reached through the frame pointer and
+// those of main by their absolute slot; only Load and Store of an enclosing
+// function's variable go through the display. The variables of LoadOp,
+// LoadLoadOp, LoadLoadCompareJump and LoadAddStore are always in the
+// current frame. The jump forms keep their target in addr. Call, Ret
+// and TailCall have level 0 for a function that no nested function reaches
+// through the display, which is then neither saved nor set.
+struct Code {
+  Instruction op;
+  Instruction sub; // operator of LoadOp, LiteralOp, LoadLoadOp, *CompareJump
+  uint16_t level;
+  int32_t addr; // variable address, code index, or a count
+  // The frame a TailCall replaces: its level and parameter count, and the
+  // number of arguments passed to the callee.
+  struct Frame {
+    uint16_t level;
+    uint16_t params;
+    int32_t args;
+  };
+
+  // The variables LoadLoadCompareJump compares.
+  struct Vars {
+    int32_t lhs;
+    int32_t rhs;
+  };
+
+  union {
+    long long value; // Literal, LiteralOp, LoadAddStore, LiteralCompareJump
+    int32_t rhs;     // address of LoadLoadOp's second variable
+    Frame caller;    // TailCall
+    Vars vars;       // LoadLoadCompareJump
+  };
+};
+static_assert(sizeof(Code) == 16, "Code should stay two words");
+
+using Bytecode = std::vector<Code>;
+
+// Read-only view of decoded code that lives elsewhere, such as a Bytecode or
+// a mapped .plzc file.
+class CodeView {
+public:
+  CodeView(const Code *data, size_t size) : ptr(data), count(size) {}
+  CodeView(const Bytecode &code) : ptr(code.data()), count(code.size()) {}
+
+  const Code *data() const { return ptr; }
+  size_t size() const { return count; }
+  const Code &operator[](size_t i) const { return ptr[i]; }
+  const Code *begin() const { return ptr; }
+  const Code *end() const { return ptr + count; }
+
+private:
+  const Code *ptr;
+  size_t count;
+};
+
+// Function entries are turned from Program offsets into indices. They also
+// tell which function each instruction is in, and so which frame holds each
+// variable it uses.
+Bytecode decode(const Program &program, FunctionTable &functions);
+void print_program(CodeView code);
+
+// Entries a display needs for every level code refers to.
+size_t display_size(CodeView code);
+
+// Throws unless code is decoded code the VM and the JIT can run without
+// leaving their stacks, as decode() would produce it for functions: every
+// variable inside the frame it names, calls and returns that match the
+// function table and the display levels, and an operand stack depth that
+// every path agrees on and never takes below zero. Opcodes, operators and
+// jump targets are checked too; Halt ends a path anywhere.
+void check_code(CodeView code, const FunctionTable &functions);
+} // namespace pl0
@@ -1,205 +1,97 @@
 #include <cassert>
+#include <climits>
 #include <string>
 
 #include "./compiler.hpp"
-#include "./token.hpp"
 
 using namespace pl0;
 
 Program Compiler::compile() {
-  ident_table.appendFunc("main", 0, 0);
-  block(0);
-  return program;
+  entry_points.assign(ast.functions.size(), 0);
+  size_t main = block(0);
+  function_table[main].end = program.size();
+  append(Instruction::Halt);
+  return std::move(program);
 }
 
-void Compiler::block(size_t func_id) {
-  size_t var_size = 0;
+size_t Compiler::block(size_t function) {
+  const ast::Function &func = ast.function(function);
   size_t backpatch_target = append(Instruction::Jmp, 0);
-  while (true) {
-    if (cur_token.type == TokenType::Const) {
-      constDecl();
-    } else if (cur_token.type == TokenType::Var) {
-      varDecl(&var_size);
-    } else if (cur_token.type == TokenType::Function) {
-      functionDecl();
-    } else {
-      break;
-    }
+  for (uint32_t i = 0; i < func.nested.size; i++) {
+    functionDecl(ast.list(func.nested.first)[i]);
   }
   backpatch(backpatch_target);
 
-  append(Instruction::Ict, var_size);
-
-  cur_func_id = func_id;
-  statement();
-}
-
-void Compiler::constDecl() {
-  takeToken(TokenType::Const);
-  while (true) {
-    if (cur_token.type != TokenType::Ident) {
-      throw "expected ident";
-    }
-
-    std::string const_name = cur_token.ident;
-    nextToken();
-
-    if (cur_token.type != TokenType::Equal) {
-      throw "expected equal";
-    }
-    nextToken();
-
-    if (cur_token.type != TokenType::Integer) {
-      throw "expected integer";
-    }
-
-    ident_table.appendConst(const_name, cur_token.integer);
-    nextToken();
-
-    if (cur_token.type == TokenType::Colon) {
-      nextToken();
-      // continue;
-    } else if (cur_token.type == TokenType::Semicolon) {
-      nextToken();
-      break;
-    } else {
-      throw "unexpected at constDecl";
-    }
-  }
-}
-
-void Compiler::varDecl(size_t *var_size) {
-  takeToken(TokenType::Var);
-  while (true) {
-    if (cur_token.type != TokenType::Ident) {
-      throw "expected ident";
-    }
-
-    ident_table.appendVar(cur_token.ident);
-    (*var_size)++;
-    nextToken();
+  size_t index = function_table.size();
+  function_table.push_back({Interner::global().name(func.name).str(),
+                            program.size(), 0, func.level, func.params});
+  append(Instruction::Ict, func.locals);
 
-    if (cur_token.type == TokenType::Colon) {
-      nextToken();
-      // continue;
-    } else if (cur_token.type == TokenType::Semicolon) {
-      nextToken();
-      break;
-    } else {
-      throw "unexpected at varDecl";
-    }
-  }
+  cur_function = function;
+  statement(func.body);
+  return index;
 }
 
-void Compiler::functionDecl() {
-  takeToken(TokenType::Function);
-  if (cur_token.type != TokenType::Ident) {
-    throw "expected ident but";
-  }
-  std::string func_name = std::move(cur_token.ident);
-  nextToken();
-
-  size_t entry_point = program.size();
+void Compiler::functionDecl(size_t function) {
+  const ast::Function &func = ast.function(function);
+  entry_points[function] = label();
   size_t backpatch_target = append(Instruction::Jmp, 0);
-
-  std::vector<std::string> params;
-  takeToken(TokenType::ParenL);
-  while (true) {
-    if (cur_token.type != TokenType::Ident) {
-      break;
-    }
-
-    params.push_back(cur_token.ident);
-    nextToken();
-    if (cur_token.type == TokenType::Colon) {
-      nextToken();
-      // continue;
-    } else {
-      break;
-    }
-  }
-  takeToken(TokenType::ParenR);
-
-  size_t func_id =
-      ident_table.appendFunc(func_name, entry_point, params.size());
-
-  ident_table.enterBlock();
-  long long offset = -params.size();
-  for (const auto &param : params) {
-    ident_table.appendParam(param, offset++);
-  }
-
   backpatch(backpatch_target);
-  block(func_id);
-  takeToken(TokenType::Semicolon);
-  append(Instruction::Ret, ident_table.getLevel(), params.size());
-  ident_table.leaveBlock();
+  size_t index = block(function);
+  append(Instruction::Ret, func.level, func.params);
+  function_table[index].end = program.size();
 }
 
-void Compiler::statement() {
+void Compiler::statement(ast::NodeId id) {
+  const ast::Node &node = ast.node(id);
+  const ast::Function &func = ast.function(cur_function);
   size_t backpatch_target;
   size_t start_at;
-  const IdInfo *info;
 
-  switch (cur_token.type) {
-  case TokenType::Ident:
-    info = &ident_table.find(cur_token.ident);
-    nextToken();
-    takeToken(TokenType::Assign);
-    expression();
-    append(Instruction::Store, info->level, info->addr);
+  switch (node.kind) {
+  case ast::Kind::Assign:
+    expression(node.first);
+    append(Instruction::Store, node.ref, node.value);
     break;
-  case TokenType::Begin:
-    nextToken();
-    while (true) {
-      statement();
-      if (cur_token.type == TokenType::Semicolon) {
-        takeToken(TokenType::Semicolon);
-        // continue;
-      } else if (cur_token.type == TokenType::End) {
-        takeToken(TokenType::End);
-        break;
-      } else {
-        lexer.print_head();
-        std::cout << cur_token << std::endl;
-        std::cout << peek_token << std::endl;
-        throw "expect semicolon or end but not";
-      }
+  case ast::Kind::Begin:
+    for (uint32_t i = 0; i < node.size; i++) {
+      statement(ast.list(node.first)[i]);
     }
     break;
-  case TokenType::If:
-    nextToken();
-
-    condition();
-    takeToken(TokenType::Then);
+  case ast::Kind::If:
+    expression(node.first);
     backpatch_target = append(Instruction::Jpc, 0);
-    statement();
+    statement(node.second);
     backpatch(backpatch_target);
     break;
-  case TokenType::While:
-    nextToken();
-
-    start_at = program.size();
-    condition();
-    takeToken(TokenType::Do);
+  case ast::Kind::While:
+    start_at = label();
+    expression(node.first);
     backpatch_target = append(Instruction::Jpc, 0);
-    statement();
+    statement(node.second);
     append(Instruction::Jmp, start_at);
     backpatch(backpatch_target);
     break;
-  case TokenType::Return:
-    nextToken();
-    expression();
-    info = &ident_table.get(cur_func_id);
-    append(Instruction::Ret, ident_table.getLevel(), info->param_size);
+  case ast::Kind::Return:
+    expression(node.first);
+    if (!inst_starts.empty() && inst_starts.back() == last_call_at &&
+        tail_operands(0)[0] <= static_cast<long long>(func.level)) {
+      // return f(...): f can take over this frame, unless it is nested in
+      // this function and reaches its variables through the display.
+      const long long *call = tail_operands(0);
+      replace_tail(1, {static_cast<long long>(Instruction::TailCall), call[0],
+                       call[1], static_cast<long long>(func.level),
+                       static_cast<long long>(func.params),
+                       static_cast<long long>(last_call_args)});
+    } else {
+      append(Instruction::Ret, func.level, func.params);
+    }
     break;
-  case TokenType::Write:
-    nextToken();
-    expression();
+  case ast::Kind::Write:
+    expression(node.first);
     append(Instruction::Write);
     break;
-  case TokenType::Writeln:
-    nextToken();
+  case ast::Kind::Writeln:
     append(Instruction::Writeln);
     break;
   default:;
@@ -208,6 +100,14 @@ void Compiler::statement() {
 
 Instruction token_to_inst(TokenType type) {
   switch (type) {
+  case TokenType::Plus:
+    return Instruction::Add;
+  case TokenType::Minus:
+    return Instruction::Sub;
+  case TokenType::Mul:
+    return Instruction::Mul;
+  case TokenType::Div:
+    return Instruction::Div;
   case TokenType::Equal:
     return Instruction::Eq;
   case TokenType::NotEqual:
@@ -225,157 +125,159 @@ Instruction token_to_inst(TokenType type) {
   }
 }
 
-void Compiler::condition() {
-  if (cur_token.type == TokenType::Odd) {
-    nextToken();
-    expression();
-    append(Instruction::Odd);
-  } else {
-    expression();
-    Instruction inst = token_to_inst(cur_token.type);
-    nextToken();
-    expression();
-    append(inst);
-  }
-}
-
-void Compiler::expression() {
-  TokenType sign = cur_token.type;
-  if (cur_token.type == TokenType::Plus || cur_token.type == TokenType::Minus) {
-    nextToken();
-  }
-
-  term();
-  if (sign == TokenType::Minus) {
-    append(Instruction::Neg);
-  }
-
-  while (true) {
-    if (cur_token.type == TokenType::Plus) {
-      nextToken();
-      term();
-      append(Instruction::Add);
-    } else if (cur_token.type == TokenType::Minus) {
-      nextToken();
-      term();
-      append(Instruction::Sub);
-    } else {
-      break;
-    }
-  }
-}
-
-void Compiler::term() {
-  factor();
-  while (true) {
-    if (cur_token.type == TokenType::Mul) {
-      nextToken();
-      factor();
-      append(Instruction::Mul);
-    } else if (cur_token.type == TokenType::Div) {
-      nextToken();
-      factor();
-      append(Instruction::Div);
-    } else {
-      break;
-    }
-  }
-}
+void Compiler::expression(ast::NodeId id) {
+  const ast::Node &node = ast.node(id);
+  const ast::Function *callee;
 
-void Compiler::factor() {
-  if (cur_token.type == TokenType::Ident) {
-    const auto &info = ident_table.find(cur_token.ident);
-    nextToken();
-    size_t params = 0;
-    switch (info.type) {
-    case IdType::Const:
-      append(Instruction::Literal, info.value);
-      break;
-    case IdType::Function:
-      takeToken(TokenType::ParenL);
-      while (cur_token.type != TokenType::ParenR) {
-        params++;
-        expression();
-        if (cur_token.type == TokenType::Colon) {
-          nextToken();
-          // continue;
-        } else {
-          break;
-        }
-      }
-      takeToken(TokenType::ParenR);
-      if (params != info.param_size) {
-        throw "params not same";
-      }
-      append(Instruction::Call, info.level, info.entry_point);
-      break;
-    case IdType::Var:
-      append(Instruction::Load, info.level, info.addr);
-      break;
+  switch (node.kind) {
+  case ast::Kind::Number:
+    append(Instruction::Literal, node.value);
+    break;
+  case ast::Kind::Variable:
+    append(Instruction::Load, node.ref, node.value);
+    break;
+  case ast::Kind::Call:
+    for (uint32_t i = 0; i < node.size; i++) {
+      expression(ast.list(node.first)[i]);
     }
-  } else if (cur_token.type == TokenType::Integer) {
-    append(Instruction::Literal, cur_token.integer);
-    nextToken();
-  } else if (cur_token.type == TokenType::ParenL) {
-    nextToken();
-    expression();
-    takeToken(TokenType::ParenR);
-  } else {
-    lexer.print_head();
-    std::cout << cur_token << std::endl;
-    throw "expect factr but";
+    callee = &ast.function(node.ref);
+    append(Instruction::Call, callee->level, entry_points[node.ref]);
+    last_call_at = inst_starts.back();
+    last_call_args = node.size;
+    break;
+  case ast::Kind::Unary:
+    expression(node.first);
+    append(node.op == TokenType::Odd ? Instruction::Odd : Instruction::Neg);
+    break;
+  case ast::Kind::Binary:
+    expression(node.first);
+    expression(node.second);
+    append(token_to_inst(node.op));
+    break;
+  default:
+    throw "expect expression but";
   }
 }
 
 size_t Compiler::append(Instruction instruction) {
-  return append(static_cast<long long>(instruction));
+  assert(operand_size(instruction) == 0);
+  inst_starts.push_back(program.size());
+  emit(static_cast<long long>(instruction));
+  combine();
+  return program.size() - 1;
 }
 
 size_t Compiler::append(Instruction instruction, long long value) {
   assert(operand_size(instruction) == 1);
-  append(instruction);
-  return append(value);
+  inst_starts.push_back(program.size());
+  emit(static_cast<long long>(instruction));
+  emit(value);
+  combine();
+  return program.size() - 1;
 }
 
 size_t Compiler::append(Instruction instruction, long long first,
                         long long second) {
   assert(operand_size(instruction) == 2);
-  append(instruction);
-  append(first);
-  return append(second);
-}
-
-size_t Compiler::append(long long value) {
-  program.push_back(value);
+  inst_starts.push_back(program.size());
+  emit(static_cast<long long>(instruction));
+  emit(first);
+  emit(second);
+  combine();
   return program.size() - 1;
 }
 
-void Compiler::backpatch(size_t target) { program[target] = program.size(); }
+void Compiler::emit(long long value) { program.push_back(value); }
 
-void Compiler::nextToken() {
-  cur_token = std::move(peek_token);
-  peek_token = std::move(lexer.nextToken());
+// Returns the current position as a jump target. Superinstructions are
+// never formed across a label.
+size_t Compiler::label() {
+  label_at = program.size();
+  return label_at;
 }
 
-void Compiler::takeToken(TokenType type) {
-  if (cur_token.type != type) {
-    std::cerr << cur_token.type << std::endl;
-    throw "unexpected token";
+void Compiler::backpatch(size_t target) { program[target] = label(); }
+
+// Replaces the instructions at the end of program with a superinstruction
+// when they form one of the common sequences below.
+void Compiler::combine() {
+  const Instruction last = tail(0);
+
+  if (is_binary_op(last)) {
+    if (combinable(3) && tail(1) == Instruction::Load &&
+        tail(2) == Instruction::Load) {
+      const long long *lhs = tail_operands(2);
+      const long long *rhs = tail_operands(1);
+      replace_tail(3, {static_cast<long long>(Instruction::LoadLoadOp), lhs[0],
+                       lhs[1], rhs[0], rhs[1], static_cast<long long>(last)});
+    } else if (combinable(2) && tail(1) == Instruction::Load) {
+      const long long *rhs = tail_operands(1);
+      replace_tail(2, {static_cast<long long>(Instruction::LoadOp), rhs[0],
+                       rhs[1], static_cast<long long>(last)});
+    } else if (combinable(2) && tail(1) == Instruction::Literal) {
+      const long long *rhs = tail_operands(1);
+      replace_tail(2, {static_cast<long long>(Instruction::LiteralOp), rhs[0],
+                       static_cast<long long>(last)});
+    }
+  } else if (last == Instruction::Jpc) {
+    // By now the compare has usually been combined with its operands.
+    long long target = tail_operands(0)[0];
+    if (combinable(2) && is_compare(tail(1))) {
+      long long cond = static_cast<long long>(tail(1));
+      replace_tail(2, {static_cast<long long>(Instruction::CompareJump), cond,
+                       target});
+    } else if (combinable(2) && tail(1) == Instruction::LiteralOp &&
+               is_compare(static_cast<Instruction>(tail_operands(1)[1]))) {
+      const long long *op = tail_operands(1);
+      replace_tail(2,
+                   {static_cast<long long>(Instruction::LiteralCompareJump),
+                    op[0], op[1], target});
+    } else if (combinable(2) && tail(1) == Instruction::LoadLoadOp &&
+               is_compare(static_cast<Instruction>(tail_operands(1)[4]))) {
+      const long long *op = tail_operands(1);
+      replace_tail(2,
+                   {static_cast<long long>(Instruction::LoadLoadCompareJump),
+                    op[0], op[1], op[2], op[3], op[4], target});
+    }
+  } else if (last == Instruction::Store) {
+    if (combinable(3) && tail(1) == Instruction::LiteralOp &&
+        tail(2) == Instruction::Load) {
+      const long long *store = tail_operands(0);
+      const long long *op = tail_operands(1);
+      const long long *load = tail_operands(2);
+      const Instruction kind = static_cast<Instruction>(op[1]);
+      bool same = load[0] == store[0] && load[1] == store[1];
+      if (same && kind == Instruction::Add) {
+        replace_tail(3, {static_cast<long long>(Instruction::LoadAddStore),
+                         store[0], store[1], op[0]});
+      } else if (same && kind == Instruction::Sub && op[0] != LLONG_MIN) {
+        replace_tail(3, {static_cast<long long>(Instruction::LoadAddStore),
+                         store[0], store[1], -op[0]});
+      }
+    }
   }
-  nextToken();
 }
 
-void pl0::print_program(const Program &program) {
-  size_t i = 0;
-  while (i < program.size()) {
-    std::cout << i << ": ";
-    Instruction inst = static_cast<Instruction>(program[i++]);
-    std::cout << inst;
+// Whether the last count instructions lie after the latest label.
+bool Compiler::combinable(size_t count) const {
+  return inst_starts.size() >= count &&
+         inst_starts[inst_starts.size() - count] >= label_at;
+}
 
-    size_t size = operand_size(inst);
-    while (size--) {
-      std::cout << ' ' << program[i++];
-    }
-    std::cout << std::endl;
-  }
+// The nth instruction counted back from the end of program.
+Instruction Compiler::tail(size_t nth) const {
+  return static_cast<Instruction>(
+      program[inst_starts[inst_starts.size() - 1 - nth]]);
+}
+
+const long long *Compiler::tail_operands(size_t nth) const {
+  return &program[inst_starts[inst_starts.size() - 1 - nth] + 1];
+}
+
+void Compiler::replace_tail(size_t count,
+                            std::initializer_list<long long> code) {
+  size_t start = inst_starts[inst_starts.size() - count];
+  inst_starts.resize(inst_starts.size() - count + 1);
+  program.resize(start);
+  program.insert(program.end(), code.begin(), code.end());
 }
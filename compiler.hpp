@@ -1,50 +1,60 @@
 #pragma once
 
+#include <cstdint>
+#include <initializer_list>
 #include <string>
 #include <vector>
 
+#include "./arena.hpp"
+#include "./ast.hpp"
 #include "./instruction.hpp"
-#include "./lexer.hpp"
-#include "./table.hpp"
-#include "./token.hpp"
+#include "./parser.hpp"
 
 namespace pl0 {
 class Compiler {
 public:
-  Compiler(const std::string &path) : lexer(path) {
-    cur_token = std::move(lexer.nextToken());
-    peek_token = std::move(lexer.nextToken());
-  }
+  Compiler(const std::string &path)
+      : ast(Parser(path, arena).parse()), entry_points(arena),
+        inst_starts(arena) {}
+  // The tree and the other data of the compilation live until the Compiler
+  // is destroyed.
   Program compile();
+  // Valid after compile(); entries are offsets into the returned Program.
+  const FunctionTable &functions() const { return function_table; }
 
 private:
-  void block(size_t func_id);
-  void constDecl();
-  void varDecl(size_t *var_size);
-  void functionDecl();
-  void statement();
-  void condition();
-  void expression();
-  void term();
-  void factor();
+  // Returns the index of the function in function_table.
+  size_t block(size_t function);
+  void functionDecl(size_t function);
+  void statement(ast::NodeId id);
+  void expression(ast::NodeId id);
 
 private:
   size_t append(Instruction instruction);
   size_t append(Instruction instruction, long long value);
   size_t append(Instruction instruction, long long first, long long second);
-  size_t append(long long value);
+  void emit(long long value);
+  size_t label();
   void backpatch(size_t target);
 
-  void nextToken();
-  void takeToken(TokenType type);
+  void combine();
+  bool combinable(size_t count) const;
+  Instruction tail(size_t nth) const;
+  const long long *tail_operands(size_t nth) const;
+  void replace_tail(size_t count, std::initializer_list<long long> code);
 
 private:
-  Lexer lexer;
+  Arena arena;
+  ast::Ast ast;
   Program program;
-  Table ident_table;
-
-  Token cur_token;
-  Token peek_token;
-  size_t cur_func_id;
+  FunctionTable function_table;
+  ArenaVector<long long> entry_points; // by function of ast
+  ArenaVector<size_t> inst_starts;
+  size_t label_at = 0;
+
+  size_t cur_function;
+  // Program offset and argument count of the latest Call, for TailCall.
+  size_t last_call_at = SIZE_MAX;
+  size_t last_call_args = 0;
 };
 } // namespace pl0
@@ -1,27 +1,36 @@
 #pragma once
 
-#include <iostream>
+#include <sstream>
+#include <stdexcept>
 #include <string>
 
 #include "./token.hpp"
 
-static void unsupportedError(const std::string &syntax) {
-  std::cerr << "error: " << syntax << " is unsupported" << std::endl;
-  exit(1);
+namespace pl0 {
+// Compile error from the LLVM front end. The message is complete, so a
+// driver only prints what() and decides whether to go on.
+class Error : public std::runtime_error {
+public:
+  explicit Error(const std::string &msg) : std::runtime_error(msg) {}
+};
+} // namespace pl0
+
+[[noreturn]] static void unsupportedError(const std::string &syntax) {
+  throw pl0::Error("error: " + syntax + " is unsupported");
 }
 
-static void undefinedError(const std::string &ident) {
-  std::cerr << "undefined error: " << ident << " is undefined" << std::endl;
-  exit(1);
+[[noreturn]] static void undefinedError(const std::string &ident) {
+  throw pl0::Error("undefined error: " + ident + " is undefined");
 }
 
-static void parseError(pl0::TokenType expect, pl0::TokenType actual) {
-  std::cerr << "parse error: " << expect << " is expected, but actual is "
-            << actual << std::endl;
-  exit(1);
+[[noreturn]] static void parseError(pl0::TokenType expect,
+                                    pl0::TokenType actual) {
+  std::ostringstream msg;
+  msg << "parse error: " << expect << " is expected, but actual is "
+      << actual;
+  throw pl0::Error(msg.str());
 }
 
-static void error(const std::string &msg) {
-  std::cerr << "error: " << msg << std::endl;
-  exit(1);
+[[noreturn]] static void error(const std::string &msg) {
+  throw pl0::Error("error: " + msg);
 }
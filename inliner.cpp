@@ -0,0 +1,332 @@
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "./inliner.hpp"
+
+using namespace pl0;
+
+namespace {
+struct Inst {
+  size_t pos;
+  Instruction op;
+  std::vector<long long> operands;
+  bool relocate; // target is still an address of the input program
+
+  long long target() const { return operands[target_operand(op)]; }
+  void set_target(long long pos) { operands[target_operand(op)] = pos; }
+  bool has_target() const { return target_operand(op) >= 0; }
+};
+
+// A function whose calls can be replaced by insts[first, last).
+struct Candidate {
+  size_t first, last;
+  long long locals;
+};
+
+// Number of inlined calls, by (caller, callee) function index.
+using Sites = std::map<std::pair<size_t, size_t>, size_t>;
+
+class Inliner {
+public:
+  Inliner(const Program &program, FunctionTable &functions, size_t budget)
+      : functions(functions), budget(budget) {
+    size_t i = 0;
+    while (i < program.size()) {
+      Inst inst;
+      inst.pos = i;
+      inst.op = static_cast<Instruction>(program[i++]);
+      inst.relocate = false;
+      for (size_t size = operand_size(inst.op); size > 0; size--) {
+        inst.operands.push_back(program[i++]);
+      }
+      insts.push_back(std::move(inst));
+    }
+    end_pos = program.size();
+  }
+
+  // One round over the whole program. Returns whether anything was inlined.
+  bool run(Sites &sites) {
+    index();
+    find_candidates();
+
+    // The extra slots each caller needs: the most any one inlined call
+    // uses, since inlined bodies make no calls and so never overlap.
+    std::vector<long long> scratch(functions.size(), 0);
+    for (size_t i = 0; i < insts.size(); i++) {
+      const Candidate *callee = inlinable(i);
+      if (callee != nullptr) {
+        size_t g = callee_of(insts[i]);
+        scratch[owner[i]] = std::max(scratch[owner[i]],
+                                     static_cast<long long>(
+                                         functions[g].params) +
+                                         callee->locals);
+      }
+    }
+
+    std::vector<Inst> out;
+    std::vector<long long> new_pos(end_pos + 1);
+    size_t pos = 0;
+    bool changed = false;
+    for (size_t i = 0; i < insts.size(); i++) {
+      const Inst &inst = insts[i];
+      new_pos[inst.pos] = pos;
+      const Candidate *callee = inlinable(i);
+      if (callee != nullptr) {
+        size_t f = owner[i], g = callee_of(inst);
+        expand(inst, functions[f], functions[g], *callee,
+               2 + frame_locals(f), out, pos);
+        sites[std::make_pair(f, g)]++;
+        changed = true;
+        continue;
+      }
+      Inst copy = inst;
+      copy.relocate = copy.has_target();
+      if (inst.op == Instruction::Ict && function_at[inst.pos] >= 0) {
+        copy.operands[0] += scratch[function_at[inst.pos]];
+      }
+      emit(out, pos, std::move(copy));
+    }
+    new_pos[end_pos] = pos;
+
+    for (auto &inst : out) {
+      if (inst.relocate) {
+        inst.set_target(new_pos[inst.target()]);
+      }
+    }
+    for (auto &func : functions) {
+      func.entry = new_pos[func.entry];
+      func.end = new_pos[func.end];
+    }
+    insts = std::move(out);
+    end_pos = pos;
+    return changed;
+  }
+
+  Program program() const {
+    Program program;
+    for (const auto &inst : insts) {
+      program.push_back(static_cast<long long>(inst.op));
+      program.insert(program.end(), inst.operands.begin(),
+                     inst.operands.end());
+    }
+    return program;
+  }
+
+private:
+  void index() {
+    index_at.assign(end_pos + 1, -1);
+    is_target.assign(end_pos + 1, false);
+    function_at.assign(end_pos + 1, -1);
+    owner.assign(insts.size(), -1);
+    for (size_t i = 0; i < insts.size(); i++) {
+      index_at[insts[i].pos] = i;
+      insts[i].relocate = false;
+    }
+    index_at[end_pos] = insts.size();
+    for (const auto &inst : insts) {
+      if (inst.has_target()) {
+        is_target[inst.target()] = true;
+      }
+    }
+    // Bodies do not overlap: nested functions come before the body.
+    for (size_t f = 0; f < functions.size(); f++) {
+      function_at[functions[f].entry] = f;
+      for (long long i = index_at[functions[f].entry];
+           i < index_at[functions[f].end]; i++) {
+        owner[i] = f;
+      }
+    }
+  }
+
+  void find_candidates() {
+    candidates.assign(functions.size(), Candidate());
+    is_candidate.assign(functions.size(), false);
+    // main, the last function, is never called.
+    for (size_t g = 0; g + 1 < functions.size(); g++) {
+      const Function &func = functions[g];
+      const long long first = index_at[func.entry];
+      const long long last = index_at[func.end] - 1; // the final Ret
+      if (last - 1 <= first || insts[first].op != Instruction::Ict ||
+          insts[last].op != Instruction::Ret || is_target[insts[last].pos]) {
+        continue;
+      }
+      const Instruction before = insts[last - 1].op;
+      if (before != Instruction::Ret && before != Instruction::Jmp) {
+        continue; // the final Ret is reachable
+      }
+      if (static_cast<size_t>(last - first - 1) > budget) {
+        continue;
+      }
+      bool leaf = true;
+      for (long long i = first + 1; i < last; i++) {
+        Instruction op = insts[i].op;
+        if (op == Instruction::Call || op == Instruction::TailCall ||
+            op == Instruction::Ict || op == Instruction::Halt) {
+          leaf = false;
+          break;
+        }
+      }
+      if (!leaf) {
+        continue;
+      }
+      candidates[g] = {static_cast<size_t>(first + 1),
+                       static_cast<size_t>(last), insts[first].operands[0]};
+      is_candidate[g] = true;
+    }
+  }
+
+  // The function a Call or TailCall enters, or -1. Calls go to the Jmp over
+  // nested functions unless the peephole pass threaded them to the body.
+  long long callee_of(const Inst &inst) const {
+    long long target = inst.target();
+    for (size_t step = 0; step < insts.size(); step++) {
+      if (function_at[target] >= 0) {
+        return function_at[target];
+      }
+      long long i = index_at[target];
+      if (i < 0 || i >= static_cast<long long>(insts.size()) ||
+          insts[i].op != Instruction::Jmp || insts[i].target() == target) {
+        break;
+      }
+      target = insts[i].target();
+    }
+    return -1;
+  }
+
+  const Candidate *inlinable(size_t i) const {
+    const Inst &inst = insts[i];
+    if ((inst.op != Instruction::Call && inst.op != Instruction::TailCall) ||
+        owner[i] < 0) {
+      return nullptr;
+    }
+    long long g = callee_of(inst);
+    return g >= 0 && is_candidate[g] ? &candidates[g] : nullptr;
+  }
+
+  // Locals the caller's Ict allocates, before any scratch slots.
+  long long frame_locals(size_t f) const {
+    return insts[index_at[functions[f].entry]].operands[0];
+  }
+
+  static void emit(std::vector<Inst> &out, size_t &pos, Inst inst) {
+    inst.pos = pos;
+    pos += 1 + inst.operands.size();
+    out.push_back(std::move(inst));
+  }
+
+  static void emit(std::vector<Inst> &out, size_t &pos, Instruction op,
+                   std::vector<long long> operands) {
+    emit(out, pos, Inst{0, op, std::move(operands), false});
+  }
+
+  // Emits the body of callee in place of call, with its frame at slot base
+  // of the caller's.
+  void expand(const Inst &call, const Function &caller,
+              const Function &callee, const Candidate &body, long long base,
+              std::vector<Inst> &out, size_t &pos) const {
+    const long long caller_level = caller.level;
+    const long long level = callee.level;
+    const long long params = callee.params;
+
+    // Arguments are on the stack, the last one on top.
+    for (long long i = params - 1; i >= 0; i--) {
+      emit(out, pos, Instruction::Store, {caller_level, base + i});
+    }
+    // Ict would have zeroed the locals.
+    for (long long i = 0; i < body.locals; i++) {
+      emit(out, pos, Instruction::Literal, {0});
+      emit(out, pos, Instruction::Store, {caller_level, base + params + i});
+    }
+
+    // Parameters are at -params..-1 and locals from 2 in the callee's
+    // frame; in the caller they follow each other from base.
+    auto move = [&](long long &var_level, long long &addr) {
+      if (var_level == level) {
+        var_level = caller_level;
+        addr = base + (addr < 0 ? params + addr : params + addr - 2);
+      }
+    };
+
+    const size_t start = out.size();
+    std::vector<long long> copy_at(body.last - body.first);
+    std::vector<size_t> returns;
+    for (size_t i = body.first; i < body.last; i++) {
+      Inst inst = insts[i];
+      inst.relocate = false;
+      switch (inst.op) {
+      case Instruction::Load:
+      case Instruction::Store:
+      case Instruction::LoadOp:
+      case Instruction::LoadAddStore:
+        move(inst.operands[0], inst.operands[1]);
+        break;
+      case Instruction::LoadLoadOp:
+      case Instruction::LoadLoadCompareJump:
+        move(inst.operands[0], inst.operands[1]);
+        move(inst.operands[2], inst.operands[3]);
+        break;
+      case Instruction::Ret:
+        // The value stays on the stack for the caller.
+        inst.op = Instruction::Jmp;
+        inst.operands = {0};
+        returns.push_back(out.size());
+        break;
+      default:
+        break;
+      }
+      copy_at[i - body.first] = pos;
+      emit(out, pos, std::move(inst));
+    }
+    const long long end = pos;
+
+    for (size_t i = start; i < out.size(); i++) {
+      if (std::find(returns.begin(), returns.end(), i) != returns.end()) {
+        out[i].set_target(end);
+      } else if (out[i].has_target()) {
+        // Jumps in a body stay inside it; the final Ret is never a target.
+        out[i].set_target(copy_at[index_at[out[i].target()] - body.first]);
+      }
+    }
+
+    if (call.op == Instruction::TailCall) {
+      // return f(...) also returns from the caller.
+      emit(out, pos, Instruction::Ret, {call.operands[2], call.operands[3]});
+    }
+  }
+
+private:
+  std::vector<Inst> insts;
+  FunctionTable &functions;
+  size_t budget;
+  size_t end_pos;
+  std::vector<long long> index_at;    // by position; insts.size() at the end
+  std::vector<bool> is_target;        // by position
+  std::vector<long long> function_at; // function whose body starts there
+  std::vector<long long> owner;       // function whose body holds an inst
+  std::vector<Candidate> candidates;  // by function
+  std::vector<bool> is_candidate;     // by function
+};
+} // namespace
+
+Program pl0::inline_calls(const Program &program, FunctionTable &functions,
+                          size_t budget, std::ostream *report) {
+  if (budget == 0) {
+    return program;
+  }
+  Inliner inliner(program, functions, budget);
+  Sites sites;
+  // A caller whose calls were all inlined may be inlined itself next round.
+  for (int round = 0; round < 4 && inliner.run(sites); round++) {
+  }
+
+  if (report != nullptr) {
+    for (const auto &site : sites) {
+      *report << "inlined " << functions[site.first.second].name << " into "
+              << functions[site.first.first].name << " at " << site.second
+              << (site.second == 1 ? " call site" : " call sites") << '\n';
+    }
+  }
+  return inliner.program();
+}
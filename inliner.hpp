@@ -0,0 +1,28 @@
+#pragma once
+
+#include <ostream>
+
+#include "./instruction.hpp"
+
+namespace pl0 {
+// Budget -O uses unless --inline-budget says otherwise.
+constexpr size_t default_inline_budget = 16;
+
+// Replaces calls to small leaf functions with a copy of their body:
+// - the callee makes no calls and its final Ret can not be reached, so
+//   every path ends in a return
+// - its body, without the Ict and the final Ret, has at most budget
+//   instructions
+// The arguments and locals of an inlined call live in extra slots of the
+// caller's frame. Accesses to the callee's own level are moved there.
+// Accesses to outer levels are kept as they are, because a call leaves the
+// display below the callee's level unchanged. An inner Ret jumps past the
+// copy and leaves its value on the stack. A TailCall becomes the copy
+// followed by the caller's Ret.
+//
+// Callers that become leaves are inlined in turn, for a few rounds. Entries
+// in functions are relocated. If report is given, one line per caller and
+// callee pair is written to it. A budget of 0 disables inlining.
+Program inline_calls(const Program &program, FunctionTable &functions,
+                     size_t budget, std::ostream *report = nullptr);
+} // namespace pl0
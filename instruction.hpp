@@ -1,10 +1,11 @@
 #pragma once
 
 #include <ostream>
+#include <string>
 #include <vector>
 
 namespace pl0 {
-enum class Instruction {
+enum class Instruction : unsigned char {
   Load = 0,
   Store,
   Call,
@@ -27,10 +28,42 @@ enum class Instruction {
   GreaterEq,
   Write,
   Writeln,
+  TailCall, // Call; Ret of the calling function, reusing its frame
+
+  // superinstructions, emitted by Compiler in place of common sequences
+  LoadOp,              // Load; <op>
+  LiteralOp,           // Literal; <op>
+  LoadLoadOp,          // Load; Load; <op>
+  CompareJump,         // <compare>; Jpc
+  LoadAddStore,        // Load; Literal; Add; Store to the same variable
+  LiteralCompareJump,  // Literal; <compare>; Jpc
+  LoadLoadCompareJump, // Load; Load; <compare>; Jpc
+
+  // forms of Load and Store chosen by decode(), never found in a Program
+  LoadLocal,   // Load from the current frame
+  StoreLocal,  // Store to the current frame
+  LoadGlobal,  // Load from main's frame
+  StoreGlobal, // Store to main's frame
+
+  Halt,
 };
 
 using Program = std::vector<long long>;
 
+// A function as laid out by the compiler. entry is the code address of its
+// body (the Ict after the Jmp over nested functions) and end the address
+// just past it, after the final Ret (main: the Halt): Program offsets, or
+// Bytecode indices once decoded. Functions are listed in the order
+// of their bodies, so main is always the last one.
+struct Function {
+  std::string name;
+  size_t entry;
+  size_t end;
+  size_t level; // display level of the function's own frame
+  size_t params;
+};
+using FunctionTable = std::vector<Function>;
+
 static std::ostream &operator<<(std::ostream &out, const Instruction inst) {
   switch (inst) {
   case Instruction::Load:
@@ -77,19 +110,66 @@ static std::ostream &operator<<(std::ostream &out, const Instruction inst) {
     return out << "Write";
   case Instruction::Writeln:
     return out << "Writeln";
+  case Instruction::TailCall:
+    return out << "TailCall";
+  case Instruction::LoadOp:
+    return out << "LoadOp";
+  case Instruction::LiteralOp:
+    return out << "LiteralOp";
+  case Instruction::LoadLoadOp:
+    return out << "LoadLoadOp";
+  case Instruction::CompareJump:
+    return out << "CompareJump";
+  case Instruction::LoadAddStore:
+    return out << "LoadAddStore";
+  case Instruction::LiteralCompareJump:
+    return out << "LiteralCompareJump";
+  case Instruction::LoadLoadCompareJump:
+    return out << "LoadLoadCompareJump";
+  case Instruction::LoadLocal:
+    return out << "LoadLocal";
+  case Instruction::StoreLocal:
+    return out << "StoreLocal";
+  case Instruction::LoadGlobal:
+    return out << "LoadGlobal";
+  case Instruction::StoreGlobal:
+    return out << "StoreGlobal";
+  case Instruction::Halt:
+    return out << "Halt";
   }
 }
 
 static size_t operand_size(Instruction inst) {
   switch (inst) {
+  // 6
+  case Instruction::LoadLoadCompareJump:
+    return 6;
+
+  // 5
+  case Instruction::LoadLoadOp:
+  case Instruction::TailCall:
+    return 5;
+
+  // 3
+  case Instruction::LoadOp:
+  case Instruction::LoadAddStore:
+  case Instruction::LiteralCompareJump:
+    return 3;
+
   // 2
   case Instruction::Load:
   case Instruction::Store:
   case Instruction::Call:
   case Instruction::Ret:
+  case Instruction::LiteralOp:
+  case Instruction::CompareJump:
     return 2;
 
   // 1
+  case Instruction::LoadLocal:
+  case Instruction::StoreLocal:
+  case Instruction::LoadGlobal:
+  case Instruction::StoreGlobal:
   case Instruction::Literal:
   case Instruction::Ict:
   case Instruction::Jmp:
@@ -111,9 +191,54 @@ static size_t operand_size(Instruction inst) {
   case Instruction::GreaterEq:
   case Instruction::Write:
   case Instruction::Writeln:
+  case Instruction::Halt:
     return 0;
   }
 }
 
-void print_program(const Program &program);
+static bool is_compare(Instruction inst) {
+  switch (inst) {
+  case Instruction::Eq:
+  case Instruction::Neq:
+  case Instruction::Less:
+  case Instruction::LessEq:
+  case Instruction::Greater:
+  case Instruction::GreaterEq:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// The binary operators that LoadOp, LiteralOp and LoadLoadOp can carry.
+static bool is_binary_op(Instruction inst) {
+  switch (inst) {
+  case Instruction::Add:
+  case Instruction::Sub:
+  case Instruction::Mul:
+  case Instruction::Div:
+    return true;
+  default:
+    return is_compare(inst);
+  }
+}
+
+// Index of the operand holding a code address, or -1 if there is none.
+static int target_operand(Instruction inst) {
+  switch (inst) {
+  case Instruction::Jmp:
+  case Instruction::Jpc:
+    return 0;
+  case Instruction::Call:
+  case Instruction::TailCall:
+  case Instruction::CompareJump:
+    return 1;
+  case Instruction::LiteralCompareJump:
+    return 2;
+  case Instruction::LoadLoadCompareJump:
+    return 5;
+  default:
+    return -1;
+  }
+}
 } // namespace pl0
@@ -0,0 +1,94 @@
+#include "./interner.hpp"
+#include "./token.hpp"
+
+using namespace pl0;
+
+static const Symbol none = UINT32_MAX;
+
+// In TokenType order, starting at TokenType::Const.
+static const char *const keywords[] = {
+    "const", "var",    "function", "begin",   "end",
+    "if",    "then",   "while",    "do",      "return",
+    "write", "writeln", "odd",
+};
+
+static_assert(sizeof(keywords) / sizeof(keywords[0]) ==
+                  static_cast<size_t>(TokenType::Odd) -
+                      static_cast<size_t>(TokenType::Const) + 1,
+              "every keyword TokenType needs a name");
+
+const Symbol Interner::keyword_count = sizeof(keywords) / sizeof(keywords[0]);
+
+Interner &Interner::global() {
+  static Interner interner;
+  return interner;
+}
+
+Interner::Interner() : slots(256, none) {
+  for (const char *keyword : keywords) {
+    intern(keyword);
+  }
+}
+
+TokenType Interner::keyword(Symbol symbol) {
+  return static_cast<TokenType>(static_cast<Symbol>(TokenType::Const) +
+                                symbol);
+}
+
+// FNV-1a
+uint64_t Interner::hash_name(StringView name) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < name.size(); i++) {
+    hash ^= static_cast<unsigned char>(name[i]);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+Symbol Interner::intern(StringView name) {
+  std::lock_guard<std::mutex> lock(mutex);
+  uint64_t hash = hash_name(name);
+  size_t mask = slots.size() - 1;
+  size_t i = hash & mask;
+  while (slots[i] != none) {
+    Symbol symbol = slots[i];
+    if (hashes[symbol] == hash && names[symbol] == name) {
+      return symbol;
+    }
+    i = (i + 1) & mask;
+  }
+
+  Symbol symbol = names.size();
+  storage.push_back(name.str());
+  names.push_back(storage.back());
+  hashes.push_back(hash);
+  slots[i] = symbol;
+  // Keep the load factor at or below one half.
+  if (names.size() * 2 > slots.size()) {
+    grow();
+  }
+  return symbol;
+}
+
+StringView Interner::name(Symbol symbol) const {
+  // names may be reallocated by a concurrent intern().
+  std::lock_guard<std::mutex> lock(mutex);
+  return names[symbol];
+}
+
+size_t Interner::size() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return names.size();
+}
+
+void Interner::grow() {
+  slots.assign(slots.size() * 2, none);
+  size_t mask = slots.size() - 1;
+  for (Symbol symbol = 0; symbol < names.size(); symbol++) {
+    size_t i = hashes[symbol] & mask;
+    while (slots[i] != none) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = symbol;
+  }
+}
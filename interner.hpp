@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "./string_view.hpp"
+
+namespace pl0 {
+enum class TokenType : uint8_t;
+
+// Dense ID of an interned identifier. Equal names get equal IDs, so the
+// front ends compare and index symbols instead of strings.
+using Symbol = uint32_t;
+
+// Process-wide string interner. The keywords are interned first, in
+// TokenType order, so a keyword is recognized by its ID alone. Safe to use
+// from several threads; compilations running in parallel share the IDs.
+class Interner {
+public:
+  static Interner &global();
+
+  Symbol intern(StringView name);
+  // Valid for the lifetime of the interner.
+  StringView name(Symbol symbol) const;
+  size_t size() const;
+
+  static bool is_keyword(Symbol symbol) { return symbol < keyword_count; }
+  static TokenType keyword(Symbol symbol);
+
+private:
+  Interner();
+
+  static uint64_t hash_name(StringView name);
+  void grow();
+
+private:
+  static const Symbol keyword_count;
+
+  mutable std::mutex mutex;
+
+  std::deque<std::string> storage; // stable addresses for names
+  std::vector<StringView> names;   // by symbol
+  std::vector<uint64_t> hashes;    // by symbol
+  std::vector<Symbol> slots;       // open addressing; none if empty
+};
+} // namespace pl0
@@ -0,0 +1,243 @@
+#include "./ir.hpp"
+
+using namespace pl0;
+using namespace pl0::ir;
+
+ValueId Graph::add(BlockId block, Value value) {
+  value.block = block;
+  values.push_back(std::move(value));
+  ValueId id = static_cast<ValueId>(values.size() - 1);
+  blocks[block].values.push_back(id);
+  return id;
+}
+
+BlockId Graph::add_block(long long pos) {
+  Block block;
+  block.pos = pos;
+  block.removed = false;
+  blocks.push_back(std::move(block));
+  return static_cast<BlockId>(blocks.size() - 1);
+}
+
+Value ir::make(Op op) {
+  Value value;
+  value.op = op;
+  value.sub = Instruction::Halt;
+  value.block = -1;
+  value.value = 0;
+  value.level = 0;
+  value.addr = 0;
+  value.target = 0;
+  value.caller_level = 0;
+  value.caller_params = 0;
+  value.variable = no_variable;
+  return value;
+}
+
+bool ir::is_terminator(Op op) {
+  switch (op) {
+  case Op::Jmp:
+  case Op::Branch:
+  case Op::Ret:
+  case Op::TailCall:
+  case Op::Exit:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool ir::is_pure(const Graph &graph, const Value &value) {
+  switch (value.op) {
+  case Op::Const:
+  case Op::Arg:
+  case Op::Phi:
+  case Op::Unary:
+    return true;
+  case Op::Binary: {
+    if (value.sub != Instruction::Div) {
+      return true;
+    }
+    // Division by zero is an error the program has to see.
+    const Value &divisor = graph.values[value.operands[1]];
+    return divisor.op == Op::Const && divisor.value != 0;
+  }
+  default:
+    return false;
+  }
+}
+
+static const char *op_name(Op op) {
+  switch (op) {
+  case Op::Const:
+    return "const";
+  case Op::Arg:
+    return "arg";
+  case Op::Phi:
+    return "phi";
+  case Op::Unary:
+    return "unary";
+  case Op::Binary:
+    return "binary";
+  case Op::Load:
+    return "load";
+  case Op::Store:
+    return "store";
+  case Op::Call:
+    return "call";
+  case Op::Write:
+    return "write";
+  case Op::Writeln:
+    return "writeln";
+  case Op::Jmp:
+    return "jmp";
+  case Op::Branch:
+    return "branch";
+  case Op::Ret:
+    return "ret";
+  case Op::TailCall:
+    return "tailcall";
+  case Op::Exit:
+    return "exit";
+  case Op::Nop:
+    return "nop";
+  }
+  return "?";
+}
+
+void ir::print(std::ostream &out, const Graph &graph) {
+  for (size_t b = 0; b < graph.blocks.size(); b++) {
+    const Block &block = graph.blocks[b];
+    if (block.removed) {
+      continue;
+    }
+    out << "b" << b << ":";
+    if (!block.preds.empty()) {
+      out << " ; preds";
+      for (BlockId pred : block.preds) {
+        out << " b" << pred;
+      }
+    }
+    out << '\n';
+    for (ValueId id : block.values) {
+      const Value &value = graph.values[id];
+      out << "  ";
+      if (!is_terminator(value.op) && value.op != Op::Store &&
+          value.op != Op::Write && value.op != Op::Writeln) {
+        out << "v" << id << " = ";
+      }
+      if (value.op == Op::Unary || value.op == Op::Binary) {
+        out << value.sub;
+      } else {
+        out << op_name(value.op);
+      }
+      switch (value.op) {
+      case Op::Const:
+        out << ' ' << value.value;
+        break;
+      case Op::Arg:
+        out << ' ' << value.addr;
+        break;
+      case Op::Load:
+      case Op::Store:
+        out << " [" << value.level << ' ' << value.addr << ']';
+        break;
+      case Op::Call:
+      case Op::TailCall:
+        out << " @" << value.target;
+        break;
+      default:
+        break;
+      }
+      for (ValueId operand : value.operands) {
+        out << " v" << operand;
+      }
+      for (BlockId succ : graph.blocks[b].succs) {
+        if (id == block.values.back()) {
+          out << " b" << succ;
+        }
+      }
+      out << '\n';
+    }
+  }
+}
+
+Program pl0::optimize_ir(const Program &program, FunctionTable &functions,
+                         std::ostream *dump) {
+  std::vector<long long> body_at(program.size() + 1, -1);
+  for (size_t f = 0; f < functions.size(); f++) {
+    body_at[functions[f].entry] = f;
+  }
+
+  Program out;
+  // Input position -> output position, for the instructions outside the
+  // optimized bodies, the body entries and the ends.
+  std::vector<long long> new_pos(program.size() + 1, -1);
+  std::vector<size_t> relocations; // offsets in out holding input positions
+  std::vector<bool> lowered(functions.size(), false);
+  std::vector<std::pair<size_t, size_t>> placed(functions.size());
+
+  size_t pos = 0;
+  size_t copy_until = 0; // end of a body that is kept as it is
+  while (pos < program.size()) {
+    new_pos[pos] = out.size();
+    if (pos < copy_until || body_at[pos] < 0) {
+      Instruction op = static_cast<Instruction>(program[pos]);
+      size_t size = 1 + operand_size(op);
+      int target = target_operand(op);
+      if (target >= 0) {
+        relocations.push_back(out.size() + 1 + target);
+      }
+      out.insert(out.end(), program.begin() + pos,
+                 program.begin() + pos + size);
+      pos += size;
+      continue;
+    }
+
+    const size_t f = body_at[pos];
+    Program body;
+    std::vector<size_t> body_relocations;
+    try {
+      ir::Graph graph = ir::build(program, functions, f);
+      ir::optimize(graph);
+      if (dump != nullptr) {
+        *dump << functions[f].name << ":\n";
+        ir::print(*dump, graph);
+      }
+      body = ir::lower(graph, out.size(), body_relocations);
+    } catch (const char *msg) {
+      // Code the middle end does not understand stays as it is.
+      if (dump != nullptr) {
+        *dump << functions[f].name << ": " << msg << '\n';
+      }
+      copy_until = functions[f].end;
+      continue;
+    }
+    for (size_t offset : body_relocations) {
+      relocations.push_back(out.size() + offset);
+    }
+    lowered[f] = true;
+    placed[f].first = out.size();
+    out.insert(out.end(), body.begin(), body.end());
+    placed[f].second = out.size();
+    pos = functions[f].end;
+  }
+  new_pos[program.size()] = out.size();
+
+  for (size_t offset : relocations) {
+    if (new_pos[out[offset]] < 0) {
+      throw "middle end: reference into a function body";
+    }
+    out[offset] = new_pos[out[offset]];
+  }
+  for (size_t f = 0; f < functions.size(); f++) {
+    if (lowered[f]) {
+      functions[f].entry = placed[f].first;
+      functions[f].end = placed[f].second;
+    } else {
+      functions[f].entry = new_pos[functions[f].entry];
+      functions[f].end = new_pos[functions[f].end];
+    }
+  }
+  return out;
+}
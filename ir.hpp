@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "./instruction.hpp"
+
+namespace pl0 {
+// Middle end: each function body is lifted from bytecode into a graph of
+// basic blocks over SSA values, optimized, and lowered back to bytecode.
+//
+// Variables of a function that none of its nested functions can see live in
+// SSA values; all other variables stay in memory and are read and written
+// with Load and Store. So do the operand stack entries that cross a jump,
+// which appear where the inliner copied a body into an expression.
+namespace ir {
+using ValueId = int32_t;
+using BlockId = int32_t;
+
+const long long no_variable = INT64_MIN;
+
+enum class Op : unsigned char {
+  Const,  // value
+  Arg,    // the parameter at frame address addr, on entry
+  Phi,    // one operand per predecessor, in the order of Block::preds
+  Unary,  // sub is Neg or Odd
+  Binary, // sub is one of Add to GreaterEq
+  Load,   // from variable (level, addr), which stays in memory
+  Store,  // operands[0] to variable (level, addr)
+  Call,   // of the function at target, level as in the bytecode
+  Write,
+  Writeln,
+
+  // Terminators, one at the end of every block.
+  Jmp,      // to succs[0]
+  Branch,   // to succs[0] if operands[0] is not 0, else to succs[1]
+  Ret,      // operands[0]; level and addr (the parameter count) as in Ret
+  TailCall, // level and target as in Call, caller_level and caller_params
+  Exit,     // main runs off its end into the Halt at target
+
+  Nop, // removed
+};
+
+struct Value {
+  Op op;
+  Instruction sub;
+  BlockId block;
+  long long value;
+  long long level;
+  long long addr;
+  long long target; // Program offset
+  long long caller_level;
+  long long caller_params;
+  // Frame address of the variable this value was assigned to, as a hint
+  // for lowering; no_variable if none.
+  long long variable;
+  std::vector<ValueId> operands;
+};
+
+struct Block {
+  std::vector<ValueId> values; // phis first, the terminator last
+  std::vector<BlockId> preds;
+  std::vector<BlockId> succs;
+  // Layout key: twice the Program offset the block came from, so that a
+  // block can be placed right before another.
+  long long pos;
+  bool removed;
+};
+
+struct Graph {
+  std::vector<Value> values;
+  std::vector<Block> blocks; // blocks[0] is the entry
+  long long level;          // of the function's own frame
+  long long params;
+  long long locals; // frame slots the Ict allocates
+  // Frame addresses, from -params up, whose variable lives in SSA values.
+  std::vector<bool> promoted;
+
+  bool is_promoted(long long addr) const {
+    return addr + params >= 0 &&
+           addr + params < static_cast<long long>(promoted.size()) &&
+           promoted[addr + params];
+  }
+
+  ValueId add(BlockId block, Value value);
+  BlockId add_block(long long pos);
+  const Value &terminator(BlockId block) const {
+    return values[blocks[block].values.back()];
+  }
+};
+
+Value make(Op op);
+bool is_terminator(Op op);
+// Whether the value may be removed when nothing uses it, and moved to any
+// point where its operands are available.
+bool is_pure(const Graph &graph, const Value &value);
+
+// Lifts the body of functions[function] from program.
+Graph build(const Program &program, const FunctionTable &functions,
+            size_t function);
+void optimize(Graph &graph);
+// Code for the body, to be placed at Program offset base. Jumps within it
+// are resolved; the offsets in relocations, relative to base, hold
+// positions of the input program (call targets, and main's exit) that the
+// caller has to relocate.
+Program lower(Graph &graph, size_t base, std::vector<size_t> &relocations);
+
+void print(std::ostream &out, const Graph &graph);
+} // namespace ir
+
+// Runs the middle end over every function of program and returns the new
+// program, with the entries in functions relocated. If dump is given, the
+// optimized graphs are printed to it.
+Program optimize_ir(const Program &program, FunctionTable &functions,
+                    std::ostream *dump = nullptr);
+} // namespace pl0
@@ -0,0 +1,648 @@
+#include <map>
+#include <utility>
+
+#include "./ir.hpp"
+
+using namespace pl0;
+using namespace pl0::ir;
+
+namespace {
+struct Inst {
+  size_t pos;
+  Instruction op;
+  const long long *operands;
+};
+
+// A run of instructions of the body, [first, last) in insts.
+struct Range {
+  size_t first, last;
+  BlockId block;
+  long long depth; // operand stack entries on entry, -1 until known
+};
+
+// Operand stack entry k is read and written like a variable under this key.
+const long long stack_key = 1LL << 40;
+
+// Lifts one body with the SSA construction of Braun et al., "Simple and
+// Efficient Construction of Static Single Assignment Form": variables are
+// looked up backwards through the predecessors, with phis where paths
+// join, and blocks are filled in reverse postorder.
+class Builder {
+public:
+  Builder(const Program &program, const FunctionTable &functions,
+          size_t function)
+      : program(program), functions(functions), function(function),
+        func(functions[function]), is_main(function + 1 == functions.size()) {
+    if (program[func.entry] != static_cast<long long>(Instruction::Ict)) {
+      throw "middle end: body does not start with Ict";
+    }
+    graph.level = func.level;
+    graph.params = func.params;
+    graph.locals = program[func.entry + 1];
+    for (size_t i = func.entry + 2; i < func.end;) {
+      Inst inst{i, static_cast<Instruction>(program[i]), &program[i + 1]};
+      i += 1 + operand_size(inst.op);
+      insts.push_back(inst);
+    }
+  }
+
+  Graph build() {
+    promote();
+    split();
+    fill();
+    return std::move(graph);
+  }
+
+private:
+  // A variable of the function is promoted unless a nested function can
+  // see it. Nested functions are the ones listed right before it with a
+  // deeper level.
+  void promote() {
+    graph.promoted.assign(graph.params + 2 + graph.locals, true);
+    graph.promoted[graph.params] = false;     // saved display
+    graph.promoted[graph.params + 1] = false; // return address
+    auto seen = [&](long long level, long long addr) {
+      if (level == graph.level && graph.is_promoted(addr)) {
+        graph.promoted[addr + graph.params] = false;
+      }
+    };
+    for (size_t g = function; g-- > 0 && functions[g].level > func.level;) {
+      for (size_t i = functions[g].entry; i < functions[g].end;) {
+        const Instruction op = static_cast<Instruction>(program[i]);
+        const long long *operand = &program[i + 1];
+        switch (op) {
+        case Instruction::Load:
+        case Instruction::Store:
+        case Instruction::LoadOp:
+        case Instruction::LoadAddStore:
+          seen(operand[0], operand[1]);
+          break;
+        case Instruction::LoadLoadOp:
+        case Instruction::LoadLoadCompareJump:
+          seen(operand[0], operand[1]);
+          seen(operand[2], operand[3]);
+          break;
+        default:
+          break;
+        }
+        i += 1 + operand_size(op);
+      }
+    }
+  }
+
+  // Cuts the body into ranges at jump targets and after jumps, and finds
+  // the ranges that run, with their stack depth.
+  void split() {
+    std::vector<bool> leader(insts.size() + 1, false);
+    index_at.assign(func.end + 1, -1);
+    for (size_t i = 0; i < insts.size(); i++) {
+      index_at[insts[i].pos] = i;
+    }
+    index_at[func.end] = insts.size();
+    leader[0] = true;
+    for (size_t i = 0; i < insts.size(); i++) {
+      const Inst &inst = insts[i];
+      switch (inst.op) {
+      case Instruction::Jmp:
+      case Instruction::Jpc:
+      case Instruction::CompareJump:
+      case Instruction::LiteralCompareJump:
+      case Instruction::LoadLoadCompareJump:
+        leader[index(inst.operands[target_operand(inst.op)])] = true;
+        leader[i + 1] = true;
+        break;
+      case Instruction::Ret:
+      case Instruction::TailCall:
+        leader[i + 1] = true;
+        break;
+      case Instruction::Ict:
+      case Instruction::Halt:
+        throw "middle end: unexpected instruction in a body";
+      default:
+        break;
+      }
+    }
+
+    range_at.assign(insts.size() + 1, -1);
+    for (size_t i = 0; i < insts.size(); i++) {
+      if (leader[i]) {
+        range_at[i] = ranges.size();
+        ranges.push_back(Range{i, i + 1, -1, -1});
+      } else {
+        ranges.back().last = i + 1;
+      }
+    }
+
+    // The entry holds the initial definitions and falls into the first
+    // range; main's exit, if reached, falls into the Halt.
+    graph.add_block(2 * static_cast<long long>(func.entry));
+    exit_block = -1;
+
+    // An empty main body has no ranges and goes straight to the exit.
+    std::vector<size_t> work;
+    if (!ranges.empty()) {
+      ranges[0].depth = 0;
+      work.push_back(0);
+    }
+    while (!work.empty()) {
+      Range &range = ranges[work.back()];
+      work.pop_back();
+      long long depth = range.depth;
+      for (size_t i = range.first; i < range.last; i++) {
+        depth += effect(insts[i]);
+        if (depth < 0) {
+          throw "middle end: operand stack underflow";
+        }
+      }
+      for (size_t succ : successors(range)) {
+        if (succ == insts.size()) {
+          continue;
+        }
+        Range &next = ranges[range_at[succ]];
+        if (next.depth < 0) {
+          next.depth = depth;
+          work.push_back(range_at[succ]);
+        } else if (next.depth != depth) {
+          throw "middle end: operand stack depth differs at a join";
+        }
+      }
+    }
+
+    for (auto &range : ranges) {
+      if (range.depth >= 0) {
+        range.block = graph.add_block(2 * insts[range.first].pos);
+      }
+    }
+    link(0, block_at(0));
+    for (const auto &range : ranges) {
+      if (range.depth < 0) {
+        continue;
+      }
+      for (size_t succ : successors(range)) {
+        link(range.block, block_at(succ));
+      }
+    }
+  }
+
+  // Index of the instruction at a jump target inside the body.
+  size_t index(long long pos) const {
+    if (pos < static_cast<long long>(func.entry + 2) ||
+        pos > static_cast<long long>(func.end) || index_at[pos] < 0 ||
+        (pos == static_cast<long long>(func.end) && !is_main)) {
+      throw "middle end: jump out of the body";
+    }
+    return index_at[pos];
+  }
+
+  // Indices of the instructions control can go to after range, in the
+  // order of the terminator's succs; insts.size() for main's exit.
+  std::vector<size_t> successors(const Range &range) const {
+    const Inst &last = insts[range.last - 1];
+    switch (last.op) {
+    case Instruction::Jmp:
+      return {index(last.operands[0])};
+    case Instruction::Jpc:
+    case Instruction::CompareJump:
+    case Instruction::LiteralCompareJump:
+    case Instruction::LoadLoadCompareJump:
+      return {range.last, index(last.operands[target_operand(last.op)])};
+    case Instruction::Ret:
+    case Instruction::TailCall:
+      return {};
+    default:
+      if (range.last == insts.size() && !is_main) {
+        throw "middle end: body runs off its end";
+      }
+      return {range.last};
+    }
+  }
+
+  BlockId block_at(size_t index) {
+    if (index < insts.size()) {
+      return ranges[range_at[index]].block;
+    }
+    if (exit_block < 0) {
+      exit_block = graph.add_block(2 * static_cast<long long>(func.end));
+    }
+    return exit_block;
+  }
+
+  void link(BlockId from, BlockId to) {
+    graph.blocks[from].succs.push_back(to);
+    graph.blocks[to].preds.push_back(from);
+  }
+
+  // Number of entries inst leaves on the operand stack, less those it
+  // takes.
+  long long effect(const Inst &inst) const {
+    switch (inst.op) {
+    case Instruction::Load:
+    case Instruction::Literal:
+    case Instruction::LoadLoadOp:
+      return 1;
+    case Instruction::Store:
+    case Instruction::Jpc:
+    case Instruction::Write:
+    case Instruction::Add:
+    case Instruction::Sub:
+    case Instruction::Mul:
+    case Instruction::Div:
+    case Instruction::Eq:
+    case Instruction::Neq:
+    case Instruction::Less:
+    case Instruction::LessEq:
+    case Instruction::Greater:
+    case Instruction::GreaterEq:
+    case Instruction::Ret:
+    case Instruction::LiteralCompareJump:
+      return -1;
+    case Instruction::CompareJump:
+      return -2;
+    case Instruction::Call:
+      return 1 - static_cast<long long>(callee(inst.operands[1]).params);
+    case Instruction::TailCall:
+      return -inst.operands[4];
+    default:
+      return 0;
+    }
+  }
+
+  // The function a call enters, through the Jmp over nested functions.
+  const Function &callee(long long target) const {
+    for (int step = 0; step < 16; step++) {
+      for (const auto &f : functions) {
+        if (static_cast<long long>(f.entry) == target) {
+          return f;
+        }
+      }
+      if (target < 0 || target >= static_cast<long long>(program.size()) ||
+          program[target] != static_cast<long long>(Instruction::Jmp)) {
+        break;
+      }
+      target = program[target + 1];
+    }
+    throw "middle end: call to an unknown function";
+  }
+
+  void fill() {
+    const long long first_local = 2;
+    for (long long addr = -graph.params; addr < first_local + graph.locals;
+         addr++) {
+      if (!graph.is_promoted(addr)) {
+        continue;
+      }
+      Value value = make(addr < 0 ? Op::Arg : Op::Const);
+      value.addr = addr;
+      value.variable = addr;
+      write(addr, 0, graph.add(0, value));
+    }
+    Value jmp = make(Op::Jmp);
+    graph.add(0, jmp);
+
+    filled.assign(graph.blocks.size(), false);
+    sealed.assign(graph.blocks.size(), false);
+    filled[0] = true;
+    sealed[0] = true;
+    for (BlockId block : reverse_postorder()) {
+      if (block == 0) {
+        continue;
+      }
+      try_seal(block);
+      if (block == exit_block) {
+        Value exit = make(Op::Exit);
+        exit.target = func.end;
+        graph.add(block, exit);
+      } else {
+        for (const auto &range : ranges) {
+          if (range.block == block) {
+            fill(range);
+            break;
+          }
+        }
+      }
+      filled[block] = true;
+      for (BlockId succ : graph.blocks[block].succs) {
+        try_seal(succ);
+      }
+    }
+  }
+
+  std::vector<BlockId> reverse_postorder() const {
+    std::vector<BlockId> order;
+    std::vector<bool> seen(graph.blocks.size(), false);
+    std::vector<std::pair<BlockId, size_t>> stack;
+    stack.push_back(std::make_pair(0, 0));
+    seen[0] = true;
+    while (!stack.empty()) {
+      auto &top = stack.back();
+      const auto &succs = graph.blocks[top.first].succs;
+      if (top.second < succs.size()) {
+        BlockId next = succs[top.second++];
+        if (!seen[next]) {
+          seen[next] = true;
+          stack.push_back(std::make_pair(next, 0));
+        }
+      } else {
+        order.push_back(top.first);
+        stack.pop_back();
+      }
+    }
+    return std::vector<BlockId>(order.rbegin(), order.rend());
+  }
+
+  void fill(const Range &range) {
+    const BlockId block = range.block;
+    std::vector<ValueId> stack;
+    for (long long k = 0; k < range.depth; k++) {
+      stack.push_back(read(stack_key + k, block));
+    }
+    auto pop = [&] {
+      ValueId value = stack.back();
+      stack.pop_back();
+      return value;
+    };
+    auto constant = [&](long long c) {
+      Value value = make(Op::Const);
+      value.value = c;
+      return graph.add(block, value);
+    };
+    auto load = [&](long long level, long long addr) {
+      if (level == graph.level && graph.is_promoted(addr)) {
+        return read(addr, block);
+      }
+      Value value = make(Op::Load);
+      value.level = level;
+      value.addr = addr;
+      return graph.add(block, value);
+    };
+    auto store = [&](long long level, long long addr, ValueId operand) {
+      if (level == graph.level && graph.is_promoted(addr)) {
+        if (graph.values[operand].variable == no_variable) {
+          graph.values[operand].variable = addr;
+        }
+        write(addr, block, operand);
+        return;
+      }
+      Value value = make(Op::Store);
+      value.level = level;
+      value.addr = addr;
+      value.operands = {operand};
+      graph.add(block, value);
+    };
+    auto binary = [&](Instruction sub, ValueId lhs, ValueId rhs) {
+      Value value = make(Op::Binary);
+      value.sub = sub;
+      value.operands = {lhs, rhs};
+      return graph.add(block, value);
+    };
+    // Ends the block: saves the operand stack for the successors.
+    auto terminate = [&](Value value) {
+      for (size_t k = 0; k < stack.size(); k++) {
+        write(stack_key + k, block, stack[k]);
+      }
+      graph.add(block, std::move(value));
+    };
+
+    for (size_t i = range.first; i < range.last; i++) {
+      const Inst &inst = insts[i];
+      const long long *operand = inst.operands;
+      switch (inst.op) {
+      case Instruction::Load:
+        stack.push_back(load(operand[0], operand[1]));
+        break;
+      case Instruction::Store:
+        store(operand[0], operand[1], pop());
+        break;
+      case Instruction::Literal:
+        stack.push_back(constant(operand[0]));
+        break;
+      case Instruction::Neg:
+      case Instruction::Odd: {
+        Value value = make(Op::Unary);
+        value.sub = inst.op;
+        value.operands = {pop()};
+        stack.push_back(graph.add(block, value));
+        break;
+      }
+      case Instruction::Add:
+      case Instruction::Sub:
+      case Instruction::Mul:
+      case Instruction::Div:
+      case Instruction::Eq:
+      case Instruction::Neq:
+      case Instruction::Less:
+      case Instruction::LessEq:
+      case Instruction::Greater:
+      case Instruction::GreaterEq: {
+        ValueId rhs = pop();
+        ValueId lhs = pop();
+        stack.push_back(binary(inst.op, lhs, rhs));
+        break;
+      }
+      case Instruction::LoadOp: {
+        ValueId rhs = load(operand[0], operand[1]);
+        ValueId lhs = pop();
+        stack.push_back(
+            binary(static_cast<Instruction>(operand[2]), lhs, rhs));
+        break;
+      }
+      case Instruction::LiteralOp: {
+        ValueId rhs = constant(operand[0]);
+        ValueId lhs = pop();
+        stack.push_back(
+            binary(static_cast<Instruction>(operand[1]), lhs, rhs));
+        break;
+      }
+      case Instruction::LoadLoadOp: {
+        ValueId lhs = load(operand[0], operand[1]);
+        ValueId rhs = load(operand[2], operand[3]);
+        stack.push_back(
+            binary(static_cast<Instruction>(operand[4]), lhs, rhs));
+        break;
+      }
+      case Instruction::LoadAddStore: {
+        ValueId sum = binary(Instruction::Add, load(operand[0], operand[1]),
+                             constant(operand[2]));
+        store(operand[0], operand[1], sum);
+        break;
+      }
+      case Instruction::Write: {
+        Value value = make(Op::Write);
+        value.operands = {pop()};
+        graph.add(block, value);
+        break;
+      }
+      case Instruction::Writeln:
+        graph.add(block, make(Op::Writeln));
+        break;
+      case Instruction::Call: {
+        Value value = make(Op::Call);
+        value.level = operand[0];
+        value.target = operand[1];
+        size_t params = callee(operand[1]).params;
+        value.operands.assign(stack.end() - params, stack.end());
+        stack.resize(stack.size() - params);
+        stack.push_back(graph.add(block, value));
+        break;
+      }
+      case Instruction::Jmp:
+        terminate(make(Op::Jmp));
+        break;
+      case Instruction::Jpc: {
+        Value value = make(Op::Branch);
+        value.operands = {pop()};
+        terminate(value);
+        break;
+      }
+      case Instruction::CompareJump: {
+        ValueId rhs = pop();
+        ValueId lhs = pop();
+        Value value = make(Op::Branch);
+        value.operands = {binary(static_cast<Instruction>(operand[0]), lhs,
+                                 rhs)};
+        terminate(value);
+        break;
+      }
+      case Instruction::LiteralCompareJump: {
+        ValueId rhs = constant(operand[0]);
+        ValueId lhs = pop();
+        Value value = make(Op::Branch);
+        value.operands = {binary(static_cast<Instruction>(operand[1]), lhs,
+                                 rhs)};
+        terminate(value);
+        break;
+      }
+      case Instruction::LoadLoadCompareJump: {
+        ValueId lhs = load(operand[0], operand[1]);
+        ValueId rhs = load(operand[2], operand[3]);
+        Value value = make(Op::Branch);
+        value.operands = {binary(static_cast<Instruction>(operand[4]), lhs,
+                                 rhs)};
+        terminate(value);
+        break;
+      }
+      case Instruction::Ret: {
+        Value value = make(Op::Ret);
+        value.level = operand[0];
+        value.addr = operand[1];
+        value.operands = {pop()};
+        graph.add(block, value);
+        break;
+      }
+      case Instruction::TailCall: {
+        Value value = make(Op::TailCall);
+        value.level = operand[0];
+        value.target = operand[1];
+        value.caller_level = operand[2];
+        value.caller_params = operand[3];
+        value.operands.assign(stack.end() - operand[4], stack.end());
+        graph.add(block, value);
+        break;
+      }
+      default:
+        throw "middle end: unexpected instruction in a body";
+      }
+    }
+    if (graph.blocks[block].values.empty() ||
+        !is_terminator(graph.terminator(block).op)) {
+      terminate(make(Op::Jmp)); // falls through
+    }
+  }
+
+  void write(long long variable, BlockId block, ValueId value) {
+    definitions[std::make_pair(variable, block)] = value;
+  }
+
+  ValueId read(long long variable, BlockId block) {
+    auto found = definitions.find(std::make_pair(variable, block));
+    if (found != definitions.end()) {
+      return found->second;
+    }
+    ValueId value;
+    const auto &preds = graph.blocks[block].preds;
+    if (!sealed[block]) {
+      value = phi(variable, block);
+      incomplete[block].push_back(std::make_pair(variable, value));
+    } else if (preds.size() == 1) {
+      value = read(variable, preds[0]);
+    } else if (preds.empty()) {
+      // Only the entry has no predecessors, and it defines every variable
+      // but the operand stack, which starts out empty.
+      throw "middle end: read of an undefined variable";
+    } else {
+      value = phi(variable, block);
+      write(variable, block, value);
+      complete(variable, value);
+    }
+    write(variable, block, value);
+    return value;
+  }
+
+  // An empty phi at the start of block.
+  ValueId phi(long long variable, BlockId block) {
+    Value value = make(Op::Phi);
+    value.block = block;
+    if (variable < stack_key) {
+      value.variable = variable;
+    }
+    graph.values.push_back(value);
+    ValueId id = static_cast<ValueId>(graph.values.size() - 1);
+    auto &values = graph.blocks[block].values;
+    auto at = values.begin();
+    while (at != values.end() && graph.values[*at].op == Op::Phi) {
+      ++at;
+    }
+    values.insert(at, id);
+    return id;
+  }
+
+  void complete(long long variable, ValueId phi) {
+    const BlockId block = graph.values[phi].block;
+    for (BlockId pred : graph.blocks[block].preds) {
+      ValueId operand = read(variable, pred);
+      graph.values[phi].operands.push_back(operand);
+    }
+  }
+
+  // Seals block once all its predecessors are filled: no more definitions
+  // can reach it, so its pending phis get their operands.
+  void try_seal(BlockId block) {
+    if (sealed[block]) {
+      return;
+    }
+    for (BlockId pred : graph.blocks[block].preds) {
+      if (!filled[pred]) {
+        return;
+      }
+    }
+    sealed[block] = true;
+    auto pending = std::move(incomplete[block]);
+    for (const auto &entry : pending) {
+      complete(entry.first, entry.second);
+    }
+  }
+
+private:
+  const Program &program;
+  const FunctionTable &functions;
+  const size_t function;
+  const Function &func;
+  const bool is_main;
+  Graph graph;
+  std::vector<Inst> insts;
+  std::vector<long long> index_at; // by Program offset, within the body
+  std::vector<long long> range_at; // by instruction index, for leaders
+  std::vector<Range> ranges;
+  BlockId exit_block;
+
+  std::map<std::pair<long long, BlockId>, ValueId> definitions;
+  std::map<BlockId, std::vector<std::pair<long long, ValueId>>> incomplete;
+  std::vector<bool> filled;
+  std::vector<bool> sealed;
+};
+} // namespace
+
+Graph ir::build(const Program &program, const FunctionTable &functions,
+                size_t function) {
+  return Builder(program, functions, function).build();
+}
@@ -0,0 +1,720 @@
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <initializer_list>
+
+#include "./ir.hpp"
+
+using namespace pl0;
+using namespace pl0::ir;
+
+namespace {
+// The compare that gives the same result with its operands swapped, or
+// Halt if there is none.
+Instruction swapped(Instruction op) {
+  switch (op) {
+  case Instruction::Add:
+  case Instruction::Mul:
+  case Instruction::Eq:
+  case Instruction::Neq:
+    return op;
+  case Instruction::Less:
+    return Instruction::Greater;
+  case Instruction::LessEq:
+    return Instruction::GreaterEq;
+  case Instruction::Greater:
+    return Instruction::Less;
+  case Instruction::GreaterEq:
+    return Instruction::LessEq;
+  default:
+    return Instruction::Halt;
+  }
+}
+
+bool has_result(Op op) {
+  switch (op) {
+  case Op::Const:
+  case Op::Arg:
+  case Op::Phi:
+  case Op::Unary:
+  case Op::Binary:
+  case Op::Load:
+  case Op::Call:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Appends instructions, forming the same superinstructions as Compiler
+// does, and never across a label.
+class Emitter {
+public:
+  explicit Emitter(size_t base) : base(base), label_at(0) {}
+
+  size_t label() {
+    label_at = program.size();
+    return base + label_at;
+  }
+
+  void append(Instruction op, std::initializer_list<long long> operands) {
+    starts.push_back(program.size());
+    program.push_back(static_cast<long long>(op));
+    program.insert(program.end(), operands.begin(), operands.end());
+    combine();
+  }
+
+  size_t size() const { return program.size(); }
+  Program &code() { return program; }
+
+private:
+  void combine() {
+    const Instruction last = tail(0);
+
+    if (is_binary_op(last)) {
+      if (combinable(3) && tail(1) == Instruction::Load &&
+          tail(2) == Instruction::Load) {
+        const Program lhs = operands(2), rhs = operands(1);
+        replace_tail(3, Instruction::LoadLoadOp,
+                     {lhs[0], lhs[1], rhs[0], rhs[1],
+                      static_cast<long long>(last)});
+      } else if (combinable(2) && tail(1) == Instruction::Load) {
+        const Program rhs = operands(1);
+        replace_tail(2, Instruction::LoadOp,
+                     {rhs[0], rhs[1], static_cast<long long>(last)});
+      } else if (combinable(2) && tail(1) == Instruction::Literal) {
+        const Program rhs = operands(1);
+        replace_tail(2, Instruction::LiteralOp,
+                     {rhs[0], static_cast<long long>(last)});
+      }
+    } else if (last == Instruction::Jpc) {
+      const long long target = operands(0)[0];
+      if (combinable(2) && is_compare(tail(1))) {
+        const long long cond = static_cast<long long>(tail(1));
+        replace_tail(2, Instruction::CompareJump, {cond, target});
+      } else if (combinable(2) && tail(1) == Instruction::LiteralOp &&
+                 is_compare(static_cast<Instruction>(operands(1)[1]))) {
+        const Program op = operands(1);
+        replace_tail(2, Instruction::LiteralCompareJump,
+                     {op[0], op[1], target});
+      } else if (combinable(2) && tail(1) == Instruction::LoadLoadOp &&
+                 is_compare(static_cast<Instruction>(operands(1)[4]))) {
+        const Program op = operands(1);
+        replace_tail(2, Instruction::LoadLoadCompareJump,
+                     {op[0], op[1], op[2], op[3], op[4], target});
+      }
+    } else if (last == Instruction::Store) {
+      if (combinable(3) && tail(1) == Instruction::LiteralOp &&
+          tail(2) == Instruction::Load) {
+        const Program store = operands(0), op = operands(1),
+                      load = operands(2);
+        const Instruction kind = static_cast<Instruction>(op[1]);
+        const bool same = load[0] == store[0] && load[1] == store[1];
+        if (same && kind == Instruction::Add) {
+          replace_tail(3, Instruction::LoadAddStore,
+                       {store[0], store[1], op[0]});
+        } else if (same && kind == Instruction::Sub && op[0] != LLONG_MIN) {
+          replace_tail(3, Instruction::LoadAddStore,
+                       {store[0], store[1], -op[0]});
+        }
+      }
+    }
+  }
+
+  bool combinable(size_t count) const {
+    return starts.size() >= count &&
+           starts[starts.size() - count] >= label_at;
+  }
+
+  Instruction tail(size_t nth) const {
+    return static_cast<Instruction>(program[starts[starts.size() - 1 - nth]]);
+  }
+
+  Program operands(size_t nth) const {
+    const size_t start = starts[starts.size() - 1 - nth];
+    const size_t size = operand_size(tail(nth));
+    return Program(program.begin() + start + 1,
+                   program.begin() + start + 1 + size);
+  }
+
+  void replace_tail(size_t count, Instruction op,
+                    std::initializer_list<long long> operands) {
+    const size_t start = starts[starts.size() - count];
+    starts.resize(starts.size() - count);
+    program.resize(start);
+    append(op, operands);
+  }
+
+private:
+  const size_t base;
+  Program program;
+  std::vector<size_t> starts;
+  size_t label_at;
+};
+
+class Lowerer {
+public:
+  Lowerer(Graph &graph, size_t base, std::vector<size_t> &relocations)
+      : graph(graph), relocations(relocations), emitter(base) {}
+
+  Program lower() {
+    split_critical_edges();
+    lay_out();
+    count_uses();
+    for (BlockId block : layout) {
+      choose_stack_values(block);
+    }
+    allocate_slots();
+    emit();
+    return std::move(emitter.code());
+  }
+
+private:
+  // Gives every edge into a block with phis from a block that branches a
+  // block of its own, where the phi copies go.
+  void split_critical_edges() {
+    const size_t count = graph.blocks.size();
+    for (size_t b = 0; b < count; b++) {
+      if (graph.blocks[b].removed || graph.blocks[b].succs.size() < 2) {
+        continue;
+      }
+      for (size_t i = 0; i < graph.blocks[b].succs.size(); i++) {
+        const BlockId succ = graph.blocks[b].succs[i];
+        if (!has_phis(succ)) {
+          continue;
+        }
+        const BlockId edge = graph.add_block(LLONG_MAX);
+        graph.add(edge, make(Op::Jmp));
+        graph.blocks[edge].preds.push_back(b);
+        graph.blocks[edge].succs.push_back(succ);
+        graph.blocks[b].succs[i] = edge;
+        auto &preds = graph.blocks[succ].preds;
+        *std::find(preds.begin(), preds.end(), static_cast<BlockId>(b)) =
+            edge;
+      }
+    }
+  }
+
+  bool has_phis(BlockId block) const {
+    const auto &values = graph.blocks[block].values;
+    return !values.empty() && graph.values[values[0]].op == Op::Phi;
+  }
+
+  // Blocks in the order of the code they came from, the entry first.
+  void lay_out() {
+    for (size_t b = 0; b < graph.blocks.size(); b++) {
+      if (!graph.blocks[b].removed) {
+        layout.push_back(b);
+      }
+    }
+    std::stable_sort(layout.begin(), layout.end(),
+                     [&](BlockId a, BlockId b) {
+                       return graph.blocks[a].pos < graph.blocks[b].pos;
+                     });
+  }
+
+  void count_uses() {
+    uses.assign(graph.values.size(), 0);
+    user.assign(graph.values.size(), -1);
+    deferred.assign(graph.values.size(), false);
+    on_stack.assign(graph.values.size(), false);
+    for (BlockId block : layout) {
+      for (ValueId id : graph.blocks[block].values) {
+        for (ValueId operand : graph.values[id].operands) {
+          uses[operand]++;
+          user[operand] = id;
+        }
+      }
+    }
+    std::vector<size_t> position(graph.values.size(), 0);
+    std::vector<size_t> sensitive(graph.values.size(), SIZE_MAX);
+    for (BlockId block : layout) {
+      // Effects before each position, which a load or a division that may
+      // fail must not be moved across.
+      const auto &values = graph.blocks[block].values;
+      std::vector<size_t> effects(values.size() + 1, 0);
+      for (size_t i = 0; i < values.size(); i++) {
+        position[values[i]] = i;
+        const Op op = graph.values[values[i]].op;
+        effects[i + 1] = effects[i] + (op == Op::Store || op == Op::Call ||
+                                       op == Op::Write || op == Op::Writeln);
+      }
+      for (size_t i = 0; i < values.size(); i++) {
+        const ValueId id = values[i];
+        const Value &value = graph.values[id];
+        if (!is_local(id)) {
+          continue;
+        }
+        switch (value.op) {
+        case Op::Unary:
+        case Op::Binary:
+        case Op::Load: {
+          // The first instruction of the tree that has to stay in order.
+          size_t first = value.op == Op::Load || !is_pure(graph, value)
+                             ? i
+                             : SIZE_MAX;
+          bool leaves = true;
+          for (ValueId operand : value.operands) {
+            leaves = leaves && is_leaf(operand);
+            if (deferred[operand]) {
+              first = std::min(first, sensitive[operand]);
+            }
+          }
+          deferred[id] =
+              leaves && (first == SIZE_MAX ||
+                         effects[position[user[id]]] == effects[first]);
+          sensitive[id] = first;
+          on_stack[id] = !deferred[id];
+          break;
+        }
+        case Op::Call:
+          on_stack[id] = true;
+          break;
+        default:
+          break;
+        }
+      }
+    }
+  }
+
+  // Whether the only use of a value comes later in its own block.
+  bool is_local(ValueId id) const {
+    if (uses[id] != 1) {
+      return false;
+    }
+    const Value &by = graph.values[user[id]];
+    return by.op != Op::Phi && by.block == graph.values[id].block;
+  }
+
+  // Whether a value can be pushed anywhere up to its use: it is a constant,
+  // lives in a frame slot, or is computed from such values there.
+  bool is_leaf(ValueId id) const { return !on_stack[id]; }
+
+  // A value used once, later in its block, is computed where it is used,
+  // from operands that are constants, slots or computed the same way
+  // (deferred), unless that moves a load or a division that may fail
+  // across an effect. Other values used that way stay on the operand stack from
+  // where they are computed to their use if the values in between leave
+  // the stack as they found it and the use takes them from the top. Values
+  // that do not fit are demoted to frame slots until the block works out.
+  void choose_stack_values(BlockId block) {
+    while (!simulate(block)) {
+    }
+  }
+
+  bool simulate(BlockId block) {
+    std::vector<ValueId> stack;
+    for (ValueId id : graph.blocks[block].values) {
+      Value &value = graph.values[id];
+      if (value.op == Op::Phi || deferred[id]) {
+        continue;
+      }
+      auto &operands = value.operands;
+      if (value.op == Op::Binary && !on_stack[operands[0]] &&
+          on_stack[operands[1]] && swapped(value.sub) != Instruction::Halt) {
+        std::swap(operands[0], operands[1]);
+        value.sub = swapped(value.sub);
+      }
+      size_t count = 0;
+      while (count < operands.size() && on_stack[operands[count]]) {
+        count++;
+      }
+      for (size_t i = count; i < operands.size(); i++) {
+        if (on_stack[operands[i]]) {
+          on_stack[operands[i]] = false;
+          return false;
+        }
+      }
+      if (count > stack.size() ||
+          !std::equal(operands.begin(), operands.begin() + count,
+                      stack.end() - count)) {
+        for (size_t i = 0; i < count; i++) {
+          on_stack[operands[i]] = false;
+        }
+        return false;
+      }
+      stack.resize(stack.size() - count);
+      if (on_stack[id]) {
+        stack.push_back(id);
+      }
+    }
+    for (ValueId left : stack) {
+      on_stack[left] = false;
+    }
+    return stack.empty();
+  }
+
+  bool needs_slot(ValueId id) const {
+    const Value &value = graph.values[id];
+    return has_result(value.op) && value.op != Op::Const && !on_stack[id] &&
+           !deferred[id];
+  }
+
+  // Calls use for every value in slots that pushing id reads.
+  template <typename Use> void slot_operands(ValueId id, Use use) const {
+    if (deferred[id]) {
+      for (ValueId operand : graph.values[id].operands) {
+        slot_operands(operand, use);
+      }
+    } else if (needs_slot(id)) {
+      use(id);
+    }
+  }
+
+  // Every value that is neither on the stack nor a constant gets a frame
+  // slot. Slots are colors of the interference graph, picked greedily in
+  // layout order from the promoted variables' slots and new ones past the
+  // frame, preferring the variable the value was assigned to and the slots
+  // of the phis it meets, so that most phi copies go away.
+  void allocate_slots() {
+    std::vector<long long> dense(graph.values.size(), -1);
+    std::vector<ValueId> nodes;
+    for (BlockId block : layout) {
+      for (ValueId id : graph.blocks[block].values) {
+        if (needs_slot(id)) {
+          dense[id] = nodes.size();
+          nodes.push_back(id);
+        }
+      }
+    }
+    const size_t count = nodes.size();
+    std::vector<std::vector<size_t>> edges(count);
+
+    // Live sets at block entries, by dense index, to a fixed point.
+    std::vector<std::vector<bool>> live_in(graph.blocks.size(),
+                                           std::vector<bool>(count, false));
+    auto live_out = [&](BlockId block) {
+      std::vector<bool> live(count, false);
+      for (BlockId succ : graph.blocks[block].succs) {
+        const auto &in = live_in[succ];
+        for (size_t i = 0; i < count; i++) {
+          live[i] = live[i] || in[i];
+        }
+        const auto &preds = graph.blocks[succ].preds;
+        const size_t index =
+            std::find(preds.begin(), preds.end(), block) - preds.begin();
+        for (ValueId id : graph.blocks[succ].values) {
+          const Value &phi = graph.values[id];
+          if (phi.op != Op::Phi) {
+            break;
+          }
+          long long operand = dense[phi.operands[index]];
+          if (operand >= 0) {
+            live[operand] = true;
+          }
+        }
+      }
+      return live;
+    };
+    // Walks block backwards from live, calling interfere(def, live) at each
+    // definition; leaves live as the set at the block's entry, phis
+    // included.
+    auto walk = [&](BlockId block, std::vector<bool> &live,
+                    bool record) {
+      const auto &values = graph.blocks[block].values;
+      std::vector<size_t> phis;
+      for (auto it = values.rbegin(); it != values.rend(); ++it) {
+        const Value &value = graph.values[*it];
+        const long long def = dense[*it];
+        if (deferred[*it]) {
+          continue;
+        }
+        if (value.op == Op::Phi) {
+          if (def >= 0) {
+            phis.push_back(def);
+          }
+          continue;
+        }
+        if (def >= 0) {
+          if (record) {
+            for (size_t i = 0; i < count; i++) {
+              if (live[i] && i != static_cast<size_t>(def)) {
+                edges[def].push_back(i);
+                edges[i].push_back(def);
+              }
+            }
+          }
+          live[def] = false;
+        }
+        for (ValueId operand : value.operands) {
+          slot_operands(operand, [&](ValueId id) { live[dense[id]] = true; });
+        }
+      }
+      // Phis are all written at the end of every predecessor.
+      for (size_t phi : phis) {
+        live[phi] = true;
+      }
+      if (record) {
+        for (size_t phi : phis) {
+          for (size_t i = 0; i < count; i++) {
+            if (live[i] && i != phi) {
+              edges[phi].push_back(i);
+              edges[i].push_back(phi);
+            }
+          }
+        }
+      }
+      for (size_t phi : phis) {
+        live[phi] = false;
+      }
+    };
+
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto it = layout.rbegin(); it != layout.rend(); ++it) {
+        std::vector<bool> live = live_out(*it);
+        walk(*it, live, false);
+        if (live != live_in[*it]) {
+          live_in[*it] = std::move(live);
+          changed = true;
+        }
+      }
+    }
+    for (BlockId block : layout) {
+      std::vector<bool> live = live_out(block);
+      walk(block, live, true);
+    }
+
+    // The pool, in order of preference.
+    std::vector<long long> pool;
+    for (long long addr = -graph.params; addr < 2 + graph.locals; addr++) {
+      if (graph.is_promoted(addr)) {
+        pool.push_back(addr);
+      }
+    }
+    long long next_slot = 2 + graph.locals;
+
+    slot.assign(graph.values.size(), LLONG_MIN);
+    std::vector<long long> color(count, LLONG_MIN);
+    auto is_free = [&](size_t node, long long candidate) {
+      if (candidate == LLONG_MIN) {
+        return false;
+      }
+      for (size_t other : edges[node]) {
+        if (color[other] == candidate) {
+          return false;
+        }
+      }
+      return true;
+    };
+    auto assign = [&](size_t node, long long candidate) {
+      color[node] = candidate;
+      slot[nodes[node]] = candidate;
+    };
+
+    // Parameters arrive in their own slots.
+    for (size_t node = 0; node < count; node++) {
+      const Value &value = graph.values[nodes[node]];
+      if (value.op == Op::Arg) {
+        assign(node, value.addr);
+      }
+    }
+    for (size_t node = 0; node < count; node++) {
+      const ValueId id = nodes[node];
+      if (color[node] != LLONG_MIN) {
+        continue;
+      }
+      const Value &value = graph.values[id];
+      std::vector<long long> hints;
+      if (graph.is_promoted(value.variable)) {
+        hints.push_back(value.variable);
+      }
+      if (value.op == Op::Phi) {
+        for (ValueId operand : value.operands) {
+          hints.push_back(slot[operand]);
+        }
+      }
+      if (uses[id] == 1 && graph.values[user[id]].op == Op::Phi) {
+        hints.push_back(slot[user[id]]);
+      }
+      long long chosen = LLONG_MIN;
+      for (long long hint : hints) {
+        if (is_free(node, hint)) {
+          chosen = hint;
+          break;
+        }
+      }
+      for (size_t i = 0; chosen == LLONG_MIN; i++) {
+        if (i == pool.size()) {
+          pool.push_back(next_slot++);
+        }
+        if (is_free(node, pool[i])) {
+          chosen = pool[i];
+        }
+      }
+      assign(node, chosen);
+    }
+    frame_locals = std::max(graph.locals, next_slot - 2);
+  }
+
+  void push(ValueId id) {
+    const Value &value = graph.values[id];
+    if (on_stack[id]) {
+      return;
+    }
+    if (deferred[id]) {
+      for (ValueId operand : value.operands) {
+        push(operand);
+      }
+      if (value.op == Op::Load) {
+        emitter.append(Instruction::Load, {value.level, value.addr});
+      } else {
+        emitter.append(value.sub, {});
+      }
+    } else if (value.op == Op::Const) {
+      emitter.append(Instruction::Literal, {value.value});
+    } else {
+      emitter.append(Instruction::Load, {graph.level, slot[id]});
+    }
+  }
+
+  void jump(Instruction op, BlockId to) {
+    emitter.append(op, {0});
+    fixups.push_back(std::make_pair(emitter.size() - 1, to));
+  }
+
+  // The parallel copy into the phis of succ on the edge from block: all
+  // incoming values are pushed before any phi slot is written.
+  void copy_phis(BlockId block, BlockId succ) {
+    const auto &preds = graph.blocks[succ].preds;
+    const size_t index =
+        std::find(preds.begin(), preds.end(), block) - preds.begin();
+    std::vector<long long> targets;
+    for (ValueId id : graph.blocks[succ].values) {
+      const Value &phi = graph.values[id];
+      if (phi.op != Op::Phi) {
+        break;
+      }
+      const ValueId from = phi.operands[index];
+      if (graph.values[from].op != Op::Const && slot[from] == slot[id]) {
+        continue;
+      }
+      if (block == 0 && is_zero(from) && is_untouched(slot[id])) {
+        continue; // Ict zeroed it
+      }
+      push(from);
+      targets.push_back(slot[id]);
+    }
+    for (auto it = targets.rbegin(); it != targets.rend(); ++it) {
+      emitter.append(Instruction::Store, {graph.level, *it});
+    }
+  }
+
+  bool is_zero(ValueId id) const {
+    return graph.values[id].op == Op::Const && graph.values[id].value == 0;
+  }
+
+  // Whether a local slot still holds the 0 from the Ict at the end of the
+  // entry block.
+  bool is_untouched(long long addr) const {
+    if (addr < 2) {
+      return false;
+    }
+    for (ValueId id : graph.blocks[0].values) {
+      if (needs_slot(id) && slot[id] == addr) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void emit() {
+    std::vector<long long> label(graph.blocks.size(), -1);
+    emitter.append(Instruction::Ict, {frame_locals});
+    for (size_t i = 0; i < layout.size(); i++) {
+      const BlockId block = layout[i];
+      const BlockId next = i + 1 < layout.size() ? layout[i + 1] : -1;
+      label[block] = emitter.label();
+      for (ValueId id : graph.blocks[block].values) {
+        const Value &value = graph.values[id];
+        if (value.op == Op::Phi || value.op == Op::Const ||
+            value.op == Op::Arg || deferred[id]) {
+          continue;
+        }
+        for (ValueId operand : value.operands) {
+          push(operand);
+        }
+        const auto &succs = graph.blocks[block].succs;
+        switch (value.op) {
+        case Op::Unary:
+        case Op::Binary:
+          emitter.append(value.sub, {});
+          break;
+        case Op::Load:
+          emitter.append(Instruction::Load, {value.level, value.addr});
+          break;
+        case Op::Store:
+          emitter.append(Instruction::Store, {value.level, value.addr});
+          break;
+        case Op::Call:
+          emitter.append(Instruction::Call, {value.level, value.target});
+          relocations.push_back(emitter.size() - 1);
+          break;
+        case Op::Write:
+          emitter.append(Instruction::Write, {});
+          break;
+        case Op::Writeln:
+          emitter.append(Instruction::Writeln, {});
+          break;
+        case Op::Jmp:
+          copy_phis(block, succs[0]);
+          if (succs[0] != next) {
+            jump(Instruction::Jmp, succs[0]);
+          }
+          break;
+        case Op::Branch:
+          jump(Instruction::Jpc, succs[1]);
+          if (succs[0] != next) {
+            jump(Instruction::Jmp, succs[0]);
+          }
+          break;
+        case Op::Ret:
+          emitter.append(Instruction::Ret, {value.level, value.addr});
+          break;
+        case Op::TailCall:
+          emitter.append(Instruction::TailCall,
+                         {value.level, value.target, value.caller_level,
+                          value.caller_params,
+                          static_cast<long long>(value.operands.size())});
+          relocations.push_back(emitter.size() - 4);
+          break;
+        case Op::Exit:
+          if (next >= 0) {
+            emitter.append(Instruction::Jmp, {value.target});
+            relocations.push_back(emitter.size() - 1);
+          }
+          break;
+        default:
+          break;
+        }
+        if (needs_slot(id)) {
+          emitter.append(Instruction::Store, {graph.level, slot[id]});
+        }
+      }
+    }
+    Program &code = emitter.code();
+    for (const auto &fixup : fixups) {
+      code[fixup.first] = label[fixup.second];
+    }
+  }
+
+private:
+  Graph &graph;
+  std::vector<size_t> &relocations;
+  Emitter emitter;
+  std::vector<BlockId> layout;
+  std::vector<size_t> uses;     // by value
+  std::vector<ValueId> user;    // the last one, by value
+  std::vector<bool> deferred;   // by value
+  std::vector<bool> on_stack;   // by value
+  std::vector<long long> slot;  // frame address, by value
+  long long frame_locals = 0;   // for the Ict
+  std::vector<std::pair<size_t, BlockId>> fixups;
+};
+} // namespace
+
+Program ir::lower(Graph &graph, size_t base,
+                  std::vector<size_t> &relocations) {
+  return Lowerer(graph, base, relocations).lower();
+}
@@ -0,0 +1,794 @@
+#include <algorithm>
+#include <map>
+#include <set>
+#include <tuple>
+
+#include "./ir.hpp"
+
+using namespace pl0;
+using namespace pl0::ir;
+
+namespace {
+// Wrapping arithmetic, as the VM does it.
+long long wrap(unsigned long long value) { return static_cast<long long>(value); }
+
+bool evaluate(Instruction op, long long lhs, long long rhs, long long &result) {
+  const unsigned long long a = lhs, b = rhs;
+  switch (op) {
+  case Instruction::Add:
+    result = wrap(a + b);
+    return true;
+  case Instruction::Sub:
+    result = wrap(a - b);
+    return true;
+  case Instruction::Mul:
+    result = wrap(a * b);
+    return true;
+  case Instruction::Div:
+    if (rhs == 0) {
+      return false; // left for the VM to report
+    }
+    result = rhs == -1 ? wrap(0 - a) : lhs / rhs;
+    return true;
+  case Instruction::Eq:
+    result = lhs == rhs;
+    return true;
+  case Instruction::Neq:
+    result = lhs != rhs;
+    return true;
+  case Instruction::Less:
+    result = lhs < rhs;
+    return true;
+  case Instruction::LessEq:
+    result = lhs <= rhs;
+    return true;
+  case Instruction::Greater:
+    result = lhs > rhs;
+    return true;
+  case Instruction::GreaterEq:
+    result = lhs >= rhs;
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool is_commutative(Instruction op) {
+  switch (op) {
+  case Instruction::Add:
+  case Instruction::Mul:
+  case Instruction::Eq:
+  case Instruction::Neq:
+    return true;
+  default:
+    return false;
+  }
+}
+
+class Optimizer {
+public:
+  explicit Optimizer(Graph &graph) : graph(graph) {}
+
+  void run() {
+    rewrite();
+    for (int round = 0; round < 8; round++) {
+      bool changed = false;
+      changed |= step(&Optimizer::remove_unreachable);
+      changed |= step(&Optimizer::simplify_phis);
+      changed |= step(&Optimizer::fold);
+      changed |= step(&Optimizer::merge_blocks);
+      changed |= step(&Optimizer::eliminate_common);
+      changed |= step(&Optimizer::eliminate_dead);
+      if (!changed) {
+        break;
+      }
+    }
+    step(&Optimizer::hoist_invariants);
+    step(&Optimizer::eliminate_common);
+    step(&Optimizer::eliminate_dead);
+    step(&Optimizer::remove_empty_blocks);
+  }
+
+private:
+  bool step(bool (Optimizer::*pass)()) {
+    bool changed = (this->*pass)();
+    rewrite();
+    return changed;
+  }
+
+  ValueId resolve(ValueId value) {
+    ValueId root = value;
+    while (forward.count(root) != 0) {
+      root = forward[root];
+    }
+    while (value != root) {
+      ValueId next = forward[value];
+      forward[value] = root;
+      value = next;
+    }
+    return root;
+  }
+
+  // Replaces every use of value with by and drops value.
+  void replace(ValueId value, ValueId by) {
+    if (value == by) {
+      return;
+    }
+    forward[value] = by;
+    if (graph.values[by].variable == no_variable) {
+      graph.values[by].variable = graph.values[value].variable;
+    }
+    graph.values[value].op = Op::Nop;
+  }
+
+  void remove(ValueId value) { graph.values[value].op = Op::Nop; }
+
+  // Applies the replacements to the operands and drops the removed values
+  // from their blocks.
+  void rewrite() {
+    for (auto &block : graph.blocks) {
+      if (block.removed) {
+        continue;
+      }
+      auto &values = block.values;
+      values.erase(std::remove_if(values.begin(), values.end(),
+                                  [&](ValueId id) {
+                                    return graph.values[id].op == Op::Nop;
+                                  }),
+                   values.end());
+      for (ValueId id : values) {
+        for (auto &operand : graph.values[id].operands) {
+          operand = resolve(operand);
+        }
+      }
+    }
+  }
+
+  bool is_const(ValueId value, long long c) const {
+    return graph.values[value].op == Op::Const && graph.values[value].value == c;
+  }
+
+  std::vector<BlockId> reverse_postorder() const {
+    std::vector<BlockId> order;
+    std::vector<bool> seen(graph.blocks.size(), false);
+    std::vector<std::pair<BlockId, size_t>> stack;
+    stack.push_back(std::make_pair(0, 0));
+    seen[0] = true;
+    while (!stack.empty()) {
+      auto &top = stack.back();
+      const auto &succs = graph.blocks[top.first].succs;
+      if (top.second < succs.size()) {
+        BlockId next = succs[top.second++];
+        if (!seen[next]) {
+          seen[next] = true;
+          stack.push_back(std::make_pair(next, 0));
+        }
+      } else {
+        order.push_back(top.first);
+        stack.pop_back();
+      }
+    }
+    return std::vector<BlockId>(order.rbegin(), order.rend());
+  }
+
+  // Removes the edge to succs[index] of from, with its phi operands. A
+  // target that is already removed has no preds or phis left to update.
+  void remove_edge(BlockId from, size_t index) {
+    Block &source = graph.blocks[from];
+    const BlockId to = source.succs[index];
+    source.succs.erase(source.succs.begin() + index);
+    Block &target = graph.blocks[to];
+    if (target.removed) {
+      return;
+    }
+    auto at = std::find(target.preds.begin(), target.preds.end(), from);
+    const size_t pred = at - target.preds.begin();
+    target.preds.erase(at);
+    for (ValueId id : target.values) {
+      Value &value = graph.values[id];
+      if (value.op == Op::Phi) {
+        value.operands.erase(value.operands.begin() + pred);
+      }
+    }
+  }
+
+  bool remove_unreachable() {
+    std::vector<bool> reachable(graph.blocks.size(), false);
+    for (BlockId block : reverse_postorder()) {
+      reachable[block] = true;
+    }
+    bool changed = false;
+    for (size_t b = 0; b < graph.blocks.size(); b++) {
+      Block &block = graph.blocks[b];
+      if (reachable[b] || block.removed) {
+        continue;
+      }
+      while (!block.succs.empty()) {
+        remove_edge(b, block.succs.size() - 1);
+      }
+      for (ValueId id : block.values) {
+        remove(id);
+      }
+      block.values.clear();
+      block.preds.clear();
+      block.removed = true;
+      changed = true;
+    }
+    return changed;
+  }
+
+  bool simplify_phis() {
+    bool changed = false;
+    bool again = true;
+    while (again) {
+      again = false;
+      for (auto &block : graph.blocks) {
+        if (block.removed) {
+          continue;
+        }
+        for (ValueId id : block.values) {
+          Value &value = graph.values[id];
+          if (value.op != Op::Phi) {
+            continue;
+          }
+          ValueId same = -1;
+          bool trivial = true;
+          for (ValueId operand : value.operands) {
+            operand = resolve(operand);
+            if (operand == id || operand == same) {
+              continue;
+            }
+            if (same >= 0) {
+              trivial = false;
+              break;
+            }
+            same = operand;
+          }
+          if (trivial && same >= 0) {
+            replace(id, same);
+            again = changed = true;
+          }
+        }
+      }
+    }
+    return changed;
+  }
+
+  bool fold() {
+    bool changed = false;
+    for (size_t b = 0; b < graph.blocks.size(); b++) {
+      if (graph.blocks[b].removed) {
+        continue;
+      }
+      for (ValueId id : graph.blocks[b].values) {
+        changed |= fold(id);
+      }
+      Value &last = graph.values[graph.blocks[b].values.back()];
+      if (last.op == Op::Branch &&
+          graph.values[last.operands[0]].op == Op::Const) {
+        // Keep succs[0] if the condition holds.
+        const bool taken = graph.values[last.operands[0]].value != 0;
+        remove_edge(b, taken ? 1 : 0);
+        last.op = Op::Jmp;
+        last.operands.clear();
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  // Folds value into a constant, or into one of its operands.
+  bool fold(ValueId id) {
+    Value &value = graph.values[id];
+    if (value.op == Op::Unary) {
+      const Value &operand = graph.values[value.operands[0]];
+      if (operand.op != Op::Const) {
+        return false;
+      }
+      const long long c = operand.value;
+      to_const(value, value.sub == Instruction::Neg
+                          ? wrap(0 - static_cast<unsigned long long>(c))
+                          : c % 2);
+      return true;
+    }
+    if (value.op != Op::Binary) {
+      return false;
+    }
+    const ValueId lhs = value.operands[0], rhs = value.operands[1];
+    const Value &left = graph.values[lhs], &right = graph.values[rhs];
+    long long result;
+    if (left.op == Op::Const && right.op == Op::Const &&
+        evaluate(value.sub, left.value, right.value, result)) {
+      to_const(value, result);
+      return true;
+    }
+
+    switch (value.sub) {
+    case Instruction::Add:
+      if (is_const(rhs, 0) || is_const(lhs, 0)) {
+        replace(id, is_const(rhs, 0) ? lhs : rhs);
+        return true;
+      }
+      break;
+    case Instruction::Sub:
+      if (is_const(rhs, 0)) {
+        replace(id, lhs);
+        return true;
+      }
+      if (lhs == rhs) {
+        to_const(value, 0);
+        return true;
+      }
+      break;
+    case Instruction::Mul:
+      if (is_const(rhs, 1) || is_const(lhs, 1)) {
+        replace(id, is_const(rhs, 1) ? lhs : rhs);
+        return true;
+      }
+      if (is_const(rhs, 0) || is_const(lhs, 0)) {
+        to_const(value, 0);
+        return true;
+      }
+      break;
+    case Instruction::Div:
+      if (is_const(rhs, 1)) {
+        replace(id, lhs);
+        return true;
+      }
+      break;
+    case Instruction::Eq:
+    case Instruction::LessEq:
+    case Instruction::GreaterEq:
+      if (lhs == rhs) {
+        to_const(value, 1);
+        return true;
+      }
+      break;
+    case Instruction::Neq:
+    case Instruction::Less:
+    case Instruction::Greater:
+      if (lhs == rhs) {
+        to_const(value, 0);
+        return true;
+      }
+      break;
+    default:
+      break;
+    }
+    return false;
+  }
+
+  static void to_const(Value &value, long long c) {
+    value.op = Op::Const;
+    value.value = c;
+    value.operands.clear();
+  }
+
+  // Appends a block to its only predecessor when that one jumps to it.
+  bool merge_blocks() {
+    bool changed = false;
+    for (size_t b = 0; b < graph.blocks.size(); b++) {
+      while (!graph.blocks[b].removed) {
+        Block &block = graph.blocks[b];
+        if (graph.terminator(b).op != Op::Jmp) {
+          break;
+        }
+        const BlockId s = block.succs[0];
+        Block &succ = graph.blocks[s];
+        if (s == static_cast<BlockId>(b) || s == 0 || succ.preds.size() != 1) {
+          break;
+        }
+        remove(block.values.back());
+        block.values.pop_back();
+        for (ValueId id : succ.values) {
+          Value &value = graph.values[id];
+          if (value.op == Op::Phi) {
+            replace(id, value.operands[0]);
+            continue;
+          }
+          value.block = b;
+          block.values.push_back(id);
+        }
+        block.succs = std::move(succ.succs);
+        for (BlockId next : block.succs) {
+          for (auto &pred : graph.blocks[next].preds) {
+            if (pred == s) {
+              pred = b;
+            }
+          }
+        }
+        succ.values.clear();
+        succ.preds.clear();
+        succ.succs.clear();
+        succ.removed = true;
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  // Immediate dominators, by Cooper, Harvey and Kennedy, "A Simple, Fast
+  // Dominance Algorithm". idom[0] is 0 and unreachable blocks have -1.
+  void dominators() {
+    order = reverse_postorder();
+    rank.assign(graph.blocks.size(), -1);
+    for (size_t i = 0; i < order.size(); i++) {
+      rank[order[i]] = i;
+    }
+    idom.assign(graph.blocks.size(), -1);
+    idom[0] = 0;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t i = 1; i < order.size(); i++) {
+        const BlockId block = order[i];
+        BlockId dom = -1;
+        for (BlockId pred : graph.blocks[block].preds) {
+          if (idom[pred] < 0) {
+            continue;
+          }
+          dom = dom < 0 ? pred : intersect(pred, dom);
+        }
+        if (idom[block] != dom) {
+          idom[block] = dom;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  BlockId intersect(BlockId a, BlockId b) const {
+    while (a != b) {
+      while (rank[a] > rank[b]) {
+        a = idom[a];
+      }
+      while (rank[b] > rank[a]) {
+        b = idom[b];
+      }
+    }
+    return a;
+  }
+
+  bool dominates(BlockId a, BlockId b) const {
+    while (b != a && b != 0) {
+      b = idom[b];
+    }
+    return b == a;
+  }
+
+  // Pure values are looked up by their operation and operands over the
+  // dominator tree, so that a value replaces every later copy of it that
+  // it dominates. Memory loads are only reused within a block, up to the
+  // next call; a store makes its value the one to load.
+  bool eliminate_common() {
+    dominators();
+    std::vector<std::vector<BlockId>> children(graph.blocks.size());
+    for (size_t i = 1; i < order.size(); i++) {
+      children[idom[order[i]]].push_back(order[i]);
+    }
+
+    using Key = std::tuple<Op, Instruction, long long, std::vector<ValueId>>;
+    std::map<Key, ValueId> available;
+    std::vector<std::pair<BlockId, std::vector<Key>>> stack;
+    stack.push_back(std::make_pair(0, std::vector<Key>()));
+    std::vector<size_t> next_child(graph.blocks.size(), 0);
+    bool changed = false;
+    bool entering = true;
+
+    while (!stack.empty()) {
+      const BlockId b = stack.back().first;
+      if (entering) {
+        std::vector<Key> added;
+        std::map<std::pair<long long, long long>, ValueId> memory;
+        for (ValueId id : graph.blocks[b].values) {
+          Value &value = graph.values[id];
+          for (auto &operand : value.operands) {
+            operand = resolve(operand);
+          }
+          if (value.op == Op::Load || value.op == Op::Store) {
+            auto var = std::make_pair(value.level, value.addr);
+            auto found = memory.find(var);
+            if (value.op == Op::Load && found != memory.end()) {
+              replace(id, found->second);
+              changed = true;
+            } else {
+              memory[var] = value.op == Op::Load ? id : value.operands[0];
+            }
+            continue;
+          }
+          if (value.op == Op::Call) {
+            memory.clear();
+            continue;
+          }
+          if ((value.op != Op::Const && value.op != Op::Unary &&
+               value.op != Op::Binary) ||
+              !is_pure(graph, value)) {
+            continue;
+          }
+          std::vector<ValueId> operands = value.operands;
+          if (value.op == Op::Binary && is_commutative(value.sub)) {
+            std::sort(operands.begin(), operands.end());
+          }
+          Key key(value.op, value.sub, value.value, std::move(operands));
+          auto found = available.find(key);
+          if (found != available.end()) {
+            replace(id, found->second);
+            changed = true;
+          } else {
+            available[key] = id;
+            added.push_back(std::move(key));
+          }
+        }
+        stack.back().second = std::move(added);
+      }
+      if (next_child[b] < children[b].size()) {
+        stack.push_back(
+            std::make_pair(children[b][next_child[b]++], std::vector<Key>()));
+        entering = true;
+      } else {
+        for (const auto &key : stack.back().second) {
+          available.erase(key);
+        }
+        stack.pop_back();
+        entering = false;
+      }
+    }
+    return changed;
+  }
+
+  // Drops every value that neither has an effect nor feeds one.
+  bool eliminate_dead() {
+    std::vector<bool> live(graph.values.size(), false);
+    std::vector<ValueId> work;
+    for (const auto &block : graph.blocks) {
+      if (block.removed) {
+        continue;
+      }
+      for (ValueId id : block.values) {
+        const Value &value = graph.values[id];
+        switch (value.op) {
+        case Op::Const:
+        case Op::Arg:
+        case Op::Phi:
+        case Op::Unary:
+        case Op::Load:
+          break;
+        case Op::Binary:
+          if (is_pure(graph, value)) {
+            break;
+          }
+          // fallthrough
+        default:
+          live[id] = true;
+          work.push_back(id);
+        }
+      }
+    }
+    while (!work.empty()) {
+      ValueId id = work.back();
+      work.pop_back();
+      for (ValueId operand : graph.values[id].operands) {
+        operand = resolve(operand);
+        if (!live[operand]) {
+          live[operand] = true;
+          work.push_back(operand);
+        }
+      }
+    }
+    bool changed = false;
+    for (const auto &block : graph.blocks) {
+      if (block.removed) {
+        continue;
+      }
+      for (ValueId id : block.values) {
+        if (!live[id]) {
+          remove(id);
+          changed = true;
+        }
+      }
+    }
+    return changed;
+  }
+
+  // Moves the values a loop computes the same way on every iteration to
+  // its preheader: pure operations on values from outside the loop, and
+  // loads of variables the loop neither stores nor can reach by a call.
+  // Inner loops go first, so their hoisted values may move on outwards.
+  bool hoist_invariants() {
+    bool changed = false;
+    std::set<BlockId> done;
+    while (true) {
+      dominators();
+      std::map<BlockId, std::set<BlockId>> loops;
+      for (BlockId block : order) {
+        for (BlockId succ : graph.blocks[block].succs) {
+          if (dominates(succ, block)) {
+            collect_loop(succ, block, loops[succ]);
+          }
+        }
+      }
+      BlockId header = -1;
+      for (const auto &loop : loops) {
+        if (done.count(loop.first) == 0 &&
+            (header < 0 || loop.second.size() < loops[header].size())) {
+          header = loop.first;
+        }
+      }
+      if (header < 0) {
+        return changed;
+      }
+      done.insert(header);
+      changed |= hoist(header, loops[header]);
+    }
+  }
+
+  void collect_loop(BlockId header, BlockId tail, std::set<BlockId> &body) {
+    body.insert(header);
+    std::vector<BlockId> work;
+    if (body.insert(tail).second) {
+      work.push_back(tail);
+    }
+    while (!work.empty()) {
+      BlockId block = work.back();
+      work.pop_back();
+      for (BlockId pred : graph.blocks[block].preds) {
+        if (body.insert(pred).second) {
+          work.push_back(pred);
+        }
+      }
+    }
+  }
+
+  bool hoist(BlockId header, const std::set<BlockId> &body) {
+    std::set<std::pair<long long, long long>> stored;
+    bool calls = false;
+    std::vector<ValueId> candidates;
+    for (BlockId block : order) {
+      if (body.count(block) == 0) {
+        continue;
+      }
+      for (ValueId id : graph.blocks[block].values) {
+        const Value &value = graph.values[id];
+        if (value.op == Op::Store) {
+          stored.insert(std::make_pair(value.level, value.addr));
+        } else if (value.op == Op::Call) {
+          calls = true;
+        } else if (value.op == Op::Const || value.op == Op::Unary ||
+                   value.op == Op::Binary || value.op == Op::Load) {
+          candidates.push_back(id);
+        }
+      }
+    }
+
+    std::vector<ValueId> hoisted;
+    std::set<ValueId> moved;
+    auto invariant = [&](const Value &value) {
+      if (value.op == Op::Load) {
+        if (calls || stored.count(std::make_pair(value.level, value.addr))) {
+          return false;
+        }
+      } else if (!is_pure(graph, value)) {
+        return false;
+      }
+      for (ValueId operand : value.operands) {
+        if (body.count(graph.values[operand].block) != 0 &&
+            moved.count(operand) == 0) {
+          return false;
+        }
+      }
+      return true;
+    };
+    // candidates are in dominance order, so one pass finds them all.
+    for (ValueId id : candidates) {
+      if (invariant(graph.values[id])) {
+        hoisted.push_back(id);
+        moved.insert(id);
+      }
+    }
+    bool useful = false;
+    for (ValueId id : hoisted) {
+      useful |= graph.values[id].op != Op::Const;
+    }
+    if (!useful) {
+      return false;
+    }
+
+    const BlockId preheader = make_preheader(header, body);
+    if (preheader < 0) {
+      return false;
+    }
+    for (ValueId id : hoisted) {
+      auto &from = graph.blocks[graph.values[id].block].values;
+      from.erase(std::find(from.begin(), from.end(), id));
+      auto &to = graph.blocks[preheader].values;
+      to.insert(to.end() - 1, id);
+      graph.values[id].block = preheader;
+    }
+    return true;
+  }
+
+  // The block that all entries into the loop go through, made if needed;
+  // -1 if the loop is entered from more than one place.
+  BlockId make_preheader(BlockId header, const std::set<BlockId> &body) {
+    BlockId outside = -1;
+    size_t index = 0;
+    const auto &preds = graph.blocks[header].preds;
+    for (size_t i = 0; i < preds.size(); i++) {
+      if (body.count(preds[i]) != 0) {
+        continue;
+      }
+      if (outside >= 0) {
+        return -1;
+      }
+      outside = preds[i];
+      index = i;
+    }
+    if (outside < 0) {
+      return -1;
+    }
+    if (graph.blocks[outside].succs.size() == 1) {
+      return outside;
+    }
+    const BlockId preheader = graph.add_block(graph.blocks[header].pos - 1);
+    graph.add(preheader, make(Op::Jmp));
+    Block &block = graph.blocks[preheader];
+    block.preds.push_back(outside);
+    block.succs.push_back(header);
+    for (auto &succ : graph.blocks[outside].succs) {
+      if (succ == header) {
+        succ = preheader;
+      }
+    }
+    graph.blocks[header].preds[index] = preheader;
+    return preheader;
+  }
+
+  // Sends the predecessor of a block that only jumps on straight to the
+  // block's successor.
+  bool remove_empty_blocks() {
+    bool changed = false;
+    for (size_t b = 1; b < graph.blocks.size(); b++) {
+      Block &block = graph.blocks[b];
+      if (block.removed || block.values.size() != 1 ||
+          graph.terminator(b).op != Op::Jmp || block.preds.size() != 1 ||
+          block.succs[0] == static_cast<BlockId>(b)) {
+        continue;
+      }
+      const BlockId pred = block.preds[0], succ = block.succs[0];
+      // The phis in succ tell the two edges of a branch apart by their
+      // blocks, so a branch cannot go to succ twice.
+      const auto &pred_succs = graph.blocks[pred].succs;
+      if (std::find(pred_succs.begin(), pred_succs.end(), succ) !=
+          pred_succs.end()) {
+        continue;
+      }
+      for (auto &next : graph.blocks[pred].succs) {
+        if (next == static_cast<BlockId>(b)) {
+          next = succ;
+        }
+      }
+      for (auto &prev : graph.blocks[succ].preds) {
+        if (prev == static_cast<BlockId>(b)) {
+          prev = pred;
+        }
+      }
+      remove(block.values[0]);
+      block.values.clear();
+      block.preds.clear();
+      block.succs.clear();
+      block.removed = true;
+      changed = true;
+    }
+    return changed;
+  }
+
+private:
+  Graph &graph;
+  std::map<ValueId, ValueId> forward; // replaced value -> replacement
+  std::vector<BlockId> order;         // reverse postorder
+  std::vector<long long> rank;        // position in order, by block
+  std::vector<BlockId> idom;
+};
+} // namespace
+
+void ir::optimize(Graph &graph) { Optimizer(graph).run(); }
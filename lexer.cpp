@@ -1,10 +1,10 @@
+#include <climits>
+
 #include "./lexer.hpp"
 #include "./token.hpp"
 
 using namespace pl0;
 
-std::map<std::string, TokenType> Lexer::keywords;
-
 bool Lexer::try_readc(char c) {
   if (c == peekc()) {
     head++;
@@ -13,16 +13,8 @@ bool Lexer::try_readc(char c) {
   return false;
 }
 
-Lexer::Lexer(const std::string &path) : path(path) {
-  Lexer::init_keywords();
-  std::ifstream ifs(path);
-  if (ifs.fail()) {
-    throw "Can not open " + path;
-  }
-  std::istreambuf_iterator<char> it(ifs);
-  std::istreambuf_iterator<char> last;
-  source_program = std::move(std::string(it, last));
-}
+Lexer::Lexer(const std::string &path)
+    : source(path), text(source.data()), path(path) {}
 
 Token Lexer::nextToken() {
   if (buffer.size() > 0) {
@@ -124,46 +116,32 @@ void Lexer::skip_blank() {
 }
 
 Token Lexer::read_number() {
-  std::string digit;
+  long long value = 0;
   while (isdigit(peekc())) {
-    digit.push_back(readc());
+    int digit = readc() - '0';
+    if (value > (LLONG_MAX - digit) / 10) {
+      throw "integer literal is too large";
+    }
+    value = value * 10 + digit;
   }
-  return std::move(Token(std::stoll(digit)));
+  return std::move(Token(value));
 }
 
 bool is_ident_piece(char c) { return isalnum(c) || c == '_'; }
 
 Token Lexer::read_ident() {
-  std::string ident;
+  size_t start = head;
   while (is_ident_piece(peekc())) {
-    ident.push_back(readc());
+    head++;
   }
+  Symbol ident =
+      Interner::global().intern(StringView(text + start, head - start));
 
-  auto itr = keywords.find(ident);
-  if (itr == keywords.end()) {
-    return std::move(Token(std::move(ident)));
+  if (Interner::is_keyword(ident)) {
+    return std::move(Token(Interner::keyword(ident)));
   } else {
-    return std::move(Token(itr->second));
+    return std::move(Token(ident));
   }
 }
 
 void Lexer::print_head() { std::cout << "head: " << head << std::endl; }
-
-void Lexer::init_keywords() {
-  if (keywords.size() != 0) {
-    return;
-  }
-  keywords["const"] = TokenType::Const;
-  keywords["var"] = TokenType::Var;
-  keywords["function"] = TokenType::Function;
-  keywords["begin"] = TokenType::Begin;
-  keywords["end"] = TokenType::End;
-  keywords["if"] = TokenType::If;
-  keywords["then"] = TokenType::Then;
-  keywords["while"] = TokenType::While;
-  keywords["do"] = TokenType::Do;
-  keywords["return"] = TokenType::Return;
-  keywords["write"] = TokenType::Write;
-  keywords["writeln"] = TokenType::Writeln;
-  keywords["odd"] = TokenType::Odd;
-}
@@ -2,13 +2,15 @@
 
 #include <fstream>
 #include <iostream>
-#include <map>
 #include <string>
 #include <vector>
 
+#include "./interner.hpp"
+#include "./source.hpp"
+
 namespace pl0 {
 class Token;
-enum class TokenType;
+enum class TokenType : uint8_t;
 
 class Lexer {
 public:
@@ -21,19 +23,16 @@ public:
 
 private:
   void skip_blank();
-  char peekc() { return source_program[head]; }
-  char readc() { return source_program[head++]; }
+  char peekc() { return text[head]; }
+  char readc() { return text[head++]; }
   bool try_readc(char c);
 
   Token read_number();
   Token read_ident();
 
 private:
-  static std::map<std::string, TokenType> keywords;
-  static void init_keywords();
-
-private:
-  std::string source_program;
+  SourceFile source;
+  const char *text;
   std::string path;
   size_t head = 0;
   std::vector<Token> buffer;
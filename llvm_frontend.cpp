@@ -1,21 +1,26 @@
-#include "llvm/IR/LegacyPassManager.h"
-#include <llvm/Bitcode/BitcodeWriter.h>
-#include <llvm/IR/IRPrintingPasses.h>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
 #include <llvm/IR/ValueSymbolTable.h>
 #include <llvm/Support/FileSystem.h>
-#include <llvm/Support/raw_ostream.h>
 #include <string>
 
 #include "./llvm_frontend.hpp"
+#include "./llvm_jit.hpp"
+#include "./llvm_pipeline.hpp"
+#include "./parser.hpp"
 
 using namespace pl0;
 
-Frontend::Frontend(const std::string &path)
-    : lexer(path), context(), module(new llvm::Module("top", context)),
-      builder(context) {
-  cur_token = std::move(lexer.nextToken());
-  peek_token = std::move(lexer.nextToken());
+static llvm::StringRef symbolName(Symbol symbol) {
+  StringView name = Interner::global().name(symbol);
+  return llvm::StringRef(name.data(), name.size());
+}
 
+Frontend::Frontend(const std::string &path)
+    : ast(Parser(path, arena).parse()), context(),
+      module(new llvm::Module("top", context)), builder(context),
+      functions(ast.functions.size(), nullptr, arena), slots(arena) {
   {
     std::vector<llvm::Type *> param_types(1, builder.getInt64Ty());
     auto *funcType =
@@ -35,211 +40,92 @@ void Frontend::compile() {
   auto *funcType = llvm::FunctionType::get(builder.getInt64Ty(), false);
   auto *mainFunc = llvm::Function::Create(
       funcType, llvm::Function::ExternalLinkage, "main", module);
-  auto *entry = llvm::BasicBlock::Create(context, "entrypoint", mainFunc);
-  block(mainFunc);
-  builder.CreateRet(builder.getInt64(1));
+  llvm::BasicBlock::Create(context, "entrypoint", mainFunc);
+  functions[0] = mainFunc;
+  block(0, mainFunc);
+  builder.CreateRet(builder.getInt64(0));
 }
 
-void Frontend::block(llvm::Function *func) {
-  ident_table.enterBlock();
-  std::vector<std::string> vars;
-  while (true) {
-    if (cur_token.type == TokenType::Const) {
-      constDecl();
-    } else if (cur_token.type == TokenType::Var) {
-      varDecl(&vars);
-    } else if (cur_token.type == TokenType::Function) {
-      functionDecl();
-    } else {
-      break;
-    }
+void Frontend::block(size_t function, llvm::Function *func) {
+  const ast::Function &info = ast.function(function);
+  for (uint32_t i = 0; i < info.nested.size; i++) {
+    functionDecl(ast.list(info.nested.first)[i]);
   }
 
   curFunc = func;
+  cur_function = function;
   builder.SetInsertPoint(&func->getEntryBlock());
+  slots.clear();
   auto itr = func->arg_begin();
   for (size_t i = 0; i < func->arg_size(); i++) {
     auto *alloca =
         builder.CreateAlloca(builder.getInt64Ty(), 0, itr->getName());
     builder.CreateStore(itr, alloca);
-    ident_table.appendVar(itr->getName(), alloca);
+    slots.push_back(alloca);
     itr++;
   }
-  for (const auto &var : vars) {
-    auto *alloca = builder.CreateAlloca(builder.getInt64Ty(), 0, var);
-    ident_table.appendVar(var, alloca);
+  for (uint32_t i = info.params; i < info.names.size; i++) {
+    auto *alloca = builder.CreateAlloca(
+        builder.getInt64Ty(), 0, symbolName(ast.names[info.names.first + i]));
+    slots.push_back(alloca);
   }
-  statement();
-  ident_table.leaveBlock();
+  statement(info.body);
 }
 
-void Frontend::constDecl() {
-  takeToken(TokenType::Const);
-  while (true) {
-    if (cur_token.type != TokenType::Ident) {
-      parseError(TokenType::Ident, cur_token.type);
-    }
-
-    std::string const_name = cur_token.ident;
-    nextToken();
-    takeToken(TokenType::Equal);
-
-    if (cur_token.type != TokenType::Integer) {
-      parseError(TokenType::Integer, cur_token.type);
-    }
-
-    ident_table.appendConst(const_name, builder.getInt64(cur_token.integer));
-    nextToken();
-
-    if (cur_token.type == TokenType::Colon) {
-      nextToken();
-      // continue;
-    } else if (cur_token.type == TokenType::Semicolon) {
-      nextToken();
-      break;
-    } else {
-      throw "unexpected at constDecl";
-    }
-  }
-}
-
-void Frontend::varDecl(std::vector<std::string> *vars) {
-  takeToken(TokenType::Var);
-  while (true) {
-    if (cur_token.type != TokenType::Ident) {
-      parseError(TokenType::Ident, cur_token.type);
-    }
-
-    vars->push_back(cur_token.ident);
-    nextToken();
-
-    if (cur_token.type == TokenType::Colon) {
-      nextToken();
-      // continue;
-    } else if (cur_token.type == TokenType::Semicolon) {
-      nextToken();
-      break;
-    } else {
-      error("unexpected at varDecl");
-    }
-  }
-}
-void Frontend::functionDecl() {
-  takeToken(TokenType::Function);
-  if (cur_token.type != TokenType::Ident) {
-    parseError(TokenType::Ident, cur_token.type);
-  }
-  std::string func_name = std::move(cur_token.ident);
-  nextToken();
-
-  std::vector<std::string> params;
-  takeToken(TokenType::ParenL);
-  while (true) {
-    if (cur_token.type != TokenType::Ident) {
-      break;
-    }
-
-    params.push_back(cur_token.ident);
-    nextToken();
-    if (cur_token.type == TokenType::Colon) {
-      nextToken();
-      // continue;
-    } else {
-      break;
-    }
-  }
-  takeToken(TokenType::ParenR);
-
-  std::vector<llvm::Type *> param_types(params.size(), builder.getInt64Ty());
+void Frontend::functionDecl(size_t function) {
+  const ast::Function &info = ast.function(function);
+  std::vector<llvm::Type *> param_types(info.params, builder.getInt64Ty());
   auto *funcType =
       llvm::FunctionType::get(builder.getInt64Ty(), param_types, false);
   auto *func = llvm::Function::Create(funcType, llvm::Function::ExternalLinkage,
-                                      func_name, module);
-  auto *bblock = llvm::BasicBlock::Create(context, "entry", func);
-  ident_table.appendFunction(func_name, func);
+                                      symbolName(info.name), module);
+  llvm::BasicBlock::Create(context, "entry", func);
+  functions[function] = func;
 
   auto itr = func->arg_begin();
-  for (size_t i = 0; i < params.size(); i++) {
-    ident_table.appendParam(params[i]);
-    itr->setName(params[i]);
+  for (uint32_t i = 0; i < info.params; i++) {
+    itr->setName(symbolName(ast.names[info.names.first + i]));
     itr++;
   }
 
-  block(func);
-  takeToken(TokenType::Semicolon);
+  block(function, func);
 }
 
-void Frontend::statement() {
-  size_t backpatch_target;
-  size_t start_at;
-  const pl0llvm::IdInfo *info;
-
-  llvm::Value *val;
-  llvm::BasicBlock *stash;
+void Frontend::statement(ast::NodeId id) {
+  const ast::Node &node = ast.node(id);
 
-  switch (cur_token.type) {
-  case TokenType::Ident:
-    statementAssign();
+  switch (node.kind) {
+  case ast::Kind::Assign:
+    builder.CreateStore(expression(node.first), variable(node));
     return;
-  case TokenType::Begin:
-    nextToken();
-    while (true) {
-      statement();
-      if (cur_token.type == TokenType::Semicolon) {
-        takeToken(TokenType::Semicolon);
-        // continue;
-      } else if (cur_token.type == TokenType::End) {
-        takeToken(TokenType::End);
-        break;
-      } else {
-        lexer.print_head();
-        parseError(TokenType::End, cur_token.type);
-      }
+  case ast::Kind::Begin:
+    for (uint32_t i = 0; i < node.size; i++) {
+      statement(ast.list(node.first)[i]);
     }
     return;
-  case TokenType::If:
-    statementIf();
+  case ast::Kind::If:
+    statementIf(node);
     return;
-  case TokenType::While:
-    statementWhile();
+  case ast::Kind::While:
+    statementWhile(node);
     return;
-  case TokenType::Return:
-    nextToken();
-    builder.CreateRet(expression());
+  case ast::Kind::Return:
+    builder.CreateRet(expression(node.first));
     builder.SetInsertPoint(llvm::BasicBlock::Create(context, "dummy"));
     return;
-  case TokenType::Write:
-    nextToken();
-    builder.CreateCall(writeFunc, std::vector<llvm::Value *>(1, expression()));
+  case ast::Kind::Write:
+    builder.CreateCall(writeFunc,
+                       std::vector<llvm::Value *>(1, expression(node.first)));
     break;
-  case TokenType::Writeln:
-    nextToken();
+  case ast::Kind::Writeln:
     builder.CreateCall(writelnFunc);
     break;
   default:;
   }
 }
 
-void Frontend::statementAssign() {
-  const auto &info = ident_table.find(cur_token.ident);
-  llvm::Value *assignee;
-  if (info.type == pl0llvm::IdType::Var) {
-    assignee = info.val;
-  } else {
-    error("variable is expected but it is not variable");
-  }
-  nextToken();
-  takeToken(TokenType::Assign);
-  builder.CreateStore(expression(), assignee);
-  return;
-}
-
-void Frontend::statementIf() {
-  takeToken(TokenType::If);
-
-  auto *cond = condition();
-
-  takeToken(TokenType::Then);
+void Frontend::statementIf(const ast::Node &node) {
+  auto *cond = condition(node.first);
 
   auto *then_block = llvm::BasicBlock::Create(context, "if.then", curFunc);
   auto *merge_block = llvm::BasicBlock::Create(context, "if.merge");
@@ -247,7 +133,7 @@ void Frontend::statementIf() {
   builder.CreateCondBr(cond, then_block, merge_block);
 
   builder.SetInsertPoint(then_block);
-  statement();
+  statement(node.second);
   builder.CreateBr(merge_block);
   then_block = builder.GetInsertBlock();
 
@@ -255,9 +141,7 @@ void Frontend::statementIf() {
   builder.SetInsertPoint(merge_block);
 }
 
-void Frontend::statementWhile() {
-  takeToken(TokenType::While);
-
+void Frontend::statementWhile(const ast::Node &node) {
   auto *cond_block = llvm::BasicBlock::Create(context, "while.cond", curFunc);
   auto *body_block = llvm::BasicBlock::Create(context, "while.body");
   auto *merge_block = llvm::BasicBlock::Create(context, "while.merge");
@@ -266,15 +150,14 @@ void Frontend::statementWhile() {
 
   {
     builder.SetInsertPoint(cond_block);
-    auto *cond = condition();
-    takeToken(TokenType::Do);
+    auto *cond = condition(node.first);
     builder.CreateCondBr(cond, body_block, merge_block);
   }
 
   {
     curFunc->getBasicBlockList().push_back(body_block);
     builder.SetInsertPoint(body_block);
-    statement();
+    statement(node.second);
     builder.CreateBr(cond_block);
   }
 
@@ -301,138 +184,208 @@ llvm::CmpInst::Predicate token_to_inst(TokenType type) {
   }
 }
 
-llvm::Value *Frontend::condition() {
-  if (cur_token.type == TokenType::Odd) {
-    nextToken();
-    auto *lhs = builder.CreateSRem(expression(), builder.getInt64(2));
-    return builder.CreateICmpEQ(lhs, builder.getInt64(0));
+llvm::Value *Frontend::condition(ast::NodeId id) {
+  const ast::Node &node = ast.node(id);
+  if (node.kind == ast::Kind::Unary) {
+    auto *lhs =
+        builder.CreateSRem(expression(node.first), builder.getInt64(2));
+    return builder.CreateICmpNE(lhs, builder.getInt64(0));
   } else {
-    auto *lhs = expression();
-    llvm::CmpInst::Predicate inst = token_to_inst(cur_token.type);
-    nextToken();
-    auto *rhs = expression();
-    return builder.CreateICmp(inst, lhs, rhs);
+    auto *lhs = expression(node.first);
+    auto *rhs = expression(node.second);
+    return builder.CreateICmp(token_to_inst(node.op), lhs, rhs);
   }
 }
 
-llvm::Value *Frontend::expression() {
-  TokenType sign = cur_token.type;
-  if (cur_token.type == TokenType::Plus || cur_token.type == TokenType::Minus) {
-    nextToken();
-  }
+llvm::Value *Frontend::expression(ast::NodeId id) {
+  const ast::Node &node = ast.node(id);
+  llvm::Value *lhs;
+  llvm::Value *rhs;
 
-  llvm::Value *ret = term();
-  if (sign == TokenType::Minus) {
-    ret = builder.CreateNeg(ret);
+  switch (node.kind) {
+  case ast::Kind::Number:
+    return builder.getInt64(node.value);
+  case ast::Kind::Variable:
+    // TODO: ?
+    return builder.CreateLoad(variable(node));
+  case ast::Kind::Call: {
+    std::vector<llvm::Value *> args;
+    for (uint32_t i = 0; i < node.size; i++) {
+      args.push_back(expression(ast.list(node.first)[i]));
+    }
+    return builder.CreateCall(functions[node.ref], args);
   }
-
-  while (true) {
-    if (cur_token.type == TokenType::Plus) {
-      nextToken();
-      ret = builder.CreateAdd(ret, term());
-    } else if (cur_token.type == TokenType::Minus) {
-      nextToken();
-      ret = builder.CreateSub(ret, term());
-    } else {
+  case ast::Kind::Unary:
+    return builder.CreateNeg(expression(node.first));
+  case ast::Kind::Binary:
+    lhs = expression(node.first);
+    rhs = expression(node.second);
+    switch (node.op) {
+    case TokenType::Plus:
+      return builder.CreateAdd(lhs, rhs);
+    case TokenType::Minus:
+      return builder.CreateSub(lhs, rhs);
+    case TokenType::Mul:
+      return builder.CreateMul(lhs, rhs);
+    case TokenType::Div:
+      return builder.CreateSDiv(lhs, rhs);
+    default:
       break;
     }
+  default:
+    break;
+  }
+  error("expect factor but not");
+}
+
+// The alloca of the variable a Variable or Assign node refers to. Only the
+// function's own variables have one.
+llvm::Value *Frontend::variable(const ast::Node &node) {
+  const ast::Function &info = ast.function(cur_function);
+  if (node.ref != info.level) {
+    unsupportedError("variable of an enclosing function");
   }
-  return ret;
+  return slots[info.slot(node.value)];
 }
 
-llvm::Value *Frontend::term() {
-  llvm::Value *ret = factor();
-  while (true) {
-    if (cur_token.type == TokenType::Mul) {
-      nextToken();
-      ret = builder.CreateMul(ret, factor());
-    } else if (cur_token.type == TokenType::Div) {
-      nextToken();
-      ret = builder.CreateSDiv(ret, factor());
+static void usage(const char *name) {
+  std::cerr << "usage: " << name
+            << " [--run] [-O0|-O1|-O2|-O3] [-j N] [-c] [--emit=ll|bc|obj|exe]"
+               " [-o FILE] [--runtime=FILE] [--runtime-lib=FILE] FILE"
+            << std::endl;
+  exit(1);
+}
+
+enum class Emit { None, IR, Bitcode, Object, Executable };
+
+static int compileMain(int argc, char **argv) {
+  bool run = false;
+  unsigned opt_level = 1;
+  unsigned jobs = 1;
+  Emit emit = Emit::None;
+  std::string output;
+  std::string runtime = PL0_RUNTIME_IR;
+  std::string runtime_lib = PL0_RUNTIME_LIB;
+  const char *path = nullptr;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--run") {
+      run = true;
+    } else if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 &&
+               arg[2] >= '0' && arg[2] <= '3') {
+      opt_level = arg[2] - '0';
+    } else if (arg == "-j" && i + 1 < argc) {
+      jobs = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--emit=ll") {
+      emit = Emit::IR;
+    } else if (arg == "--emit=bc") {
+      emit = Emit::Bitcode;
+    } else if (arg == "-c" || arg == "--emit=obj") {
+      emit = Emit::Object;
+    } else if (arg == "--emit=exe") {
+      emit = Emit::Executable;
+    } else if (arg == "-o" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (arg.compare(0, 10, "--runtime=") == 0) {
+      runtime = arg.substr(10);
+    } else if (arg.compare(0, 14, "--runtime-lib=") == 0) {
+      runtime_lib = arg.substr(14);
+    } else if (arg[0] == '-' || path != nullptr) {
+      usage(argv[0]);
     } else {
-      break;
+      path = argv[i];
     }
   }
-  return ret;
-}
+  if (path == nullptr) {
+    usage(argv[0]);
+  }
+  // Like cc: -o alone builds an executable, nothing at all writes out.ll.
+  if (emit == Emit::None) {
+    emit = output.empty() ? Emit::IR : Emit::Executable;
+  }
 
-llvm::Value *Frontend::factor() {
-  llvm::Value *ret;
-  if (cur_token.type == TokenType::Ident) {
-    ret = factorIdent();
-  } else if (cur_token.type == TokenType::Integer) {
-    ret = builder.getInt64(cur_token.integer);
-    nextToken();
-  } else if (cur_token.type == TokenType::ParenL) {
-    nextToken();
-    ret = expression();
-    takeToken(TokenType::ParenR);
-  } else {
-    lexer.print_head();
-    error("expect factor but not");
+  pl0::Frontend frontend(path);
+  frontend.compile();
+  llvm::Module &module = *frontend.getModule();
+
+  if (run) {
+    // write and writeln come from the copy of write.c in this process.
+    pl0::optimizeModule(module, opt_level);
+    pl0::JIT jit;
+    jit.addModule(frontend.takeModule());
+    void *address = jit.getSymbolAddress("main");
+    if (address == nullptr) {
+      error("cannot find main");
+    }
+    reinterpret_cast<uint64_t (*)()>(address)();
+    return 0;
   }
-  return ret;
-}
 
-llvm::Value *Frontend::factorIdent() {
-  auto &val = ident_table.find(cur_token.ident);
-  takeToken(TokenType::Ident);
+  switch (emit) {
+  case Emit::None:
+  case Emit::IR:
+  case Emit::Bitcode: {
+    // Linking before optimizing lets write and writeln be inlined.
+    bool bitcode = emit == Emit::Bitcode;
+    pl0::linkRuntime(module, runtime);
+    std::unique_ptr<llvm::Module> optimized;
+    if (jobs > 1) {
+      optimized =
+          pl0::optimizeParallel(frontend.takeModule(), opt_level, jobs);
+    } else {
+      pl0::optimizeModule(module, opt_level);
+    }
+    if (output.empty()) {
+      output = bitcode ? "out.bc" : "out.ll";
+    }
+    pl0::writeModule(optimized ? *optimized : module, output, bitcode);
+    break;
+  }
+  case Emit::Object:
+  case Emit::Executable: {
+    // The runtime archive is write.c built with renamed functions, so that
+    // an executable does not replace write(2) for the C library.
+    module.getFunction("write")->setName("pl0_runtime_write");
+    module.getFunction("writeln")->setName("pl0_runtime_writeln");
+    if (output.empty()) {
+      output = "out.o";
+    }
 
-  switch (val.type) {
-  case pl0llvm::IdType::Const:
-    return val.val;
-  case pl0llvm::IdType::Var:
-    // TODO: ?
-    return builder.CreateLoad(val.val);
-  case pl0llvm::IdType::Param:
-    error("Param ident can not be factor");
-  case pl0llvm::IdType::Function:
-    takeToken(TokenType::ParenL);
-    std::vector<llvm::Value *> args;
-    while (cur_token.type != TokenType::ParenR) {
-      args.push_back(expression());
-      if (cur_token.type == TokenType::Colon) {
-        nextToken();
-        // continue;
-      } else {
+    pl0::TemporaryObjects objects;
+    if (jobs > 1) {
+      objects =
+          pl0::emitObjectsParallel(frontend.takeModule(), opt_level, jobs);
+    } else {
+      pl0::optimizeModule(module, opt_level);
+      if (emit == Emit::Object) {
+        pl0::emitObject(module, output, opt_level);
         break;
       }
+      pl0::emitObject(module, objects.create(), opt_level);
     }
-    takeToken(TokenType::ParenR);
-    if (args.size() != val.func->arg_size()) {
-      error("argument number is wrong");
+
+    if (emit == Emit::Object) {
+      pl0::linkRelocatable(objects.list(), output);
+    } else {
+      pl0::linkExecutable(objects.list(), runtime_lib, output);
     }
-    return builder.CreateCall(val.func, args);
+    break;
   }
+  }
+
+  return 0;
 }
 
 int main(int argc, char **argv) {
-  if (argc != 2) {
-    std::cerr << "usage " << argv[0] << " FILE" << std::endl;
-    return 1;
+  try {
+    return compileMain(argc, argv);
+  } catch (const pl0::Error &e) {
+    std::cerr << e.what() << std::endl;
+  } catch (const char *msg) {
+    // From the parser and the lexer.
+    std::cerr << "error: " << msg << std::endl;
+  } catch (const std::string &msg) {
+    std::cerr << "error: " << msg << std::endl;
   }
-
-  // std::fstream ifs(argv[1]);
-  // if (ifs.fail()) {
-  //   std::cerr << "cannot read " << argv[1] << std::endl;
-  //   return 1;
-  // }
-
-  // std::string code = std::string(std::istreambuf_iterator<char>(ifs),
-  // std::istreambuf_iterator<char>());
-
-  pl0::Frontend frontend(argv[1]);
-  frontend.compile();
-
-  llvm::legacy::PassManager pm;
-
-  // generate bitcode
-  std::error_code error_info;
-  llvm::raw_fd_ostream raw_stream("out.ll", error_info,
-                                  llvm::sys::fs::OpenFlags::F_None);
-  pm.add(llvm::createPrintModulePass(raw_stream));
-  pm.run(*frontend.getModule());
-  raw_stream.close();
-
-  return 0;
+  return 1;
 }
@@ -4,10 +4,9 @@
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 
+#include "./arena.hpp"
+#include "./ast.hpp"
 #include "./error.hpp"
-#include "./lexer.hpp"
-#include "./llvm_table.hpp"
-#include "./token.hpp"
 
 namespace pl0 {
 class Frontend {
@@ -17,50 +16,39 @@ public:
 
   void compile();
   llvm::Module *getModule() { return module; }
+  std::unique_ptr<llvm::Module> takeModule() {
+    std::unique_ptr<llvm::Module> owned(module);
+    module = nullptr;
+    return owned;
+  }
 
 public:
-  void block(llvm::Function *func);
+  void block(size_t function, llvm::Function *func);
+  void functionDecl(size_t function);
 
-  void constDecl();
-  void varDecl(std::vector<std::string> *vars);
-  void functionDecl();
-  void statement();
-  void statementAssign();
-  void statementIf();
-  void statementWhile();
+  void statement(ast::NodeId id);
+  void statementIf(const ast::Node &node);
+  void statementWhile(const ast::Node &node);
 
-  llvm::Value *condition();
-  llvm::Value *expression();
-  llvm::Value *term();
-  llvm::Value *factor();
-  llvm::Value *factorIdent();
+  llvm::Value *condition(ast::NodeId id);
+  llvm::Value *expression(ast::NodeId id);
+  llvm::Value *variable(const ast::Node &node);
 
 private:
-  void nextToken() {
-    cur_token = std::move(peek_token);
-    peek_token = std::move(lexer.nextToken());
-  }
-
-  void takeToken(TokenType type) {
-    if (cur_token.type != type) {
-      parseError(type, cur_token.type);
-    }
-    nextToken();
-  }
+  Arena arena;
+  ast::Ast ast;
 
-private:
   llvm::LLVMContext context;
   llvm::Module *module;
   llvm::IRBuilder<> builder;
 
+  size_t cur_function;
   llvm::Function *curFunc;
   llvm::Function *writeFunc;
   llvm::Function *writelnFunc;
 
-  Lexer lexer;
-
-  Token cur_token;
-  Token peek_token;
-  pl0llvm::Table ident_table;
+  ArenaVector<llvm::Function *> functions; // by function of ast
+  // Allocas of the parameters and locals of curFunc, by Function::slot.
+  ArenaVector<llvm::Value *> slots;
 };
 } // namespace pl0
@@ -0,0 +1,85 @@
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/Orc/LambdaResolver.h>
+#include <llvm/ExecutionEngine/RTDyldMemoryManager.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/IR/Mangler.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <stdint.h>
+
+#include "./llvm_jit.hpp"
+
+using namespace pl0;
+
+// write.c, built with its functions renamed so they do not clash with
+// write(2) in the host process.
+extern "C" uint64_t pl0_runtime_write(uint64_t n);
+extern "C" uint64_t pl0_runtime_writeln();
+
+static llvm::TargetMachine *createHostTargetMachine() {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  llvm::InitializeNativeTargetAsmParser();
+  return llvm::EngineBuilder().selectTarget();
+}
+
+JIT::JIT()
+    : target_machine(createHostTargetMachine()),
+      data_layout(target_machine->createDataLayout()),
+      object_layer(
+          []() { return std::make_shared<llvm::SectionMemoryManager>(); }),
+      compile_layer(object_layer, llvm::orc::SimpleCompiler(*target_machine)) {
+  llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+
+  runtime[mangle("write")] = static_cast<llvm::JITTargetAddress>(
+      reinterpret_cast<uintptr_t>(&pl0_runtime_write));
+  runtime[mangle("writeln")] = static_cast<llvm::JITTargetAddress>(
+      reinterpret_cast<uintptr_t>(&pl0_runtime_writeln));
+}
+
+void JIT::addModule(std::unique_ptr<llvm::Module> module) {
+  module->setDataLayout(data_layout);
+  module->setTargetTriple(target_machine->getTargetTriple().str());
+
+  // Symbols are looked up in the JIT first, then in the runtime, and only
+  // then anywhere else in the process.
+  auto resolver = llvm::orc::createLambdaResolver(
+      [this](const std::string &name) {
+        if (auto sym = compile_layer.findSymbol(name, false)) {
+          return sym;
+        }
+        return llvm::JITSymbol(nullptr);
+      },
+      [this](const std::string &name) { return findHostSymbol(name); });
+
+  llvm::cantFail(
+      compile_layer.addModule(std::move(module), std::move(resolver)));
+}
+
+void *JIT::getSymbolAddress(const std::string &name) {
+  auto sym = compile_layer.findSymbol(mangle(name), true);
+  if (!sym) {
+    return nullptr;
+  }
+  return reinterpret_cast<void *>(llvm::cantFail(sym.getAddress()));
+}
+
+std::string JIT::mangle(const std::string &name) const {
+  std::string mangled;
+  llvm::raw_string_ostream stream(mangled);
+  llvm::Mangler::getNameWithPrefix(stream, name, data_layout);
+  return stream.str();
+}
+
+llvm::JITSymbol JIT::findHostSymbol(const std::string &name) const {
+  auto itr = runtime.find(name);
+  if (itr != runtime.end()) {
+    return llvm::JITSymbol(itr->second, llvm::JITSymbolFlags::Exported);
+  }
+  if (auto addr =
+          llvm::RTDyldMemoryManager::getSymbolAddressInProcess(name)) {
+    return llvm::JITSymbol(addr, llvm::JITSymbolFlags::Exported);
+  }
+  return llvm::JITSymbol(nullptr);
+}
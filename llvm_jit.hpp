@@ -0,0 +1,39 @@
+#pragma once
+
+#include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace pl0 {
+// In-process ORC JIT for modules built by Frontend. The write and writeln
+// runtime functions resolve to the copy of write.c linked into llvmpl0, so
+// a program runs without llvm-link, opt or lli.
+class JIT {
+public:
+  JIT();
+
+  void addModule(std::unique_ptr<llvm::Module> module);
+  void *getSymbolAddress(const std::string &name);
+
+private:
+  std::string mangle(const std::string &name) const;
+  llvm::JITSymbol findHostSymbol(const std::string &name) const;
+
+private:
+  std::unique_ptr<llvm::TargetMachine> target_machine;
+  const llvm::DataLayout data_layout;
+  llvm::orc::RTDyldObjectLinkingLayer object_layer;
+  llvm::orc::IRCompileLayer<decltype(object_layer), llvm::orc::SimpleCompiler>
+      compile_layer;
+
+  // mangled name -> address of the host runtime function
+  std::map<std::string, llvm::JITTargetAddress> runtime;
+};
+} // namespace pl0
@@ -0,0 +1,313 @@
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/TargetRegistry.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <llvm/ADT/SmallString.h>
+#include <memory>
+#include <mutex>
+
+#include "./error.hpp"
+#include "./llvm_pipeline.hpp"
+
+void pl0::linkRuntime(llvm::Module &module, const std::string &path) {
+  llvm::SMDiagnostic diag;
+  auto runtime = llvm::parseIRFile(path, diag, module.getContext());
+  if (!runtime) {
+    error("cannot read runtime " + path + ": " + diag.getMessage().str());
+  }
+
+  module.setTargetTriple(runtime->getTargetTriple());
+  module.setDataLayout(runtime->getDataLayout());
+  if (llvm::Linker::linkModules(module, std::move(runtime))) {
+    error("cannot link runtime " + path);
+  }
+}
+
+static llvm::PassBuilder::OptimizationLevel toPassBuilderLevel(unsigned level) {
+  switch (level) {
+  case 1:
+    return llvm::PassBuilder::O1;
+  case 2:
+    return llvm::PassBuilder::O2;
+  default:
+    return llvm::PassBuilder::O3;
+  }
+}
+
+void pl0::optimizeModule(llvm::Module &module, unsigned level) {
+  if (llvm::verifyModule(module, &llvm::errs())) {
+    error("broken module");
+  }
+  if (level == 0) {
+    return;
+  }
+
+  llvm::PassBuilder builder;
+  llvm::LoopAnalysisManager lam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::CGSCCAnalysisManager cgam;
+  llvm::ModuleAnalysisManager mam;
+  builder.registerModuleAnalyses(mam);
+  builder.registerCGSCCAnalyses(cgam);
+  builder.registerFunctionAnalyses(fam);
+  builder.registerLoopAnalyses(lam);
+  builder.crossRegisterProxies(lam, fam, cgam, mam);
+
+  auto mpm = builder.buildPerModuleDefaultPipeline(toPassBuilderLevel(level));
+  mpm.run(module, mam);
+}
+
+void pl0::writeModule(const llvm::Module &module, const std::string &path,
+                      bool bitcode) {
+  std::error_code error_info;
+  llvm::raw_fd_ostream stream(path, error_info,
+                              bitcode ? llvm::sys::fs::F_None
+                                      : llvm::sys::fs::F_Text);
+  if (error_info) {
+    error("cannot open " + path + ": " + error_info.message());
+  }
+
+  if (bitcode) {
+    llvm::WriteBitcodeToFile(&module, stream);
+  } else {
+    module.print(stream, nullptr);
+  }
+}
+
+static llvm::CodeGenOpt::Level toCodeGenLevel(unsigned level) {
+  switch (level) {
+  case 0:
+    return llvm::CodeGenOpt::None;
+  case 1:
+    return llvm::CodeGenOpt::Less;
+  case 2:
+    return llvm::CodeGenOpt::Default;
+  default:
+    return llvm::CodeGenOpt::Aggressive;
+  }
+}
+
+static std::unique_ptr<llvm::TargetMachine>
+createHostTargetMachine(unsigned level) {
+  // Target registration is not thread safe, and codegen may run on a pool.
+  static std::once_flag initialized;
+  std::call_once(initialized, [] {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+  });
+
+  std::string triple = llvm::sys::getDefaultTargetTriple();
+  std::string message;
+  auto *target = llvm::TargetRegistry::lookupTarget(triple, message);
+  if (target == nullptr) {
+    error(message);
+  }
+
+  llvm::StringMap<bool> host_features;
+  std::string features;
+  if (llvm::sys::getHostCPUFeatures(host_features)) {
+    for (auto &feature : host_features) {
+      features += (feature.second ? "+" : "-") + feature.first().str() + ",";
+    }
+  }
+
+  // PIC, since the system compiler may link a position-independent
+  // executable.
+  return std::unique_ptr<llvm::TargetMachine>(target->createTargetMachine(
+      triple, llvm::sys::getHostCPUName(), features, llvm::TargetOptions(),
+      llvm::Reloc::PIC_, llvm::None, toCodeGenLevel(level)));
+}
+
+void pl0::emitObject(llvm::Module &module, const std::string &path,
+                     unsigned level) {
+  auto machine = createHostTargetMachine(level);
+  module.setTargetTriple(machine->getTargetTriple().str());
+  module.setDataLayout(machine->createDataLayout());
+
+  std::error_code error_info;
+  llvm::raw_fd_ostream stream(path, error_info, llvm::sys::fs::F_None);
+  if (error_info) {
+    error("cannot open " + path + ": " + error_info.message());
+  }
+
+  // Code generation is still only available through the legacy pass manager.
+  llvm::legacy::PassManager codegen;
+  if (machine->addPassesToEmitFile(codegen, stream,
+                                   llvm::TargetMachine::CGFT_ObjectFile)) {
+    error("cannot emit an object file for " +
+          machine->getTargetTriple().str());
+  }
+  codegen.run(module);
+}
+
+using Bitcode = llvm::SmallVector<char, 0>;
+
+static void writeBitcode(const llvm::Module &module, Bitcode &buffer) {
+  llvm::raw_svector_ostream stream(buffer);
+  llvm::WriteBitcodeToFile(&module, stream);
+}
+
+static std::unique_ptr<llvm::Module> readBitcode(const Bitcode &buffer,
+                                                 llvm::LLVMContext &context) {
+  llvm::MemoryBufferRef ref(llvm::StringRef(buffer.data(), buffer.size()),
+                            "partition");
+  auto module = llvm::parseBitcodeFile(ref, context);
+  if (!module) {
+    error("cannot read partition: " + llvm::toString(module.takeError()));
+  }
+  return std::move(*module);
+}
+
+// Splits module into up to jobs partitions and calls work(part, index) for
+// each one on a thread pool. Partitions cross threads as bitcode, and every
+// task parses its partition into a context of its own, because an
+// LLVMContext must not be used by two threads at once.
+static void
+forEachPartition(std::unique_ptr<llvm::Module> module, unsigned jobs,
+                 const std::function<void(llvm::Module &, size_t)> &work) {
+  std::vector<Bitcode> parts;
+  llvm::SplitModule(std::move(module), jobs,
+                    [&](std::unique_ptr<llvm::Module> part) {
+                      parts.emplace_back();
+                      writeBitcode(*part, parts.back());
+                    });
+
+  llvm::ThreadPool pool(jobs);
+  std::vector<std::shared_future<void>> tasks;
+  for (size_t i = 0; i < parts.size(); i++) {
+    tasks.push_back(pool.async([&, i] {
+      llvm::LLVMContext context;
+      auto part = readBitcode(parts[i], context);
+      work(*part, i);
+    }));
+  }
+  pool.wait();
+  // Rethrows the first pl0::Error a task ran into.
+  for (auto &task : tasks) {
+    task.get();
+  }
+}
+
+std::unique_ptr<llvm::Module>
+pl0::optimizeParallel(std::unique_ptr<llvm::Module> module, unsigned level,
+                      unsigned jobs) {
+  llvm::LLVMContext &context = module->getContext();
+  auto linked = llvm::make_unique<llvm::Module>(module->getModuleIdentifier(),
+                                                context);
+  linked->setTargetTriple(module->getTargetTriple());
+  linked->setDataLayout(module->getDataLayout());
+
+  std::vector<Bitcode> optimized(jobs);
+  forEachPartition(std::move(module), jobs,
+                   [&](llvm::Module &part, size_t index) {
+                     optimizeModule(part, level);
+                     writeBitcode(part, optimized[index]);
+                   });
+
+  for (const auto &part : optimized) {
+    if (!part.empty() &&
+        llvm::Linker::linkModules(*linked, readBitcode(part, context))) {
+      error("cannot link optimized partitions");
+    }
+  }
+  return linked;
+}
+
+pl0::TemporaryObjects
+pl0::emitObjectsParallel(std::unique_ptr<llvm::Module> module, unsigned level,
+                         unsigned jobs) {
+  TemporaryObjects objects(jobs);
+  forEachPartition(std::move(module), jobs,
+                   [&](llvm::Module &part, size_t index) {
+                     optimizeModule(part, level);
+                     emitObject(part, objects.create(index), level);
+                   });
+
+  objects.compact();
+  return objects;
+}
+
+// A fresh temporary path for an object file.
+static std::string temporaryObject() {
+  llvm::SmallString<128> path;
+  if (llvm::sys::fs::createTemporaryFile("pl0", "o", path)) {
+    error("cannot create a temporary object file");
+  }
+  return path.str().str();
+}
+
+pl0::TemporaryObjects::~TemporaryObjects() {
+  for (const auto &path : paths) {
+    if (!path.empty()) {
+      llvm::sys::fs::remove(path);
+    }
+  }
+}
+
+const std::string &pl0::TemporaryObjects::create() {
+  paths.push_back(temporaryObject());
+  return paths.back();
+}
+
+const std::string &pl0::TemporaryObjects::create(size_t index) {
+  paths[index] = temporaryObject();
+  return paths[index];
+}
+
+void pl0::TemporaryObjects::compact() {
+  paths.erase(std::remove(paths.begin(), paths.end(), ""), paths.end());
+}
+
+static void runLinker(const std::vector<const char *> &args,
+                      const std::string &path) {
+  auto cc = llvm::sys::findProgramByName("cc");
+  if (!cc) {
+    error("cannot find cc to link " + path);
+  }
+
+  std::vector<const char *> argv = {cc->c_str()};
+  argv.insert(argv.end(), args.begin(), args.end());
+  argv.push_back(nullptr);
+  std::string message;
+  if (llvm::sys::ExecuteAndWait(*cc, argv.data(), nullptr, {}, 0, 0,
+                                &message) != 0) {
+    error("link failed: " + (message.empty() ? *cc : message));
+  }
+}
+
+void pl0::linkExecutable(const std::vector<std::string> &objects,
+                         const std::string &runtime, const std::string &path) {
+  std::vector<const char *> args;
+  for (const auto &object : objects) {
+    args.push_back(object.c_str());
+  }
+  args.insert(args.end(), {runtime.c_str(), "-o", path.c_str()});
+  runLinker(args, path);
+}
+
+void pl0::linkRelocatable(const std::vector<std::string> &objects,
+                          const std::string &path) {
+  std::vector<const char *> args = {"-r", "-nostdlib"};
+  for (const auto &object : objects) {
+    args.push_back(object.c_str());
+  }
+  args.insert(args.end(), {"-o", path.c_str()});
+  runLinker(args, path);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <llvm/IR/Module.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pl0 {
+// Links the runtime IR (write.ll) at path into module. The module also takes
+// the runtime's target triple and data layout.
+void linkRuntime(llvm::Module &module, const std::string &path);
+
+// Runs the new pass manager's default pipeline for -O<level>. Level 0 leaves
+// the module untouched.
+void optimizeModule(llvm::Module &module, unsigned level);
+
+// Writes module as textual IR, or as bitcode when bitcode is set.
+void writeModule(const llvm::Module &module, const std::string &path,
+                 bool bitcode);
+
+// Compiles module to a native object file for the host.
+void emitObject(llvm::Module &module, const std::string &path,
+                unsigned level);
+
+// Temporary object files, removed when this goes away, whether linking them
+// worked or not.
+class TemporaryObjects {
+public:
+  TemporaryObjects() {}
+  // Slots that threads can create objects in at once, one each.
+  explicit TemporaryObjects(size_t slots) : paths(slots) {}
+  TemporaryObjects(TemporaryObjects &&other) { paths.swap(other.paths); }
+  TemporaryObjects &operator=(TemporaryObjects &&other) {
+    paths.swap(other.paths);
+    return *this;
+  }
+  ~TemporaryObjects();
+
+  // Creates a fresh temporary object file, in a new slot or in slot index,
+  // and returns its path.
+  const std::string &create();
+  const std::string &create(size_t index);
+  // Drops the slots no object was created in.
+  void compact();
+
+  const std::vector<std::string> &list() const { return paths; }
+
+private:
+  std::vector<std::string> paths; // empty for an unused slot
+};
+
+// Parallel variants for -j. The module is split into up to jobs partitions
+// with SplitModule, and each partition is optimized (and compiled) on a
+// thread pool in an LLVMContext of its own. Inlining cannot cross partition
+// boundaries.
+//
+// optimizeParallel links the optimized partitions back into one module in
+// the original module's context.
+std::unique_ptr<llvm::Module>
+optimizeParallel(std::unique_ptr<llvm::Module> module, unsigned level,
+                 unsigned jobs);
+// emitObjectsParallel returns one temporary object file per partition.
+TemporaryObjects emitObjectsParallel(std::unique_ptr<llvm::Module> module,
+                                     unsigned level, unsigned jobs);
+
+// Links objects with the prebuilt runtime archive into an executable, using
+// the system C compiler driver.
+void linkExecutable(const std::vector<std::string> &objects,
+                    const std::string &runtime, const std::string &path);
+// Combines objects into one relocatable object.
+void linkRelocatable(const std::vector<std::string> &objects,
+                     const std::string &path);
+} // namespace pl0
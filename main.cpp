@@ -1,23 +1,453 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
 
+#include "./batch.hpp"
+#include "./bytecode_file.hpp"
 #include "./compiler.hpp"
+#include "./native_jit.hpp"
+#include "./output.hpp"
+#include "./inliner.hpp"
+#include "./ir.hpp"
+#include "./peephole.hpp"
+#include "./profiler.hpp"
+#include "./tiered.hpp"
 #include "./token.hpp"
 #include "./vm.hpp"
 
+static void usage(const char *name) {
+  std::cerr << "usage: " << name
+            << " [-O|-O2] [--inline-budget=N] [--inline-report] [--dump]"
+               " [--dump-ir] [--jit]"
+               " [--tiered] [--tier-threshold=N] [--tier-report]"
+               " [--dispatch=switch|threaded] [--buffer=line|full]"
+               " [--flush-interval=MS] [--no-cache] [--profile]"
+               " [--profile-json=FILE] [--profile-calls]"
+               " [--profile-folded=FILE] [-o FILE.plzc] FILE\n"
+            << "       " << name
+            << " --batch [-j N] [-O|-O2] [--inline-budget=N]"
+               " [--dispatch=switch|threaded] FILE..."
+            << std::endl;
+  exit(1);
+}
+
+// Parses str as a whole decimal number that fits in max.
+static bool parse_number(const char *str, unsigned long max,
+                         unsigned long &value) {
+  if (*str < '0' || *str > '9') {
+    return false;
+  }
+  char *end;
+  errno = 0;
+  value = std::strtoul(str, &end, 10);
+  return *end == '\0' && errno == 0 && value <= max;
+}
+
+static bool ends_with(const std::string &str, const std::string &suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Hash of the file contents, or 0 if it cannot be read.
+static uint64_t hash_file(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  std::string contents;
+  char buf[64 * 1024];
+  ssize_t size;
+  while ((size = read(fd, buf, sizeof(buf))) != 0) {
+    if (size < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      close(fd);
+      return 0;
+    }
+    contents.append(buf, size);
+  }
+  close(fd);
+  return pl0::hash_bytes(contents.data(), contents.size());
+}
+
+// $PL0_CACHE_DIR, else $XDG_CACHE_HOME/pl0, else ~/.cache/pl0. Created on
+// demand; empty if there is no usable location.
+static std::string cache_dir() {
+  if (const char *dir = getenv("PL0_CACHE_DIR")) {
+    mkdir(dir, 0755);
+    return dir;
+  }
+  std::string parent;
+  if (const char *xdg = getenv("XDG_CACHE_HOME")) {
+    parent = xdg;
+  } else if (const char *home = getenv("HOME")) {
+    parent = std::string(home) + "/.cache";
+    mkdir(parent.c_str(), 0755);
+  } else {
+    return "";
+  }
+  std::string dir = parent + "/pl0";
+  mkdir(dir.c_str(), 0755);
+  return dir;
+}
+
+static std::string cache_path(uint64_t source_hash, uint32_t flags) {
+  std::string dir = cache_dir();
+  if (dir.empty()) {
+    return "";
+  }
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx-%x.plzc",
+           static_cast<unsigned long long>(source_hash), flags);
+  return dir + "/" + name;
+}
+
+// Maps path if it is a valid .plzc file for this source and these flags,
+// written by this very build of pl0.
+static std::unique_ptr<pl0::MappedBytecode>
+load_cached(const std::string &path, uint64_t source_hash, uint32_t flags) {
+  try {
+    std::unique_ptr<pl0::MappedBytecode> mapped(new pl0::MappedBytecode(path));
+    if (mapped->header().source_hash == source_hash &&
+        mapped->header().flags == flags &&
+        mapped->header().compiler == pl0::compiler_id()) {
+      return mapped;
+    }
+  } catch (const char *) {
+    // Missing, stale or damaged: compile again and replace it.
+  }
+  return nullptr;
+}
+
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
+  const char *path = nullptr;
+  const char *output_path = nullptr;
+  pl0::Dispatch dispatch = pl0::VM::default_dispatch();
+  bool optimize = false;
+  bool middle_end = false;
+  size_t inline_budget = pl0::default_inline_budget;
+  bool inline_report = false;
+  bool dump = false;
+  bool dump_ir = false;
+  bool jit = false;
+  bool tiered = false;
+  unsigned tier_threshold = pl0::TieredCompiler::default_threshold;
+  bool tier_report = false;
+  bool profile = false;
+  const char *profile_json = nullptr;
+  bool profile_calls = false;
+  const char *profile_folded = nullptr;
+  bool use_cache = true;
+  pl0::Buffering buffering = pl0::Output::default_buffering(STDOUT_FILENO);
+  long flush_interval = 0;
+  bool batch = false;
+  unsigned threads = 0;
+  std::vector<std::string> batch_paths;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-O") {
+      optimize = true;
+    } else if (arg == "-O2") {
+      optimize = middle_end = true;
+    } else if (arg.compare(0, 16, "--inline-budget=") == 0) {
+      unsigned long budget;
+      if (!parse_number(argv[i] + 16, SIZE_MAX, budget)) {
+        usage(argv[0]);
+      }
+      inline_budget = budget;
+    } else if (arg == "--inline-report") {
+      inline_report = true;
+    } else if (arg == "--dump") {
+      dump = true;
+    } else if (arg == "--dump-ir") {
+      optimize = middle_end = dump_ir = true;
+    } else if (arg == "--jit") {
+      if (!pl0::NativeJIT::supported()) {
+        std::cerr << "error: the JIT is not supported on this platform"
+                  << std::endl;
+        exit(1);
+      }
+      jit = true;
+    } else if (arg == "--tiered") {
+      tiered = true;
+    } else if (arg.compare(0, 17, "--tier-threshold=") == 0) {
+      tier_threshold = std::max(1, std::atoi(argv[i] + 17));
+    } else if (arg == "--tier-report") {
+      tier_report = true;
+    } else if (arg == "--profile") {
+      profile = true;
+    } else if (arg.compare(0, 15, "--profile-json=") == 0) {
+      profile_json = argv[i] + 15;
+    } else if (arg == "--profile-calls") {
+      profile_calls = true;
+    } else if (arg.compare(0, 17, "--profile-folded=") == 0) {
+      profile_folded = argv[i] + 17;
+    } else if (arg == "--no-cache") {
+      use_cache = false;
+    } else if (arg == "-o" && i + 1 < argc) {
+      output_path = argv[++i];
+    } else if (arg == "--buffer=line") {
+      buffering = pl0::Buffering::Line;
+    } else if (arg == "--buffer=full") {
+      buffering = pl0::Buffering::Full;
+    } else if (arg.compare(0, 17, "--flush-interval=") == 0) {
+      unsigned long interval;
+      if (!parse_number(argv[i] + 17, LONG_MAX, interval)) {
+        usage(argv[0]);
+      }
+      flush_interval = interval;
+    } else if (arg == "--dispatch=switch") {
+      dispatch = pl0::Dispatch::Switch;
+    } else if (arg == "--dispatch=threaded") {
+      if (!pl0::VM::has_threaded_dispatch()) {
+        std::cerr << "error: threaded dispatch is not supported by this build"
+                  << std::endl;
+        exit(1);
+      }
+      dispatch = pl0::Dispatch::Threaded;
+    } else if (arg == "--batch") {
+      batch = true;
+    } else if (arg == "-j" && i + 1 < argc) {
+      threads = std::max(1, std::atoi(argv[++i]));
+    } else if (arg[0] != '-' && batch) {
+      batch_paths.push_back(arg);
+    } else if (arg[0] == '-' || path != nullptr) {
+      usage(argv[0]);
+    } else {
+      path = argv[i];
+    }
+  }
+
+  if (batch) {
+    if (path != nullptr) {
+      batch_paths.insert(batch_paths.begin(), path);
+    }
+    if (dump || dump_ir || jit || tiered || output_path != nullptr || profile ||
+        profile_json != nullptr || profile_calls || profile_folded != nullptr) {
+      usage(argv[0]);
+    }
+    pl0::BatchOptions options;
+    options.optimize = optimize;
+    options.middle_end = middle_end;
+    options.inline_budget = inline_budget;
+    options.dispatch = dispatch;
+    options.threads = threads;
+    // Outputs appear in argument order, each under a header line; errors go
+    // to stderr and only fail their own job.
+    size_t failed = pl0::run_batch(
+        batch_paths, options, [](const pl0::BatchResult &result) {
+          std::cout << "==> " << result.path << " <==\n" << result.output;
+          std::cout.flush();
+          if (!result.ok()) {
+            std::cerr << "error: " << result.path << ": " << result.error
+                      << std::endl;
+          }
+        });
+    return failed == 0 ? 0 : 1;
+  }
+
+  if (path == nullptr) {
     std::cerr << "error: no input file" << std::endl;
     exit(1);
   }
 
-  // pl0::Lexer lexer(argv[1]);
-  // lexer.print_all();
-  pl0::Compiler compiler(argv[1]);
-  auto program = compiler.compile();
-  // pl0::print_program(program);
+  // Code to run: either mapped from a .plzc file (given, or found in the
+  // cache) or compiled from source into decoded.
+  std::unique_ptr<pl0::MappedBytecode> mapped;
+  pl0::Bytecode decoded;
+  pl0::FunctionTable functions;
+  pl0::CodeView code(decoded);
 
-  pl0::VM vm(program);
-  vm.eval();
+  if (ends_with(path, ".plzc")) {
+    try {
+      mapped.reset(new pl0::MappedBytecode(path));
+    } catch (const char *msg) {
+      std::cerr << "error: " << path << ": " << msg << std::endl;
+      exit(1);
+    }
+    code = mapped->code();
+  } else {
+    uint32_t flags = 0;
+    if (optimize) {
+      flags |= pl0::BytecodeFlags::Optimized;
+    }
+    if (middle_end) {
+      flags |= pl0::BytecodeFlags::MiddleEnd;
+    }
+    const uint64_t source_hash = hash_file(path);
+    std::string cached;
+    // The cache only holds code built with the default inlining budget, and
+    // a report or dump needs the passes to run. Without a compiler_id() it
+    // could not tell whose code it holds.
+    if (use_cache && output_path == nullptr && source_hash != 0 &&
+        pl0::compiler_id() != 0 &&
+        inline_budget == pl0::default_inline_budget && !inline_report &&
+        !dump_ir) {
+      cached = cache_path(source_hash, flags);
+      if (!cached.empty()) {
+        mapped = load_cached(cached, source_hash, flags);
+      }
+    }
+
+    if (mapped) {
+      code = mapped->code();
+    } else {
+      // pl0::Lexer lexer(path);
+      // lexer.print_all();
+      // The compiler reports errors by throwing C strings, the lexer
+      // std::string for files it can not open.
+      try {
+        pl0::Program program;
+        {
+          // Destroying the compiler releases its arena before the passes run.
+          pl0::Compiler compiler(path);
+          program = compiler.compile();
+          functions = compiler.functions();
+        }
+        if (optimize) {
+          program = pl0::inline_calls(program, functions, inline_budget,
+                                      inline_report ? &std::cerr : nullptr);
+          if (middle_end) {
+            program = pl0::optimize_ir(program, functions,
+                                       dump_ir ? &std::cout : nullptr);
+          }
+          if (dump_ir) {
+            return 0;
+          }
+          program = pl0::peephole(program, &functions);
+        }
+        decoded = pl0::decode(program, functions);
+      } catch (const char *msg) {
+        std::cerr << "error: " << path << ": " << msg << std::endl;
+        exit(1);
+      } catch (const std::string &msg) {
+        std::cerr << "error: " << path << ": " << msg << std::endl;
+        exit(1);
+      }
+      code = decoded;
+
+      if (output_path != nullptr) {
+        try {
+          pl0::write_bytecode(output_path, code, functions, source_hash,
+                              flags);
+        } catch (const char *msg) {
+          std::cerr << "error: " << output_path << ": " << msg << std::endl;
+          exit(1);
+        }
+        return 0;
+      }
+      if (!cached.empty()) {
+        try {
+          pl0::write_bytecode(cached, code, functions, source_hash, flags);
+        } catch (const char *) {
+          // A read-only cache only costs the next run a compile.
+        }
+      }
+    }
+  }
+
+  if (dump) {
+    pl0::print_program(code);
+    return 0;
+  }
+
+  pl0::Output output(STDOUT_FILENO, buffering, pl0::Output::default_capacity,
+                     std::chrono::milliseconds(flush_interval));
+  const bool profiling = profile || profile_json != nullptr;
+  const bool call_profiling = profile_calls || profile_folded != nullptr;
+  if (tiered && !pl0::NativeJIT::supported()) {
+    std::cerr << "error: --tiered needs the JIT, which does not support this "
+                 "platform"
+              << std::endl;
+    exit(1);
+  }
+  if ((jit || tiered) && (profiling || call_profiling)) {
+    std::cerr << "error: the profiler needs the VM alone" << std::endl;
+    exit(1);
+  }
+  if (jit && tiered) {
+    usage(argv[0]);
+  }
+  if (jit) {
+    try {
+      pl0::NativeJIT native(code);
+      if (!native.run(output)) {
+        std::cerr << "error: stack overflow" << std::endl;
+        exit(1);
+      }
+    } catch (const char *msg) {
+      output.flush();
+      std::cerr << "error: " << msg << std::endl;
+      exit(1);
+    }
+    return 0;
+  }
+
+  // Large: one counter per opcode pair.
+  std::unique_ptr<pl0::OpcodeProfiler> profiler;
+  pl0::VM vm(code, output, dispatch);
+  if (profiling) {
+    profiler.reset(new pl0::OpcodeProfiler);
+    vm.set_profiler(profiler.get());
+  }
+  if (mapped && (call_profiling || tiered)) {
+    functions = mapped->functions();
+  }
+  std::unique_ptr<pl0::TieredCompiler> tier;
+  if (tiered) {
+    tier.reset(new pl0::TieredCompiler(code, functions, tier_threshold));
+    vm.set_tier(tier.get());
+  }
+  std::unique_ptr<pl0::CallProfiler> call_profiler;
+  if (call_profiling) {
+    call_profiler.reset(new pl0::CallProfiler(code, functions));
+    vm.set_call_profiler(call_profiler.get());
+  }
+  try {
+    vm.eval();
+  } catch (const char *msg) {
+    output.flush();
+    std::cerr << "error: " << msg << std::endl;
+    exit(1);
+  }
+
+  if (tier && tier_report) {
+    tier->print_report(std::cerr);
+  }
+  if (profile) {
+    profiler->print_table(std::cerr);
+  }
+  if (profile_calls) {
+    call_profiler->print_table(std::cerr);
+  }
+  if (profile_folded != nullptr) {
+    std::ofstream folded(profile_folded);
+    call_profiler->print_folded(folded);
+    if (!folded) {
+      std::cerr << "error: cannot write " << profile_folded << std::endl;
+      exit(1);
+    }
+  }
+  if (profile_json != nullptr) {
+    std::ofstream json(profile_json);
+    profiler->print_json(json);
+    if (!json) {
+      std::cerr << "error: cannot write " << profile_json << std::endl;
+      exit(1);
+    }
+  }
 
   return 0;
 }
@@ -0,0 +1,847 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <sys/mman.h>
+
+#include "./native_jit.hpp"
+
+using namespace pl0;
+
+NativeStack::NativeStack() {
+  region = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (region == MAP_FAILED) {
+    throw "cannot allocate the JIT stack";
+  }
+}
+
+NativeStack::~NativeStack() { munmap(region, size); }
+
+#if defined(__x86_64__)
+
+namespace {
+enum Reg {
+  RAX = 0,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15,
+};
+
+// Condition codes of jcc and setcc. Flipping the low bit negates one.
+enum Cond {
+  AE = 0x3,
+  E = 0x4,
+  NE = 0x5,
+  L = 0xC,
+  GE = 0xD,
+  LE = 0xE,
+  G = 0xF,
+};
+
+// Group 1 opcode extensions for the immediate forms.
+enum AluExt {
+  ADD = 0,
+  AND = 4,
+  SUB = 5,
+  CMP = 7,
+};
+
+bool fits_int8(long long v) { return v >= -128 && v <= 127; }
+bool fits_int32(long long v) { return v >= INT32_MIN && v <= INT32_MAX; }
+
+// Just enough of an x86-64 encoder for the instruction templates below.
+// Every operation is 64 bit.
+class Assembler {
+public:
+  size_t pos() const { return buf.size(); }
+  const std::vector<uint8_t> &bytes() const { return buf; }
+
+  void load(Reg dst, Reg base, int32_t disp) {
+    rex(dst, base);
+    byte(0x8B);
+    mem(dst, base, disp);
+  }
+  void store(Reg base, int32_t disp, Reg src) {
+    rex(src, base);
+    byte(0x89);
+    mem(src, base, disp);
+  }
+  void store_imm(Reg base, int32_t disp, int32_t value) {
+    rex(RAX, base);
+    byte(0xC7);
+    mem(RAX, base, disp);
+    int32(value);
+  }
+  void lea(Reg dst, Reg base, int32_t disp) {
+    rex(dst, base);
+    byte(0x8D);
+    mem(dst, base, disp);
+  }
+  void mov(Reg dst, Reg src) { alu(0x89, dst, src); }
+  void mov_imm(Reg dst, long long value) {
+    rex(RAX, dst);
+    if (fits_int32(value)) {
+      byte(0xC7);
+      direct(RAX, dst);
+      int32(static_cast<int32_t>(value));
+    } else {
+      byte(0xB8 + (dst & 7));
+      int64(value);
+    }
+  }
+
+  // add, sub, cmp etc. of the form "op r/m64, r64"
+  void alu(uint8_t opcode, Reg dst, Reg src) {
+    rex(src, dst);
+    byte(opcode);
+    direct(src, dst);
+  }
+  void add(Reg dst, Reg src) { alu(0x01, dst, src); }
+  void sub(Reg dst, Reg src) { alu(0x29, dst, src); }
+  void cmp(Reg dst, Reg src) { alu(0x39, dst, src); }
+  void alu_imm(AluExt ext, Reg dst, int32_t value) {
+    rex(RAX, dst);
+    if (fits_int8(value)) {
+      byte(0x83);
+      direct(static_cast<Reg>(ext), dst);
+      byte(static_cast<uint8_t>(value));
+    } else {
+      byte(0x81);
+      direct(static_cast<Reg>(ext), dst);
+      int32(value);
+    }
+  }
+  void imul(Reg dst, Reg src) {
+    rex(dst, src);
+    byte(0x0F);
+    byte(0xAF);
+    direct(dst, src);
+  }
+  void cqo() {
+    byte(0x48);
+    byte(0x99);
+  }
+  void idiv(Reg src) {
+    rex(RAX, src);
+    byte(0xF7);
+    direct(static_cast<Reg>(7), src);
+  }
+  void shr_imm(Reg dst, uint8_t count) {
+    rex(RAX, dst);
+    byte(0xC1);
+    direct(static_cast<Reg>(5), dst);
+    byte(count);
+  }
+  void add_to_mem(Reg base, int32_t disp, Reg src) {
+    rex(src, base);
+    byte(0x01);
+    mem(src, base, disp);
+  }
+  void cmp_mem_zero(Reg base, int32_t disp) {
+    rex(RAX, base);
+    byte(0x83);
+    mem(static_cast<Reg>(CMP), base, disp);
+    byte(0);
+  }
+  void neg(Reg dst) {
+    rex(RAX, dst);
+    byte(0xF7);
+    direct(static_cast<Reg>(3), dst);
+  }
+  void neg_mem(Reg base, int32_t disp) {
+    rex(RAX, base);
+    byte(0xF7);
+    mem(static_cast<Reg>(3), base, disp);
+  }
+  // setcc al; movzx eax, al
+  void set_rax(Cond cond) {
+    byte(0x0F);
+    byte(0x90 | cond);
+    byte(0xC0);
+    byte(0x0F);
+    byte(0xB6);
+    byte(0xC0);
+  }
+  void rep_stosq() {
+    byte(0xF3);
+    byte(0x48);
+    byte(0xAB);
+  }
+
+  void push(Reg reg) {
+    if (reg >= R8) {
+      byte(0x41);
+    }
+    byte(0x50 + (reg & 7));
+  }
+  void pop(Reg reg) {
+    if (reg >= R8) {
+      byte(0x41);
+    }
+    byte(0x58 + (reg & 7));
+  }
+  void call(Reg reg) {
+    if (reg >= R8) {
+      byte(0x41);
+    }
+    byte(0xFF);
+    direct(static_cast<Reg>(2), reg);
+  }
+  void ret() { byte(0xC3); }
+
+  // Branches return the position of their rel32 for bind().
+  size_t jmp() {
+    byte(0xE9);
+    return rel32();
+  }
+  size_t jcc(Cond cond) {
+    byte(0x0F);
+    byte(0x80 | cond);
+    return rel32();
+  }
+  size_t call() {
+    byte(0xE8);
+    return rel32();
+  }
+  void bind(size_t patch, size_t target) {
+    int32_t rel = static_cast<int32_t>(target - (patch + 4));
+    memcpy(&buf[patch], &rel, sizeof(rel));
+  }
+
+private:
+  void byte(uint8_t b) { buf.push_back(b); }
+  void int32(int32_t v) {
+    uint8_t raw[4];
+    memcpy(raw, &v, sizeof(v));
+    buf.insert(buf.end(), raw, raw + 4);
+  }
+  void int64(long long v) {
+    uint8_t raw[8];
+    memcpy(raw, &v, sizeof(v));
+    buf.insert(buf.end(), raw, raw + 8);
+  }
+  size_t rel32() {
+    int32(0);
+    return pos() - 4;
+  }
+
+  void rex(Reg reg, Reg base) {
+    byte(0x48 | ((reg >> 3) << 2) | (base >> 3));
+  }
+  void direct(Reg reg, Reg rm) {
+    byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+  }
+  // ModRM, SIB and displacement for [base + disp]
+  void mem(Reg reg, Reg base, int32_t disp) {
+    int mod;
+    if (disp == 0 && (base & 7) != RBP) {
+      mod = 0;
+    } else if (fits_int8(disp)) {
+      mod = 1;
+    } else {
+      mod = 2;
+    }
+    byte((mod << 6) | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) {
+      byte(0x24);
+    }
+    if (mod == 1) {
+      byte(static_cast<uint8_t>(disp));
+    } else if (mod == 2) {
+      int32(disp);
+    }
+  }
+
+private:
+  std::vector<uint8_t> buf;
+};
+
+void jit_write(Output *output, long long value) { output->write(value); }
+void jit_writeln(Output *output) { output->writeln(); }
+
+// Status the generated code returns with.
+enum Exit {
+  Done = 0,
+  Overflow = 1,
+  DivisionByZero = 2,
+};
+
+using Range = std::pair<size_t, size_t>;
+
+// Follows a call target through the Jmp over nested functions.
+size_t call_target(CodeView code, size_t addr) {
+  for (int i = 0; i < 16 && code[addr].op == Instruction::Jmp; i++) {
+    addr = code[addr].addr;
+  }
+  return addr;
+}
+
+// Code ranges of functions[root] and of every function it can call, and
+// how many functions that is.
+std::vector<Range> reachable(CodeView code, const FunctionTable &functions,
+                             size_t root, size_t *count) {
+  std::vector<long long> function_at(code.size(), -1);
+  for (size_t f = 0; f < functions.size(); f++) {
+    if (functions[f].entry < code.size()) {
+      function_at[functions[f].entry] = f;
+    }
+  }
+  std::vector<bool> seen(functions.size(), false);
+  std::vector<size_t> work = {root};
+  std::vector<Range> ranges;
+  seen[root] = true;
+  while (!work.empty()) {
+    const Function &func = functions[work.back()];
+    work.pop_back();
+    if (func.end <= func.entry || func.end > code.size()) {
+      throw "function without code";
+    }
+    ranges.emplace_back(func.entry, func.end);
+    for (size_t i = func.entry; i < func.end; i++) {
+      if (code[i].op != Instruction::Call &&
+          code[i].op != Instruction::TailCall) {
+        continue;
+      }
+      long long callee = function_at[call_target(code, code[i].addr)];
+      if (callee < 0) {
+        throw "call to an unknown function";
+      }
+      if (!seen[callee]) {
+        seen[callee] = true;
+        work.push_back(callee);
+      }
+    }
+  }
+  std::sort(ranges.begin(), ranges.end());
+  *count = ranges.size();
+  return ranges;
+}
+
+// Register use in generated code:
+//   rbx  Context
+//   r12  display (long long **)
+//   r13  data stack pointer, one past the top value
+//   r14  Output
+//   r15  current frame
+//   rbp  rsp saved around runtime calls
+//   rax, rcx, rdx, rsi, rdi  scratch
+class Translator {
+public:
+  Translator(CodeView code, std::vector<Range> ranges)
+      : code(code), ranges(std::move(ranges)),
+        native_at(code.size(), SIZE_MAX) {}
+
+  // Code that enters at index 0, or makes call if given.
+  std::vector<uint8_t> translate(const Code *call) {
+    prologue(call);
+    for (const auto &range : ranges) {
+      for (size_t i = range.first; i < range.second; i++) {
+        native_at[i] = a.pos();
+        instruction(code[i]);
+      }
+    }
+    epilogue();
+
+    for (const auto &fixup : fixups) {
+      if (native_at[fixup.second] == SIZE_MAX) {
+        throw "jump out of the translated code";
+      }
+      a.bind(fixup.first, native_at[fixup.second]);
+    }
+    for (size_t patch : overflow_fixups) {
+      a.bind(patch, overflow_at);
+    }
+    for (size_t patch : division_fixups) {
+      a.bind(patch, division_at);
+    }
+    for (size_t patch : halt_fixups) {
+      a.bind(patch, halt_at);
+    }
+    return a.bytes();
+  }
+
+private:
+  // Room left between the data stack and the native stack for expression
+  // temporaries and for the runtime functions.
+  static const int32_t reserve = 64 * 1024;
+
+  static int32_t slot(long long index) {
+    if (!fits_int32(index * 8 + reserve)) {
+      throw "address too large for the JIT";
+    }
+    return static_cast<int32_t>(index * 8);
+  }
+
+  void prologue(const Code *call) {
+    a.push(RBX);
+    a.push(RBP);
+    a.push(R12);
+    a.push(R13);
+    a.push(R14);
+    a.push(R15);
+    a.mov(RBX, RDI);
+    a.store(RBX, offsetof(NativeJIT::Context, saved_rsp), RSP);
+    a.load(RSP, RBX, offsetof(NativeJIT::Context, native_stack_top));
+    a.load(R12, RBX, offsetof(NativeJIT::Context, display));
+    a.load(R13, RBX, offsetof(NativeJIT::Context, stack));
+    a.load(R14, RBX, offsetof(NativeJIT::Context, output));
+    a.load(R15, R12, 0);
+    if (call != nullptr) {
+      instruction(*call);
+    } else {
+      // main returns here if it executes Ret.
+      fixups.emplace_back(a.call(), 0);
+    }
+    halt_fixups.push_back(a.jmp());
+  }
+
+  void epilogue() {
+    halt_at = a.pos();
+    a.mov_imm(RAX, Done);
+    restore();
+    overflow_at = a.pos();
+    a.mov_imm(RAX, Overflow);
+    restore();
+    division_at = a.pos();
+    a.mov_imm(RAX, DivisionByZero);
+    restore();
+  }
+
+  void restore() {
+    a.load(RSP, RBX, offsetof(NativeJIT::Context, saved_rsp));
+    a.pop(R15);
+    a.pop(R14);
+    a.pop(R13);
+    a.pop(R12);
+    a.pop(RBP);
+    a.pop(RBX);
+    a.ret();
+  }
+
+  // Fails over to the overflow exit unless size bytes fit on the data stack.
+  void check_stack(long long size) {
+    a.lea(RAX, R13, slot(size / 8) + reserve);
+    a.cmp(RAX, RSP);
+    overflow_fixups.push_back(a.jcc(AE));
+  }
+
+  // rax = display[level][addr]
+  void load_var(Reg dst, long long level, long long addr) {
+    a.load(dst, R12, slot(level));
+    a.load(dst, dst, slot(addr));
+  }
+
+  // Pushes the frame of a call at r13: the caller's frame, and the display
+  // entry the callee replaces if it is reached through the display.
+  void enter_frame(long long level) {
+    a.store(R13, 0, R15);
+    if (level != 0) {
+      a.load(RAX, R12, slot(level));
+      a.store(R13, 8, RAX);
+      a.store(R12, slot(level), R13);
+    }
+    a.mov(R15, R13);
+    a.alu_imm(ADD, R13, 16);
+  }
+
+  void push(Reg src) {
+    a.store(R13, 0, src);
+    a.alu_imm(ADD, R13, 8);
+  }
+
+  // rax = rax op rcx
+  void binary(Instruction op) {
+    switch (op) {
+    case Instruction::Add:
+      a.add(RAX, RCX);
+      break;
+    case Instruction::Sub:
+      a.sub(RAX, RCX);
+      break;
+    case Instruction::Mul:
+      a.imul(RAX, RCX);
+      break;
+    case Instruction::Div: {
+      // As in the VM: dividing by zero is an error and LLONG_MIN / -1
+      // wraps around instead of trapping.
+      a.alu_imm(CMP, RCX, 0);
+      division_fixups.push_back(a.jcc(E));
+      a.alu_imm(CMP, RCX, -1);
+      size_t divide = a.jcc(NE);
+      a.neg(RAX);
+      size_t done = a.jmp();
+      a.bind(divide, a.pos());
+      a.cqo();
+      a.idiv(RCX);
+      a.bind(done, a.pos());
+      break;
+    }
+    default:
+      a.cmp(RAX, RCX);
+      a.set_rax(condition(op));
+      break;
+    }
+  }
+
+  static Cond condition(Instruction op) {
+    switch (op) {
+    case Instruction::Eq:
+      return E;
+    case Instruction::Neq:
+      return NE;
+    case Instruction::Less:
+      return L;
+    case Instruction::LessEq:
+      return LE;
+    case Instruction::Greater:
+      return G;
+    case Instruction::GreaterEq:
+      return GE;
+    default:
+      throw "not a comparison";
+    }
+  }
+
+  // Calls fn(output, rsi) on a 16-byte aligned native stack.
+  void call_runtime(const void *fn) {
+    a.mov(RDI, R14);
+    a.mov(RBP, RSP);
+    a.alu_imm(AND, RSP, -16);
+    a.mov_imm(RAX, reinterpret_cast<long long>(fn));
+    a.call(RAX);
+    a.mov(RSP, RBP);
+  }
+
+  void instruction(const Code &c) {
+    switch (c.op) {
+    case Instruction::Load:
+      load_var(RAX, c.level, c.addr);
+      push(RAX);
+      break;
+    case Instruction::Store:
+      a.load(RCX, R13, -8);
+      a.alu_imm(SUB, R13, 8);
+      a.load(RAX, R12, slot(c.level));
+      a.store(RAX, slot(c.addr), RCX);
+      break;
+    case Instruction::Call:
+      check_stack(16);
+      enter_frame(c.level);
+      fixups.emplace_back(a.call(), call_target(code, c.addr));
+      break;
+    case Instruction::Ret:
+      a.load(RCX, R13, -8);
+      if (c.level != 0) {
+        a.load(RDX, R15, 8);
+        a.store(R12, slot(c.level), RDX);
+      }
+      a.lea(R13, R15, -slot(c.addr));
+      a.load(R15, R15, 0);
+      push(RCX);
+      a.ret();
+      break;
+    case Instruction::TailCall:
+      // As in the VM: drop the caller's frame, move the arguments to its
+      // parameters and jump, leaving the caller's native return address for
+      // the callee's Ret. The new frame is never larger than the old one.
+      if (c.caller.level != 0) {
+        a.load(RDX, R15, 8);
+        a.store(R12, slot(c.caller.level), RDX);
+      }
+      a.mov(RAX, R15);
+      a.load(R15, RAX, 0);
+      for (int32_t i = 0; i < c.caller.args; i++) {
+        a.load(RCX, R13, -slot(c.caller.args - i));
+        a.store(RAX, slot(i - c.caller.params), RCX);
+      }
+      a.lea(R13, RAX, slot(c.caller.args - c.caller.params));
+      enter_frame(c.level);
+      fixups.emplace_back(a.jmp(), call_target(code, c.addr));
+      break;
+    case Instruction::Literal:
+      if (fits_int32(c.value)) {
+        a.store_imm(R13, 0, static_cast<int32_t>(c.value));
+      } else {
+        a.mov_imm(RAX, c.value);
+        a.store(R13, 0, RAX);
+      }
+      a.alu_imm(ADD, R13, 8);
+      break;
+    case Instruction::Ict:
+      if (c.addr > 0) {
+        // New slots start out as zero, as with std::vector::resize.
+        check_stack(slot(c.addr));
+        if (c.addr <= 16) {
+          for (int32_t i = 0; i < c.addr; i++) {
+            a.store_imm(R13, i * 8, 0);
+          }
+        } else {
+          a.mov(RDI, R13);
+          a.mov_imm(RCX, c.addr);
+          a.mov_imm(RAX, 0);
+          a.rep_stosq();
+        }
+      }
+      if (c.addr != 0) {
+        a.alu_imm(ADD, R13, slot(c.addr));
+      }
+      break;
+    case Instruction::Jmp:
+      fixups.emplace_back(a.jmp(), c.addr);
+      break;
+    case Instruction::Jpc:
+      a.alu_imm(SUB, R13, 8);
+      a.cmp_mem_zero(R13, 0);
+      fixups.emplace_back(a.jcc(E), c.addr);
+      break;
+    case Instruction::Neg:
+      a.neg_mem(R13, -8);
+      break;
+    case Instruction::Add:
+    case Instruction::Sub:
+    case Instruction::Mul:
+    case Instruction::Div:
+    case Instruction::Eq:
+    case Instruction::Neq:
+    case Instruction::Less:
+    case Instruction::LessEq:
+    case Instruction::Greater:
+    case Instruction::GreaterEq:
+      a.load(RCX, R13, -8);
+      a.load(RAX, R13, -16);
+      binary(c.op);
+      a.store(R13, -16, RAX);
+      a.alu_imm(SUB, R13, 8);
+      break;
+    case Instruction::Odd:
+      // x % 2 with the sign of x: x - ((x + (x >>> 63)) & -2)
+      a.load(RAX, R13, -8);
+      a.mov(RDX, RAX);
+      a.shr_imm(RDX, 63);
+      a.mov(RCX, RAX);
+      a.add(RCX, RDX);
+      a.alu_imm(AND, RCX, -2);
+      a.sub(RAX, RCX);
+      a.store(R13, -8, RAX);
+      break;
+    case Instruction::Write:
+      a.load(RSI, R13, -8);
+      a.alu_imm(SUB, R13, 8);
+      call_runtime(reinterpret_cast<const void *>(&jit_write));
+      break;
+    case Instruction::Writeln:
+      call_runtime(reinterpret_cast<const void *>(&jit_writeln));
+      break;
+    case Instruction::LoadOp:
+      a.load(RAX, R13, -8);
+      a.load(RCX, R15, slot(c.addr));
+      binary(c.sub);
+      a.store(R13, -8, RAX);
+      break;
+    case Instruction::LiteralOp:
+      a.load(RAX, R13, -8);
+      a.mov_imm(RCX, c.value);
+      binary(c.sub);
+      a.store(R13, -8, RAX);
+      break;
+    case Instruction::LoadLoadOp:
+      a.load(RAX, R15, slot(c.addr));
+      a.load(RCX, R15, slot(c.rhs));
+      binary(c.sub);
+      push(RAX);
+      break;
+    case Instruction::CompareJump:
+      a.load(RCX, R13, -8);
+      a.load(RAX, R13, -16);
+      a.alu_imm(SUB, R13, 16);
+      a.cmp(RAX, RCX);
+      fixups.emplace_back(
+          a.jcc(static_cast<Cond>(condition(c.sub) ^ 1)), c.addr);
+      break;
+    case Instruction::LoadAddStore:
+      a.mov_imm(RCX, c.value);
+      a.add_to_mem(R15, slot(c.addr), RCX);
+      break;
+    case Instruction::LiteralCompareJump:
+      a.load(RAX, R13, -8);
+      a.alu_imm(SUB, R13, 8);
+      a.mov_imm(RCX, c.value);
+      a.cmp(RAX, RCX);
+      fixups.emplace_back(
+          a.jcc(static_cast<Cond>(condition(c.sub) ^ 1)), c.addr);
+      break;
+    case Instruction::LoadLoadCompareJump:
+      a.load(RAX, R15, slot(c.vars.lhs));
+      a.load(RCX, R15, slot(c.vars.rhs));
+      a.cmp(RAX, RCX);
+      fixups.emplace_back(
+          a.jcc(static_cast<Cond>(condition(c.sub) ^ 1)), c.addr);
+      break;
+    case Instruction::LoadLocal:
+      a.load(RAX, R15, slot(c.addr));
+      push(RAX);
+      break;
+    case Instruction::StoreLocal:
+      a.load(RCX, R13, -8);
+      a.alu_imm(SUB, R13, 8);
+      a.store(R15, slot(c.addr), RCX);
+      break;
+    case Instruction::LoadGlobal:
+      load_var(RAX, 0, c.addr);
+      push(RAX);
+      break;
+    case Instruction::StoreGlobal:
+      a.load(RCX, R13, -8);
+      a.alu_imm(SUB, R13, 8);
+      a.load(RAX, R12, 0);
+      a.store(RAX, slot(c.addr), RCX);
+      break;
+    case Instruction::Halt:
+      halt_fixups.push_back(a.jmp());
+      break;
+    }
+  }
+
+private:
+  CodeView code;
+  std::vector<Range> ranges; // translated code indices
+  Assembler a;
+  std::vector<size_t> native_at;
+  // (position of rel32, code index)
+  std::vector<std::pair<size_t, size_t>> fixups;
+  std::vector<size_t> overflow_fixups;
+  std::vector<size_t> division_fixups;
+  std::vector<size_t> halt_fixups;
+  size_t halt_at = 0;
+  size_t overflow_at = 0;
+  size_t division_at = 0;
+};
+} // namespace
+
+bool NativeJIT::supported() { return true; }
+
+NativeJIT::NativeJIT(CodeView code) : display(display_size(code)) {
+  load(Translator(code, {Range(0, code.size())}).translate(nullptr));
+}
+
+NativeJIT::NativeJIT(CodeView code, const FunctionTable &functions,
+                     size_t function)
+    : entry_level(functions[function].level),
+      entry_params(functions[function].params) {
+  display.resize(std::max(display_size(code), entry_level + 1));
+  Translator translator(code,
+                        reachable(code, functions, function, &this->functions));
+  Code call = {};
+  call.op = Instruction::Call;
+  call.level = entry_level;
+  call.addr = functions[function].entry;
+  load(translator.translate(&call));
+}
+
+void NativeJIT::load(const std::vector<uint8_t> &bytes) {
+  size = bytes.size();
+  void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapped == MAP_FAILED) {
+    throw "cannot allocate memory for JIT code";
+  }
+  memcpy(mapped, bytes.data(), size);
+  if (mprotect(mapped, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(mapped, size);
+    throw "cannot make JIT code executable";
+  }
+  text = static_cast<uint8_t *>(mapped);
+}
+
+NativeJIT::~NativeJIT() {
+  if (text != nullptr) {
+    munmap(text, size);
+  }
+}
+
+int NativeJIT::enter(Context &context) {
+  auto entry = reinterpret_cast<int (*)(Context *)>(text);
+  int status = entry(&context);
+  if (status == DivisionByZero) {
+    throw "division by zero";
+  }
+  return status;
+}
+
+bool NativeJIT::run(Output &output) {
+  NativeStack stack;
+
+  // Same start state as VM: main's frame at the bottom of the stack.
+  long long *base = stack.bottom();
+  base[0] = 0;
+  base[1] = 0;
+  std::fill(display.begin(), display.end(), nullptr);
+  display[0] = base;
+
+  Context context;
+  context.display = display.data();
+  context.stack = base + 2;
+  context.output = &output;
+  context.native_stack_top = stack.top();
+  context.saved_rsp = nullptr;
+
+  int status = enter(context);
+  output.flush();
+  return status == Done;
+}
+
+long long NativeJIT::call(long long *const *display, const long long *args,
+                          Output &output, NativeStack &stack) {
+  std::copy(display, display + entry_level, this->display.begin());
+  long long *base = stack.bottom();
+  std::copy(args, args + entry_params, base);
+
+  Context context;
+  context.display = this->display.data();
+  context.stack = base + entry_params;
+  context.output = &output;
+  context.native_stack_top = stack.top();
+  context.saved_rsp = nullptr;
+
+  if (enter(context) != Done) {
+    throw "stack overflow";
+  }
+  // Ret leaves the value where the arguments were.
+  return base[0];
+}
+
+#else
+
+bool NativeJIT::supported() { return false; }
+
+NativeJIT::NativeJIT(CodeView code) {
+  throw "the native JIT only supports x86-64";
+}
+
+NativeJIT::NativeJIT(CodeView code, const FunctionTable &functions,
+                     size_t function) {
+  throw "the native JIT only supports x86-64";
+}
+
+NativeJIT::~NativeJIT() {}
+
+bool NativeJIT::run(Output &output) { return false; }
+
+long long NativeJIT::call(long long *const *display, const long long *args,
+                          Output &output, NativeStack &stack) {
+  return 0;
+}
+
+#endif
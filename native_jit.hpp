@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "./code.hpp"
+#include "./instruction.hpp"
+#include "./output.hpp"
+
+namespace pl0 {
+// Reserved space for the data stack (growing up) and the native stack
+// (growing down) of generated code. Pages are only committed as they are
+// touched, so one can be kept and reused across calls.
+class NativeStack {
+public:
+  NativeStack();
+  ~NativeStack();
+  NativeStack(const NativeStack &) = delete;
+  NativeStack &operator=(const NativeStack &) = delete;
+
+  long long *bottom() const { return static_cast<long long *>(region); }
+  void *top() const { return static_cast<char *>(region) + size; }
+
+private:
+  static const size_t size = size_t(1) << 30;
+  void *region;
+};
+
+// Template JIT that translates decoded bytecode straight into x86-64
+// machine code, one fixed snippet per instruction, without LLVM.
+//
+// The generated code keeps the VM's frame layout and display semantics,
+// except that display entries and frame links are pointers into the data
+// stack instead of indices. PL/0 calls become native call/ret, so the
+// second slot of a frame only holds the saved display entry.
+// The data stack grows up from the bottom of one mapping and the native
+// stack grows down from its top, and running out of room between them is
+// reported as a stack overflow.
+class NativeJIT {
+public:
+  // Whether this build can generate code for the host (x86-64 only).
+  static bool supported();
+
+  // Translates the whole program, for run().
+  NativeJIT(CodeView code);
+  // Translates only functions[function] and every function it can call,
+  // for call().
+  NativeJIT(CodeView code, const FunctionTable &functions, size_t function);
+  ~NativeJIT();
+  NativeJIT(const NativeJIT &) = delete;
+  NativeJIT &operator=(const NativeJIT &) = delete;
+
+  // Runs the program. Returns false if it ran out of stack, and throws on
+  // division by zero like the VM.
+  bool run(Output &output);
+
+  // Calls the function as a Call instruction would and returns its value.
+  // args holds its params() arguments, and display its caller's display
+  // from level 0 up to, not including, level() as pointers to the frames;
+  // levels the code never reaches through the display may be null.
+  // Throws on stack overflow and division by zero.
+  long long call(long long *const *display, const long long *args,
+                 Output &output, NativeStack &stack);
+
+  size_t code_size() const { return size; }
+  size_t level() const { return entry_level; }
+  size_t params() const { return entry_params; }
+  // Functions translated for call(), the called one included.
+  size_t function_count() const { return functions; }
+
+public:
+  // Shared with the generated code; offsets are baked into it.
+  struct Context {
+    long long **display;
+    long long *stack;
+    Output *output;
+    void *native_stack_top;
+    void *saved_rsp;
+  };
+
+private:
+  void load(const std::vector<uint8_t> &bytes);
+  int enter(Context &context);
+
+private:
+  uint8_t *text = nullptr;
+  size_t size = 0;
+  std::vector<long long *> display;
+  size_t entry_level = 0;
+  size_t entry_params = 0;
+  size_t functions = 0;
+};
+} // namespace pl0
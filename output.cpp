@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#include "./output.hpp"
+
+using namespace pl0;
+
+const size_t Output::default_capacity;
+const size_t Output::max_line;
+
+Output::Output(int fd, Buffering buffering, size_t capacity,
+               std::chrono::milliseconds flush_interval)
+    : fd(fd), buffering(buffering), capacity(std::max(capacity, max_line)),
+      flush_interval(flush_interval),
+      last_flush(std::chrono::steady_clock::now()) {
+  buffer.reset(new char[this->capacity]);
+}
+
+Output::Output(std::string &sink, size_t capacity)
+    : fd(-1), sink(&sink), buffering(Buffering::Full),
+      capacity(std::max(capacity, max_line)), flush_interval(0),
+      last_flush(std::chrono::steady_clock::now()) {
+  buffer.reset(new char[this->capacity]);
+}
+
+Buffering Output::default_buffering(int fd) {
+  return isatty(fd) ? Buffering::Line : Buffering::Full;
+}
+
+void Output::flush() {
+  if (sink != nullptr) {
+    sink->append(buffer.get(), size);
+    size = 0;
+    return;
+  }
+  const char *p = buffer.get();
+  size_t rest = size;
+  while (rest > 0) {
+    ssize_t written = ::write(fd, p, rest);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // Nothing sensible to do with output that can not be written.
+      break;
+    }
+    p += written;
+    rest -= written;
+  }
+  size = 0;
+  if (flush_interval.count() != 0) {
+    last_flush = std::chrono::steady_clock::now();
+  }
+}
+
+// Writes the decimal form of value to out, two digits at a time, and
+// returns its length.
+size_t Output::format(long long value, char *out) {
+  static const char digits[] = "00010203040506070809"
+                               "10111213141516171819"
+                               "20212223242526272829"
+                               "30313233343536373839"
+                               "40414243444546474849"
+                               "50515253545556575859"
+                               "60616263646566676869"
+                               "70717273747576777879"
+                               "80818283848586878889"
+                               "90919293949596979899";
+  char tmp[max_line];
+  char *end = tmp + sizeof(tmp);
+  char *p = end;
+
+  // Negate in unsigned arithmetic so that LLONG_MIN works too.
+  unsigned long long n = value < 0 ? 0ULL - static_cast<unsigned long long>(value)
+                                   : static_cast<unsigned long long>(value);
+  while (n >= 100) {
+    size_t i = (n % 100) * 2;
+    n /= 100;
+    *--p = digits[i + 1];
+    *--p = digits[i];
+  }
+  if (n >= 10) {
+    size_t i = n * 2;
+    *--p = digits[i + 1];
+    *--p = digits[i];
+  } else {
+    *--p = static_cast<char>('0' + n);
+  }
+  if (value < 0) {
+    *--p = '-';
+  }
+
+  size_t length = end - p;
+  memcpy(out, p, length);
+  return length;
+}
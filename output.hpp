@@ -0,0 +1,79 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+namespace pl0 {
+enum class Buffering {
+  Line, // flush after every line, for interactive use
+  Full, // flush when the buffer fills up and at exit
+};
+
+// Buffered sink for Write/Writeln. Integers are formatted in place and
+// handed to the file descriptor in large blocks instead of going through
+// std::cout and std::endl, which flushes on every value.
+class Output {
+public:
+  static const size_t default_capacity = 64 * 1024;
+
+  // flush_interval, when not zero, also flushes once a write happens that
+  // long after the previous flush.
+  Output(int fd, Buffering buffering, size_t capacity = default_capacity,
+         std::chrono::milliseconds flush_interval = {});
+  // Collects the output in sink instead, e.g. one string per batch job.
+  // sink must outlive the Output.
+  explicit Output(std::string &sink, size_t capacity = default_capacity);
+  ~Output() { flush(); }
+  Output(const Output &) = delete;
+  Output &operator=(const Output &) = delete;
+
+  // Line buffering on a terminal, full buffering otherwise, as stdio does.
+  static Buffering default_buffering(int fd);
+
+  void write(long long value) {
+    if (capacity - size < max_line) {
+      flush();
+    }
+    size += format(value, buffer.get() + size);
+    buffer[size++] = '\n';
+    end_line();
+  }
+
+  void writeln() {
+    if (size == capacity) {
+      flush();
+    }
+    buffer[size++] = '\n';
+    end_line();
+  }
+
+  void flush();
+
+private:
+  // Longest line write() produces: sign, 19 digits and '\n'.
+  static const size_t max_line = 21;
+
+  static size_t format(long long value, char *out);
+
+  void end_line() {
+    if (buffering == Buffering::Line) {
+      flush();
+    } else if (flush_interval.count() != 0 &&
+               std::chrono::steady_clock::now() - last_flush >=
+                   flush_interval) {
+      flush();
+    }
+  }
+
+private:
+  int fd;
+  std::string *sink = nullptr;
+  Buffering buffering;
+  std::unique_ptr<char[]> buffer;
+  size_t capacity;
+  size_t size = 0;
+  std::chrono::milliseconds flush_interval;
+  std::chrono::steady_clock::time_point last_flush;
+};
+} // namespace pl0
@@ -0,0 +1,359 @@
+#include <string>
+
+#include "./parser.hpp"
+
+using namespace pl0;
+using ast::Kind;
+using ast::NodeId;
+
+ast::Ast Parser::parse() {
+  ast.functions.push_back(
+      {Interner::global().intern("main"), 0, 0, 0, 0, {}, {}});
+  block(0);
+  return std::move(ast);
+}
+
+// Parses the declarations and the statement of ast.functions[function],
+// whose parameter names are the last ones in pending_names.
+void Parser::block(size_t function) {
+  uint32_t locals = 0;
+  const size_t names_start =
+      pending_names.size() - ast.functions[function].params;
+  const size_t nested_start = pending.size();
+  while (true) {
+    if (cur_token.type == TokenType::Const) {
+      constDecl();
+    } else if (cur_token.type == TokenType::Var) {
+      varDecl(&locals);
+    } else if (cur_token.type == TokenType::Function) {
+      functionDecl();
+    } else {
+      break;
+    }
+  }
+
+  ast::Function &func = ast.functions[function];
+  func.locals = locals;
+  func.nested = take_pending(nested_start);
+  func.names.first = ast.names.size();
+  func.names.size = pending_names.size() - names_start;
+  ast.names.insert(ast.names.end(), pending_names.begin() + names_start,
+                   pending_names.end());
+  pending_names.resize(names_start);
+
+  NodeId body = statement();
+  ast.functions[function].body = body;
+}
+
+void Parser::constDecl() {
+  takeToken(TokenType::Const);
+  while (true) {
+    if (cur_token.type != TokenType::Ident) {
+      throw "expected ident";
+    }
+
+    Symbol const_name = cur_token.ident;
+    nextToken();
+
+    if (cur_token.type != TokenType::Equal) {
+      throw "expected equal";
+    }
+    nextToken();
+
+    if (cur_token.type != TokenType::Integer) {
+      throw "expected integer";
+    }
+
+    ident_table.appendConst(const_name, cur_token.integer);
+    nextToken();
+
+    if (cur_token.type == TokenType::Colon) {
+      nextToken();
+      // continue;
+    } else if (cur_token.type == TokenType::Semicolon) {
+      nextToken();
+      break;
+    } else {
+      throw "unexpected at constDecl";
+    }
+  }
+}
+
+void Parser::varDecl(uint32_t *locals) {
+  takeToken(TokenType::Var);
+  while (true) {
+    if (cur_token.type != TokenType::Ident) {
+      throw "expected ident";
+    }
+
+    ident_table.appendVar(cur_token.ident);
+    pending_names.push_back(cur_token.ident);
+    (*locals)++;
+    nextToken();
+
+    if (cur_token.type == TokenType::Colon) {
+      nextToken();
+      // continue;
+    } else if (cur_token.type == TokenType::Semicolon) {
+      nextToken();
+      break;
+    } else {
+      throw "unexpected at varDecl";
+    }
+  }
+}
+
+void Parser::functionDecl() {
+  takeToken(TokenType::Function);
+  if (cur_token.type != TokenType::Ident) {
+    throw "expected ident but";
+  }
+  Symbol func_name = cur_token.ident;
+  nextToken();
+
+  const size_t params_start = pending_names.size();
+  takeToken(TokenType::ParenL);
+  while (true) {
+    if (cur_token.type != TokenType::Ident) {
+      break;
+    }
+
+    pending_names.push_back(cur_token.ident);
+    nextToken();
+    if (cur_token.type == TokenType::Colon) {
+      nextToken();
+      // continue;
+    } else {
+      break;
+    }
+  }
+  takeToken(TokenType::ParenR);
+
+  const uint32_t params = pending_names.size() - params_start;
+  const size_t function = ast.functions.size();
+  const uint32_t level = ident_table.getLevel() + 1;
+  ast.functions.push_back({func_name, level, params, 0, 0, {}, {}});
+  pending.push_back(function);
+  ident_table.appendFunc(func_name, function, params);
+
+  ident_table.enterBlock();
+  long long offset = -static_cast<long long>(params);
+  for (size_t i = params_start; i < pending_names.size(); i++) {
+    ident_table.appendParam(pending_names[i], offset++);
+  }
+
+  block(function);
+  takeToken(TokenType::Semicolon);
+  ident_table.leaveBlock();
+}
+
+NodeId Parser::statement() {
+  NodeId node;
+  size_t start;
+
+  switch (cur_token.type) {
+  case TokenType::Ident: {
+    const IdInfo info = ident_table.find(cur_token.ident);
+    if (info.type != IdType::Var) {
+      throw "expected variable";
+    }
+    nextToken();
+    takeToken(TokenType::Assign);
+    node = add(Kind::Assign, expression());
+    ast.nodes[node].ref = info.level;
+    ast.nodes[node].value = info.addr;
+    return node;
+  }
+  case TokenType::Begin:
+    nextToken();
+    start = pending.size();
+    while (true) {
+      pending.push_back(statement());
+      if (cur_token.type == TokenType::Semicolon) {
+        takeToken(TokenType::Semicolon);
+        // continue;
+      } else if (cur_token.type == TokenType::End) {
+        takeToken(TokenType::End);
+        break;
+      } else {
+        throw "expect semicolon or end but not";
+      }
+    }
+    {
+      ast::Range statements = take_pending(start);
+      return add(Kind::Begin, statements.first, statements.size);
+    }
+  case TokenType::If:
+    nextToken();
+    node = condition();
+    takeToken(TokenType::Then);
+    return add(Kind::If, node, statement());
+  case TokenType::While:
+    nextToken();
+    node = condition();
+    takeToken(TokenType::Do);
+    return add(Kind::While, node, statement());
+  case TokenType::Return:
+    nextToken();
+    return add(Kind::Return, expression());
+  case TokenType::Write:
+    nextToken();
+    return add(Kind::Write, expression());
+  case TokenType::Writeln:
+    nextToken();
+    return add(Kind::Writeln);
+  default:
+    return add(Kind::Empty);
+  }
+}
+
+static bool is_comparison(TokenType type) {
+  switch (type) {
+  case TokenType::Equal:
+  case TokenType::NotEqual:
+  case TokenType::Less:
+  case TokenType::LessEqual:
+  case TokenType::Greater:
+  case TokenType::GreaterEqual:
+    return true;
+  default:
+    return false;
+  }
+}
+
+NodeId Parser::condition() {
+  NodeId node;
+  if (cur_token.type == TokenType::Odd) {
+    nextToken();
+    node = add(Kind::Unary, expression());
+    ast.nodes[node].op = TokenType::Odd;
+  } else {
+    NodeId lhs = expression();
+    TokenType op = cur_token.type;
+    if (!is_comparison(op)) {
+      throw "not support at token to inst";
+    }
+    nextToken();
+    node = add(Kind::Binary, lhs, expression());
+    ast.nodes[node].op = op;
+  }
+  return node;
+}
+
+NodeId Parser::expression() {
+  TokenType sign = cur_token.type;
+  if (cur_token.type == TokenType::Plus || cur_token.type == TokenType::Minus) {
+    nextToken();
+  }
+
+  NodeId node = term();
+  if (sign == TokenType::Minus) {
+    node = add(Kind::Unary, node);
+    ast.nodes[node].op = TokenType::Minus;
+  }
+
+  while (cur_token.type == TokenType::Plus ||
+         cur_token.type == TokenType::Minus) {
+    TokenType op = cur_token.type;
+    nextToken();
+    node = add(Kind::Binary, node, term());
+    ast.nodes[node].op = op;
+  }
+  return node;
+}
+
+NodeId Parser::term() {
+  NodeId node = factor();
+  while (cur_token.type == TokenType::Mul || cur_token.type == TokenType::Div) {
+    TokenType op = cur_token.type;
+    nextToken();
+    node = add(Kind::Binary, node, factor());
+    ast.nodes[node].op = op;
+  }
+  return node;
+}
+
+NodeId Parser::factor() {
+  NodeId node = 0;
+  if (cur_token.type == TokenType::Ident) {
+    const IdInfo info = ident_table.find(cur_token.ident);
+    nextToken();
+    size_t start = pending.size();
+    switch (info.type) {
+    case IdType::Const:
+      node = add(Kind::Number);
+      ast.nodes[node].value = info.value;
+      break;
+    case IdType::Function: {
+      takeToken(TokenType::ParenL);
+      while (cur_token.type != TokenType::ParenR) {
+        pending.push_back(expression());
+        if (cur_token.type == TokenType::Colon) {
+          nextToken();
+          // continue;
+        } else {
+          break;
+        }
+      }
+      takeToken(TokenType::ParenR);
+      if (pending.size() - start != info.param_size) {
+        throw "params not same";
+      }
+      ast::Range args = take_pending(start);
+      node = add(Kind::Call, args.first, args.size);
+      ast.nodes[node].ref = info.function;
+      break;
+    }
+    case IdType::Var:
+      node = add(Kind::Variable);
+      ast.nodes[node].ref = info.level;
+      ast.nodes[node].value = info.addr;
+      break;
+    }
+  } else if (cur_token.type == TokenType::Integer) {
+    node = add(Kind::Number);
+    ast.nodes[node].value = cur_token.integer;
+    nextToken();
+  } else if (cur_token.type == TokenType::ParenL) {
+    nextToken();
+    node = expression();
+    takeToken(TokenType::ParenR);
+  } else {
+    throw "expect factr but";
+  }
+  return node;
+}
+
+NodeId Parser::add(Kind kind, NodeId first, NodeId second) {
+  ast::Node node;
+  node.kind = kind;
+  node.op = TokenType::TEOF;
+  node.ref = 0;
+  node.first = first;
+  node.second = second;
+  node.value = 0;
+  ast.nodes.push_back(node);
+  return ast.nodes.size() - 1;
+}
+
+// Moves pending[start, end) to the end of ast.lists.
+ast::Range Parser::take_pending(size_t start) {
+  ast::Range range;
+  range.first = ast.lists.size();
+  range.size = pending.size() - start;
+  ast.lists.insert(ast.lists.end(), pending.begin() + start, pending.end());
+  pending.resize(start);
+  return range;
+}
+
+void Parser::nextToken() {
+  cur_token = std::move(peek_token);
+  peek_token = std::move(lexer.nextToken());
+}
+
+void Parser::takeToken(TokenType type) {
+  if (cur_token.type != type) {
+    throw "unexpected token";
+  }
+  nextToken();
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "./arena.hpp"
+#include "./ast.hpp"
+#include "./lexer.hpp"
+#include "./table.hpp"
+#include "./token.hpp"
+
+namespace pl0 {
+// Parses a source file into an ast::Ast, resolving names with a Table.
+// Errors are thrown as C strings, like the compiler's.
+class Parser {
+public:
+  // The tree and the parser's own tables are allocated from arena.
+  Parser(const std::string &path, Arena &arena)
+      : lexer(path), ast(arena), ident_table(arena), pending(arena),
+        pending_names(arena) {
+    cur_token = std::move(lexer.nextToken());
+    peek_token = std::move(lexer.nextToken());
+  }
+  ast::Ast parse();
+
+private:
+  void block(size_t function);
+  void constDecl();
+  void varDecl(uint32_t *locals);
+  void functionDecl();
+  ast::NodeId statement();
+  ast::NodeId condition();
+  ast::NodeId expression();
+  ast::NodeId term();
+  ast::NodeId factor();
+
+private:
+  ast::NodeId add(ast::Kind kind, ast::NodeId first = 0,
+                  ast::NodeId second = 0);
+  ast::Range take_pending(size_t start);
+
+  void nextToken();
+  void takeToken(TokenType type);
+
+private:
+  Lexer lexer;
+  ast::Ast ast;
+  Table ident_table;
+  // Children of the Begin and Call nodes and nested functions being parsed,
+  // innermost last; each moves to ast.lists once it is complete.
+  ArenaVector<uint32_t> pending;
+  // Likewise the parameter and local names of the functions being parsed.
+  ArenaVector<Symbol> pending_names;
+
+  Token cur_token;
+  Token peek_token;
+};
+} // namespace pl0
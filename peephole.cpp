@@ -0,0 +1,227 @@
+#include <vector>
+
+#include "./peephole.hpp"
+
+using namespace pl0;
+
+namespace {
+struct Inst {
+  size_t pos;
+  Instruction op;
+  std::vector<long long> operands;
+  bool removed;
+
+  long long target() const { return operands[target_operand(op)]; }
+  void set_target(long long pos) { operands[target_operand(op)] = pos; }
+  bool has_target() const { return target_operand(op) >= 0; }
+};
+
+class Peephole {
+public:
+  Peephole(const Program &program, FunctionTable *functions)
+      : functions(functions) {
+    size_t i = 0;
+    while (i < program.size()) {
+      Inst inst;
+      inst.pos = i;
+      inst.op = static_cast<Instruction>(program[i++]);
+      inst.removed = false;
+      for (size_t size = operand_size(inst.op); size > 0; size--) {
+        inst.operands.push_back(program[i++]);
+      }
+      insts.push_back(std::move(inst));
+    }
+    end_pos = program.size();
+  }
+
+  Program run() {
+    bool changed = true;
+    while (changed) {
+      index_targets();
+      changed = false;
+      changed |= thread_jumps();
+      changed |= drop_unreachable();
+      changed |= drop_useless();
+      relocate();
+    }
+
+    Program program;
+    for (const auto &inst : insts) {
+      program.push_back(static_cast<long long>(inst.op));
+      program.insert(program.end(), inst.operands.begin(),
+                     inst.operands.end());
+    }
+    return program;
+  }
+
+private:
+  // Builds the position to index map and marks every jump target.
+  void index_targets() {
+    index_at.assign(end_pos + 1, -1);
+    is_target.assign(end_pos + 1, false);
+    for (size_t i = 0; i < insts.size(); i++) {
+      index_at[insts[i].pos] = i;
+    }
+    for (const auto &inst : insts) {
+      if (inst.has_target()) {
+        is_target[inst.target()] = true;
+      }
+    }
+    // Function bodies stay, even if nothing calls them.
+    if (functions != nullptr) {
+      for (const auto &func : *functions) {
+        is_target[func.entry] = true;
+      }
+    }
+  }
+
+  const Inst *at(long long pos) const {
+    long long i = index_at[pos];
+    return i < 0 ? nullptr : &insts[i];
+  }
+
+  bool thread_jumps() {
+    bool changed = false;
+    for (auto &inst : insts) {
+      if (!inst.has_target()) {
+        continue;
+      }
+      long long target = inst.target();
+      // Bounded so that a Jmp cycle can not hang the pass.
+      for (size_t step = 0; step < insts.size(); step++) {
+        const Inst *next = at(target);
+        if (next == nullptr || next->op != Instruction::Jmp ||
+            next->target() == target) {
+          break;
+        }
+        target = next->target();
+      }
+      if (target != inst.target()) {
+        inst.set_target(target);
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  bool drop_unreachable() {
+    bool changed = false;
+    bool reachable = true;
+    for (auto &inst : insts) {
+      if (is_target[inst.pos]) {
+        reachable = true;
+      }
+      if (!reachable) {
+        inst.removed = true;
+        changed = true;
+        continue;
+      }
+      if (inst.op == Instruction::Jmp || inst.op == Instruction::Ret ||
+          inst.op == Instruction::TailCall || inst.op == Instruction::Halt) {
+        reachable = false;
+      }
+    }
+    return changed;
+  }
+
+  bool drop_useless() {
+    bool changed = false;
+    for (size_t i = 0; i < insts.size(); i++) {
+      auto &inst = insts[i];
+      if (inst.removed) {
+        continue;
+      }
+      const Inst *next = next_live(i);
+      const long long next_pos = next == nullptr ? end_pos : next->pos;
+
+      if (inst.op == Instruction::Jmp && inst.target() == next_pos) {
+        inst.removed = true;
+        changed = true;
+      } else if (inst.op == Instruction::LiteralOp &&
+                 is_identity(static_cast<Instruction>(inst.operands[1]),
+                             inst.operands[0])) {
+        inst.removed = true;
+        changed = true;
+      } else if (inst.op == Instruction::Literal && next != nullptr &&
+                 !is_target[next->pos] &&
+                 is_identity(next->op, inst.operands[0])) {
+        inst.removed = true;
+        insts[index_at[next->pos]].removed = true;
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  // Whether applying op with value as right hand side leaves lhs unchanged.
+  static bool is_identity(Instruction op, long long value) {
+    switch (op) {
+    case Instruction::Add:
+    case Instruction::Sub:
+      return value == 0;
+    case Instruction::Mul:
+    case Instruction::Div:
+      return value == 1;
+    default:
+      return false;
+    }
+  }
+
+  const Inst *next_live(size_t i) const {
+    for (i++; i < insts.size(); i++) {
+      if (!insts[i].removed) {
+        return &insts[i];
+      }
+    }
+    return nullptr;
+  }
+
+  // Drops removed instructions and rewrites code addresses. A removed
+  // instruction relocates to the next surviving one.
+  void relocate() {
+    std::vector<long long> new_pos(end_pos + 1);
+    size_t pos = 0;
+    size_t i = 0;
+    for (size_t old_pos = 0; old_pos <= end_pos; old_pos++) {
+      while (i < insts.size() && insts[i].pos < old_pos) {
+        if (!insts[i].removed) {
+          pos += 1 + insts[i].operands.size();
+        }
+        i++;
+      }
+      new_pos[old_pos] = pos;
+    }
+
+    std::vector<Inst> live;
+    for (auto &inst : insts) {
+      if (inst.removed) {
+        continue;
+      }
+      if (inst.has_target()) {
+        inst.set_target(new_pos[inst.target()]);
+      }
+      inst.pos = new_pos[inst.pos];
+      live.push_back(std::move(inst));
+    }
+    insts = std::move(live);
+    if (functions != nullptr) {
+      for (auto &func : *functions) {
+        func.entry = new_pos[func.entry];
+        func.end = new_pos[func.end];
+      }
+    }
+    end_pos = new_pos[end_pos];
+  }
+
+private:
+  std::vector<Inst> insts;
+  FunctionTable *functions;
+  size_t end_pos;
+  std::vector<long long> index_at;
+  std::vector<bool> is_target;
+};
+} // namespace
+
+Program pl0::peephole(const Program &program, FunctionTable *functions) {
+  return Peephole(program, functions).run();
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "./instruction.hpp"
+
+namespace pl0 {
+// Rewrites program until nothing changes:
+// - jumps and calls to a Jmp go straight to its final target
+// - Jmp to the next instruction is dropped
+// - Literal 0; Add and friends that leave the value unchanged are dropped
+// - code after Jmp, Ret or Halt that no jump reaches is dropped
+// Code addresses, including the entries in functions, are relocated after
+// every round.
+Program peephole(const Program &program, FunctionTable *functions = nullptr);
+} // namespace pl0
@@ -1,4 +1,3 @@
 #!/bin/sh
-./build/llvmpl0 $1
-llvm-link out.ll ./build/write.ll -S -o ./build/linked.ll
-opt -S -mem2reg ./build/linked.ll > out.ll
+# llvmpl0 links write.ll and optimizes by itself; kept for old scripts.
+./build/llvmpl0 -O1 --emit=ll -o out.ll "$1"
@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include "./profiler.hpp"
+
+using namespace pl0;
+
+const char *pl0::profile_clock_unit() {
+#if defined(__x86_64__) || defined(__i386__)
+  return "cycles";
+#else
+  return "ns";
+#endif
+}
+
+static std::string name(size_t op) {
+  std::ostringstream out;
+  out << static_cast<Instruction>(op);
+  return out.str();
+}
+
+static double percent(uint64_t part, uint64_t total) {
+  return total == 0 ? 0 : 100.0 * part / total;
+}
+
+std::vector<OpcodeProfiler::Pair> OpcodeProfiler::top(size_t limit) const {
+  std::vector<Pair> result;
+  for (size_t first = 0; first < instruction_count; first++) {
+    for (size_t second = 0; second < instruction_count; second++) {
+      if (pairs[first][second] != 0) {
+        result.push_back({first, second, pairs[first][second]});
+      }
+    }
+  }
+  std::sort(result.begin(), result.end(), [](const Pair &a, const Pair &b) {
+    return a.count > b.count;
+  });
+  if (result.size() > limit) {
+    result.resize(limit);
+  }
+  return result;
+}
+
+void OpcodeProfiler::print_table(std::ostream &out, size_t top_pairs) const {
+  uint64_t total_count = 0, total_time = 0;
+  std::vector<size_t> ops;
+  for (size_t op = 0; op < instruction_count; op++) {
+    if (counts[op] != 0) {
+      ops.push_back(op);
+      total_count += counts[op];
+      total_time += cycles[op];
+    }
+  }
+  std::sort(ops.begin(), ops.end(),
+            [&](size_t a, size_t b) { return cycles[a] > cycles[b]; });
+
+  const std::string unit = profile_clock_unit();
+  out << std::left << std::setw(14) << "opcode" << std::right << std::setw(14)
+      << "count" << std::setw(8) << "%" << std::setw(16) << unit
+      << std::setw(8) << "%" << std::setw(10) << (unit + "/op") << '\n';
+  out << std::fixed << std::setprecision(1);
+  for (size_t op : ops) {
+    out << std::left << std::setw(14) << name(op) << std::right
+        << std::setw(14) << counts[op] << std::setw(8)
+        << percent(counts[op], total_count) << std::setw(16) << cycles[op]
+        << std::setw(8) << percent(cycles[op], total_time) << std::setw(10)
+        << static_cast<double>(cycles[op]) / counts[op] << '\n';
+  }
+  out << std::left << std::setw(14) << "total" << std::right << std::setw(14)
+      << total_count << std::setw(8) << "" << std::setw(16) << total_time
+      << '\n';
+
+  out << "\ntop opcode pairs\n";
+  for (const auto &pair : top(top_pairs)) {
+    out << std::left << std::setw(28)
+        << (name(pair.first) + " -> " + name(pair.second)) << std::right
+        << std::setw(14) << pair.count << std::setw(8)
+        << percent(pair.count, total_count) << '\n';
+  }
+  out.unsetf(std::ios::floatfield);
+}
+
+void OpcodeProfiler::print_json(std::ostream &out, size_t top_pairs) const {
+  out << "{\"unit\":\"" << profile_clock_unit() << "\",\"opcodes\":[";
+  const char *sep = "";
+  for (size_t op = 0; op < instruction_count; op++) {
+    if (counts[op] == 0) {
+      continue;
+    }
+    out << sep << "{\"name\":\"" << name(op) << "\",\"count\":" << counts[op]
+        << ",\"time\":" << cycles[op] << '}';
+    sep = ",";
+  }
+  out << "],\"pairs\":[";
+  sep = "";
+  for (const auto &pair : top(top_pairs)) {
+    out << sep << "{\"first\":\"" << name(pair.first) << "\",\"second\":\""
+        << name(pair.second) << "\",\"count\":" << pair.count << '}';
+    sep = ",";
+  }
+  out << "]}\n";
+}
+
+CallProfiler::CallProfiler(CodeView code, const FunctionTable &functions)
+    : code(code), table(functions), functions(functions.size() + 1),
+      active(functions.size() + 1), resolved(code.size(), -1) {
+  for (size_t i = 0; i < functions.size(); i++) {
+    if (functions[i].entry < code.size()) {
+      resolved[functions[i].entry] = i;
+    }
+  }
+  nodes.push_back({functions.size(), 0, {}, 0});
+}
+
+// The last slot stands for code outside any known function, e.g. when the
+// bytecode came without a function table.
+size_t CallProfiler::function_at(size_t target) {
+  if (target >= resolved.size()) {
+    return table.size();
+  }
+  if (resolved[target] < 0) {
+    // A function starts with Jmp over its nested functions, unless the
+    // peephole pass already threaded the call to the body. Bounded like
+    // the peephole pass, so a Jmp cycle can not hang.
+    size_t pc = target;
+    for (size_t n = 0; n < 16 && resolved[pc] < 0 &&
+                       code[pc].op == Instruction::Jmp;
+         n++) {
+      pc = code[pc].addr;
+    }
+    resolved[target] = resolved[pc] < 0 ? table.size() : resolved[pc];
+  }
+  return resolved[target];
+}
+
+size_t CallProfiler::child(size_t node, size_t function) {
+  for (size_t c : nodes[node].children) {
+    if (nodes[c].function == function) {
+      return c;
+    }
+  }
+  nodes.push_back({function, node, {}, 0});
+  nodes[node].children.push_back(nodes.size() - 1);
+  return nodes.size() - 1;
+}
+
+void CallProfiler::enter(size_t function, uint64_t now) {
+  size_t parent = frames.empty() ? 0 : frames.back().node;
+  frames.push_back({child(parent, function), now});
+  Stats &stats = functions[function];
+  stats.calls++;
+  stats.max_depth = std::max(stats.max_depth, ++active[function]);
+}
+
+void CallProfiler::leave(uint64_t now) {
+  if (frames.empty()) {
+    return;
+  }
+  Frame frame = frames.back();
+  frames.pop_back();
+  Node &node = nodes[frame.node];
+  const uint64_t inclusive = now - frame.start;
+  const uint64_t exclusive = inclusive - frame.children;
+  Stats &stats = functions[node.function];
+  stats.exclusive += exclusive;
+  if (--active[node.function] == 0) {
+    stats.inclusive += inclusive;
+  }
+  node.exclusive += exclusive;
+  if (!frames.empty()) {
+    frames.back().children += inclusive;
+  }
+}
+
+void CallProfiler::start() {
+  enter(table.empty() ? table.size() : table.size() - 1, profile_clock());
+}
+
+void CallProfiler::finish() {
+  const uint64_t now = profile_clock();
+  while (!frames.empty()) {
+    leave(now);
+  }
+}
+
+static std::string function_name(const FunctionTable &table, size_t index) {
+  return index < table.size() ? table[index].name : "?";
+}
+
+void CallProfiler::print_table(std::ostream &out) const {
+  std::vector<size_t> order;
+  for (size_t i = 0; i < functions.size(); i++) {
+    if (functions[i].calls != 0) {
+      order.push_back(i);
+    }
+  }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return functions[a].exclusive > functions[b].exclusive;
+  });
+
+  const std::string unit = profile_clock_unit();
+  out << std::left << std::setw(16) << "function" << std::right
+      << std::setw(6) << "level" << std::setw(12) << "calls" << std::setw(18)
+      << ("inclusive " + unit) << std::setw(18) << ("exclusive " + unit)
+      << std::setw(10) << "max depth" << '\n';
+  for (size_t i : order) {
+    const Stats &stats = functions[i];
+    out << std::left << std::setw(16) << function_name(table, i) << std::right
+        << std::setw(6);
+    if (i < table.size()) {
+      out << table[i].level;
+    } else {
+      out << "";
+    }
+    out << std::setw(12) << stats.calls << std::setw(18) << stats.inclusive
+        << std::setw(18) << stats.exclusive << std::setw(10)
+        << stats.max_depth << '\n';
+  }
+}
+
+std::string CallProfiler::path(size_t node) const {
+  std::vector<size_t> stack;
+  for (; node != 0; node = nodes[node].parent) {
+    stack.push_back(nodes[node].function);
+  }
+  std::string result;
+  for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+    if (!result.empty()) {
+      result += ';';
+    }
+    result += function_name(table, *it);
+  }
+  return result;
+}
+
+void CallProfiler::print_folded(std::ostream &out) const {
+  for (size_t i = 1; i < nodes.size(); i++) {
+    if (nodes[i].exclusive != 0) {
+      out << path(i) << ' ' << nodes[i].exclusive << '\n';
+    }
+  }
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "./code.hpp"
+#include "./instruction.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace pl0 {
+static const size_t instruction_count =
+    static_cast<size_t>(Instruction::Halt) + 1;
+
+// Time stamp for profiling: the TSC where there is one, nanoseconds of the
+// steady clock elsewhere.
+inline uint64_t profile_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+// Unit of profile_clock() differences, for reports.
+const char *profile_clock_unit();
+
+// Per-opcode statistics, fed by VM::eval() at every dispatch when a
+// profiler is attached. The time between two dispatches is charged to the
+// earlier instruction, so it includes the dispatch itself and the cost of
+// reading the clock.
+class OpcodeProfiler {
+public:
+  void dispatch(Instruction op) {
+    const uint64_t now = profile_clock();
+    const size_t index = static_cast<size_t>(op);
+    cycles[previous] += now - last;
+    pairs[previous][index]++;
+    counts[index]++;
+    previous = index;
+    last = now;
+  }
+
+  uint64_t count(Instruction op) const {
+    return counts[static_cast<size_t>(op)];
+  }
+  uint64_t time(Instruction op) const {
+    return cycles[static_cast<size_t>(op)];
+  }
+  uint64_t pair(Instruction first, Instruction second) const {
+    return pairs[static_cast<size_t>(first)][static_cast<size_t>(second)];
+  }
+
+  // Table of the executed opcodes by time, then the top pairs by count.
+  void print_table(std::ostream &out, size_t top_pairs = 10) const;
+  void print_json(std::ostream &out, size_t top_pairs = 20) const;
+
+private:
+  struct Pair {
+    size_t first, second;
+    uint64_t count;
+  };
+  std::vector<Pair> top(size_t limit) const;
+
+private:
+  // Row instruction_count stands for "no instruction yet", so the first
+  // dispatch needs no check.
+  size_t previous = instruction_count;
+  uint64_t last = 0;
+  uint64_t counts[instruction_count] = {};
+  uint64_t cycles[instruction_count + 1] = {};
+  uint64_t pairs[instruction_count + 1][instruction_count] = {};
+};
+
+// Per-function statistics, fed by VM::eval() at every Call and Ret when a
+// call profiler is attached. Functions come from the FunctionTable the
+// compiler emits; a Call is attributed by following its target through any
+// Jmp over nested functions to a function entry.
+//
+// Calls are kept as a tree, one node per distinct call path, so that the
+// exclusive time can be printed as folded stacks ("main;f;g 1234") for
+// flame graph tools.
+class CallProfiler {
+public:
+  CallProfiler(CodeView code, const FunctionTable &functions);
+
+  // main's frame; eval() calls these around the run.
+  void start();
+  void finish();
+
+  void call(size_t target) {
+    enter(function_at(target), profile_clock());
+  }
+  void ret() { leave(profile_clock()); }
+
+  struct Stats {
+    uint64_t calls = 0;
+    uint64_t inclusive = 0; // outermost activations only, so recursion
+                            // does not count the same time twice
+    uint64_t exclusive = 0;
+    size_t max_depth = 0; // deepest recursion, in activations
+  };
+  const Stats &stats(size_t function) const { return functions[function]; }
+
+  // Functions by exclusive time.
+  void print_table(std::ostream &out) const;
+  // One line per call path with exclusive time > 0.
+  void print_folded(std::ostream &out) const;
+
+private:
+  struct Node {
+    size_t function;
+    size_t parent;
+    std::vector<size_t> children;
+    uint64_t exclusive = 0;
+  };
+  struct Frame {
+    size_t node;
+    uint64_t start;
+    uint64_t children = 0; // inclusive time of the callees
+  };
+
+  size_t function_at(size_t target);
+  size_t child(size_t node, size_t function);
+  void enter(size_t function, uint64_t now);
+  void leave(uint64_t now);
+  std::string path(size_t node) const;
+
+private:
+  CodeView code;
+  const FunctionTable &table;
+  std::vector<Stats> functions;   // by FunctionTable index
+  std::vector<size_t> active;     // activations on the stack, by function
+  std::vector<int32_t> resolved;  // Call target to function, -1 if unknown
+  std::vector<Node> nodes;        // nodes[0] is an unnamed root
+  std::vector<Frame> frames;
+};
+} // namespace pl0
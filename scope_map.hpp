@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+#include "./arena.hpp"
+#include "./interner.hpp"
+
+namespace pl0 {
+// Symbol table for block-structured scopes, keyed by interned Symbol.
+// Declarations are kept on a stack, and each one links to the declaration
+// of the same symbol it shadows. A hash map from symbol points at the
+// newest, visible declaration; symbols come from an Interner that may be
+// shared by many compilations, so it only holds the ones this one declares.
+// Lookup is one probe, and since blocks are left in LIFO order, popping a
+// declaration just restores the one it shadowed, so leaving a block costs
+// O(declarations in the block).
+template <typename T> class ScopeMap {
+public:
+  explicit ScopeMap(Arena &arena)
+      : entries(arena),
+        visible(0, std::hash<Symbol>(), std::equal_to<Symbol>(), arena) {}
+
+  // Declares symbol, shadowing any older declaration. Returns its index,
+  // which stays valid until the declaration is popped.
+  size_t declare(Symbol symbol, const T &value) {
+    uint32_t &newest = visible.emplace(symbol, none).first->second;
+    entries.push_back({symbol, newest, value});
+    newest = entries.size() - 1;
+    return entries.size() - 1;
+  }
+
+  // The visible declaration of symbol, or nullptr.
+  const T *find(Symbol symbol) const {
+    auto it = visible.find(symbol);
+    if (it == visible.end() || it->second == none) {
+      return nullptr;
+    }
+    return &entries[it->second].value;
+  }
+
+  const T &get(size_t index) const { return entries[index].value; }
+  Symbol symbol(size_t index) const { return entries[index].symbol; }
+  size_t size() const { return entries.size(); }
+
+  // Pops declarations until only size are left.
+  void truncate(size_t size) {
+    while (entries.size() > size) {
+      visible[entries.back().symbol] = entries.back().shadowed;
+      entries.pop_back();
+    }
+  }
+
+private:
+  struct Entry {
+    Symbol symbol;
+    uint32_t shadowed; // older declaration of the same symbol, or none
+    T value;
+  };
+
+  static const uint32_t none = UINT32_MAX;
+
+private:
+  ArenaVector<Entry> entries;
+  std::unordered_map<Symbol, uint32_t, std::hash<Symbol>,
+                     std::equal_to<Symbol>,
+                     ArenaAllocator<std::pair<const Symbol, uint32_t>>>
+      visible; // newest declaration by symbol, or none
+};
+
+template <typename T> const uint32_t ScopeMap<T>::none;
+} // namespace pl0
@@ -0,0 +1,63 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./source.hpp"
+
+using namespace pl0;
+
+SourceFile::SourceFile(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    throw "Can not open " + path;
+  }
+  length = st.st_size;
+
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  if (S_ISREG(st.st_mode) && length % page_size != 0) {
+    void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped != MAP_FAILED) {
+      madvise(mapped, length, MADV_SEQUENTIAL);
+      close(fd);
+      text = static_cast<const char *>(mapped);
+      mapped_size = length;
+      return;
+    }
+  }
+
+  // Empty files, page-multiple sizes, pipes: copy, and add the '\0'.
+  std::string contents;
+  char buf[64 * 1024];
+  ssize_t size;
+  while ((size = read(fd, buf, sizeof(buf))) != 0) {
+    if (size < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      close(fd);
+      throw "Can not open " + path;
+    }
+    contents.append(buf, size);
+  }
+  close(fd);
+  length = contents.size();
+  char *copy = new char[length + 1];
+  memcpy(copy, contents.data(), length);
+  copy[length] = '\0';
+  text = copy;
+}
+
+SourceFile::~SourceFile() {
+  if (mapped_size != 0) {
+    munmap(const_cast<char *>(text), mapped_size);
+  } else {
+    delete[] text;
+  }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+
+namespace pl0 {
+// Read-only contents of a source file, followed by at least one '\0' that
+// the lexer uses as its end marker. The file is mapped when the page
+// holding its end has room for that '\0' (the kernel zero-fills it), and
+// read into memory otherwise.
+class SourceFile {
+public:
+  explicit SourceFile(const std::string &path);
+  ~SourceFile();
+  SourceFile(const SourceFile &) = delete;
+  SourceFile &operator=(const SourceFile &) = delete;
+
+  const char *data() const { return text; }
+  size_t size() const { return length; }
+
+private:
+  const char *text = nullptr;
+  size_t length = 0;
+  size_t mapped_size = 0; // 0 when text is a heap copy
+};
+} // namespace pl0
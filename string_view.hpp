@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstring>
+#include <ostream>
+#include <string>
+
+namespace pl0 {
+// Non-owning reference to characters that live elsewhere, usually the
+// source buffer of a Lexer. Stand-in for std::string_view, which needs
+// C++17.
+class StringView {
+public:
+  StringView() : ptr(""), len(0) {}
+  StringView(const char *data, size_t size) : ptr(data), len(size) {}
+  StringView(const char *str) : ptr(str), len(strlen(str)) {}
+  StringView(const std::string &str) : ptr(str.data()), len(str.size()) {}
+
+  const char *data() const { return ptr; }
+  size_t size() const { return len; }
+  bool empty() const { return len == 0; }
+  char operator[](size_t i) const { return ptr[i]; }
+
+  std::string str() const { return std::string(ptr, len); }
+  operator std::string() const { return str(); }
+
+  int compare(StringView other) const {
+    int result = memcmp(ptr, other.ptr, len < other.len ? len : other.len);
+    if (result != 0) {
+      return result;
+    }
+    return len < other.len ? -1 : len > other.len ? 1 : 0;
+  }
+
+private:
+  const char *ptr;
+  size_t len;
+};
+
+inline bool operator==(StringView lhs, StringView rhs) {
+  return lhs.size() == rhs.size() &&
+         memcmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+}
+inline bool operator==(const std::string &lhs, StringView rhs) {
+  return StringView(lhs) == rhs;
+}
+inline bool operator!=(StringView lhs, StringView rhs) {
+  return !(lhs == rhs);
+}
+inline bool operator<(StringView lhs, StringView rhs) {
+  return lhs.compare(rhs) < 0;
+}
+
+inline std::ostream &operator<<(std::ostream &out, StringView str) {
+  return out.write(str.data(), str.size());
+}
+} // namespace pl0
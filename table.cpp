@@ -1,11 +1,15 @@
-#include <algorithm>
 #include <cassert>
 
 #include "./table.hpp"
 
 using namespace pl0;
 
+const size_t Table::max_level;
+
 void Table::enterBlock() {
+  if (cur_level >= max_level) {
+    throw "functions nested too deeply";
+  }
   cur_level++;
   level_start_at.push_back(infos.size());
   prev_addr.push_back(cur_addr);
@@ -15,37 +19,37 @@ void Table::enterBlock() {
 void Table::leaveBlock() {
   assert(cur_level > 0);
   cur_level--;
-  infos.resize(level_start_at.back());
+  infos.truncate(level_start_at.back());
   level_start_at.pop_back();
 
   cur_addr = prev_addr.back();
   prev_addr.pop_back();
 }
 
-const IdInfo &Table::find(const std::string &id) const {
-  auto itr = std::find_if(infos.rbegin(), infos.rend(),
-                          [&](const IdInfo &info) { return info.name == id; });
-  if (itr == infos.rend()) {
+const IdInfo &Table::find(Symbol id) const {
+  const IdInfo *info = infos.find(id);
+  if (info == nullptr) {
     throw "not find ident";
   }
 
-  return *itr;
+  return *info;
 }
 
-void Table::appendVar(const std::string &id) {
-  infos.emplace_back(id, cur_level, 2 + cur_addr++);
+void Table::appendVar(Symbol id) {
+  infos.declare(id, IdInfo(cur_level, 2 + cur_addr++));
 }
 
-void Table::appendParam(const std::string &param, long long offset) {
-  infos.emplace_back(param, cur_level, offset);
+void Table::appendParam(Symbol param, long long offset) {
+  infos.declare(param, IdInfo(cur_level, offset));
 }
 
-void Table::appendConst(const std::string &id, long long value) {
-  infos.emplace_back(id, value);
+void Table::appendConst(Symbol id, long long value) {
+  infos.declare(id, IdInfo(value));
 }
 
-size_t Table::appendFunc(const std::string &id, long long entry_point,
-                         long long param_size) {
-  infos.emplace_back(id, cur_level + 1, entry_point, param_size);
-  return infos.size() - 1;
+void Table::appendFunc(Symbol id, long long function, long long param_size) {
+  if (cur_level >= max_level) {
+    throw "functions nested too deeply";
+  }
+  infos.declare(id, IdInfo(cur_level + 1, function, param_size));
 }
@@ -1,58 +1,66 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
-#include <vector>
+
+#include "./arena.hpp"
+#include "./interner.hpp"
+#include "./scope_map.hpp"
 
 namespace pl0 {
-enum class IdType {
+enum class IdType : uint8_t {
   Const,
   Var,
   Function,
 };
 
+// What a name refers to. The name itself is the Symbol it is declared under.
 class IdInfo {
 public:
   IdInfo() {}
-  IdInfo(const std::string &name, long long value)
-      : name(name), type(IdType::Const), value(value) {}
-  IdInfo(const std::string &name, size_t level, size_t addr)
-      : name(name), type(IdType::Var), level(level), addr(addr) {}
-  IdInfo(const std::string &name, long long level, long long entry_point,
-         long long param_size)
-      : name(name), type(IdType::Function), level(level),
-        entry_point(entry_point), param_size(param_size) {}
+  IdInfo(long long value) : type(IdType::Const), value(value) {}
+  IdInfo(size_t level, long long addr)
+      : type(IdType::Var), level(level), addr(addr) {}
+  IdInfo(size_t level, long long function, long long param_size)
+      : type(IdType::Function), level(level), param_size(param_size),
+        function(function) {}
 
 public:
-  std::string name;
   IdType type;
-  size_t level;
-  size_t addr;
-  long long value;
-  long long entry_point;
-  long long param_size;
+  uint16_t level = 0;      // Var, Function
+  uint32_t param_size = 0; // Function
+  union {
+    long long value;       // Const
+    long long addr;        // Var
+    long long function;    // Function: index in ast::Ast::functions
+  };
 };
+static_assert(sizeof(IdInfo) == 16, "IdInfo should stay two words");
 
 class Table {
 public:
+  explicit Table(Arena &arena)
+      : infos(arena), level_start_at(arena), prev_addr(arena) {}
+
   void enterBlock();
   void leaveBlock();
 
-  const IdInfo &find(const std::string &id) const;
-  const IdInfo &get(size_t id) const { return infos[id]; }
-  void appendVar(const std::string &id);
-  void appendParam(const std::string &param, long long offset);
-  void appendConst(const std::string &id, long long value);
-  size_t appendFunc(const std::string &id, long long entry_point,
-                    long long param_size);
+  const IdInfo &find(Symbol id) const;
+  void appendVar(Symbol id);
+  void appendParam(Symbol param, long long offset);
+  void appendConst(Symbol id, long long value);
+  void appendFunc(Symbol id, long long function, long long param_size);
 
   size_t getLevel() const { return cur_level; }
 
+  // Deepest nesting level IdInfo, and the code after it, can hold.
+  static const size_t max_level = UINT16_MAX;
+
 private:
-  std::vector<IdInfo> infos;
-  std::vector<size_t> level_start_at;
-  std::vector<size_t> prev_addr;
-  size_t cur_level;
-  size_t cur_addr;
-  size_t index[100];
+  ScopeMap<IdInfo> infos;
+  ArenaVector<size_t> level_start_at;
+  ArenaVector<size_t> prev_addr;
+  size_t cur_level = 0;
+  size_t cur_addr = 0;
 };
 } // namespace pl0
@@ -0,0 +1,12 @@
+# Runs PL0 with the space-separated ARGS on SOURCE and compares what it
+# writes with the file EXPECTED.
+separate_arguments(args UNIX_COMMAND "${ARGS}")
+execute_process(COMMAND ${PL0} ${args} --no-cache ${SOURCE}
+  OUTPUT_VARIABLE output RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "${SOURCE}: exited with ${result}")
+endif()
+file(READ ${EXPECTED} expected)
+if(NOT output STREQUAL expected)
+  message(FATAL_ERROR "${SOURCE}: expected\n${expected}but got\n${output}")
+endif()
@@ -0,0 +1,114 @@
+#include <chrono>
+#include <sstream>
+
+#include "./tiered.hpp"
+
+using namespace pl0;
+
+TieredCompiler::TieredCompiler(CodeView code, const FunctionTable &functions,
+                               unsigned threshold)
+    : code(code), functions(functions), threshold(threshold),
+      function_at(code.size(), -1), loop_at(code.size(), -1),
+      counters(functions.size(), 0),
+      compiled(new std::atomic<NativeJIT *>[functions.size()]) {
+  std::vector<long long> entry_of(code.size(), -1);
+  for (size_t f = 0; f < functions.size(); f++) {
+    compiled[f].store(nullptr, std::memory_order_relaxed);
+    if (functions[f].entry < code.size()) {
+      entry_of[functions[f].entry] = f;
+    }
+  }
+  for (const auto &c : code) {
+    if (c.op != Instruction::Call && c.op != Instruction::TailCall) {
+      continue;
+    }
+    // Through the Jmp over nested functions.
+    size_t target = c.addr;
+    for (int i = 0; i < 16 && code[target].op == Instruction::Jmp; i++) {
+      target = code[target].addr;
+    }
+    function_at[c.addr] = entry_of[target];
+  }
+  // main, the last function, is never called, so its loops are not counted.
+  for (size_t f = 0; f + 1 < functions.size(); f++) {
+    for (size_t i = functions[f].entry;
+         i < functions[f].end && i < code.size(); i++) {
+      if (code[i].op == Instruction::Jmp &&
+          static_cast<size_t>(code[i].addr) <= i) {
+        loop_at[i] = f;
+      }
+    }
+  }
+}
+
+TieredCompiler::~TieredCompiler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_one();
+  if (worker.joinable()) {
+    worker.join();
+  }
+}
+
+void TieredCompiler::request(size_t function) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(function);
+  }
+  wake.notify_one();
+  if (!worker.joinable()) {
+    worker = std::thread(&TieredCompiler::work, this);
+  }
+}
+
+void TieredCompiler::work() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wake.wait(lock, [this] { return stopping || !queue.empty(); });
+    if (stopping) {
+      return;
+    }
+    size_t function = queue.front();
+    queue.pop_front();
+    lock.unlock();
+
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<NativeJIT> native;
+    std::string error;
+    try {
+      native.reset(new NativeJIT(code, functions, function));
+    } catch (const char *msg) {
+      // The function stays in the VM.
+      error = msg;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    std::ostringstream line;
+    line << functions[function].name << ": ";
+    if (native) {
+      line << native->function_count() << " function"
+           << (native->function_count() == 1 ? ", " : "s, ")
+           << native->code_size() << " bytes, "
+           << std::chrono::duration<double, std::milli>(end - start).count()
+           << " ms";
+    } else {
+      line << "not compiled: " << error;
+    }
+
+    lock.lock();
+    if (native) {
+      compiled[function].store(native.get(), std::memory_order_release);
+      units.push_back(std::move(native));
+    }
+    report.push_back(line.str());
+  }
+}
+
+void TieredCompiler::print_report(std::ostream &out) {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const auto &line : report) {
+    out << "tier: " << line << '\n';
+  }
+}
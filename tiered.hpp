@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "./code.hpp"
+#include "./native_jit.hpp"
+
+namespace pl0 {
+// Second tier for VM::eval(). The VM reports every Call and every jump back
+// to a loop head; once a function has been called or looped threshold times
+// in total, a background thread translates it, with every function it can
+// call, through NativeJIT. The VM keeps interpreting in the meantime and
+// runs the native code from the next call on.
+//
+// Only whole calls move to native code: a running activation, such as
+// main's loop, finishes in the VM.
+class TieredCompiler {
+public:
+  TieredCompiler(CodeView code, const FunctionTable &functions,
+                 unsigned threshold = default_threshold);
+  // Waits for a translation in progress.
+  ~TieredCompiler();
+  TieredCompiler(const TieredCompiler &) = delete;
+  TieredCompiler &operator=(const TieredCompiler &) = delete;
+
+  static const unsigned default_threshold = 1000;
+
+  // Native code for the function a Call to target enters, or nullptr while
+  // it is not translated; the call is counted then.
+  NativeJIT *call(size_t target) {
+    const long long function = function_at[target];
+    if (function < 0) {
+      return nullptr;
+    }
+    NativeJIT *native = compiled[function].load(std::memory_order_acquire);
+    if (native == nullptr) {
+      count(function);
+    }
+    return native;
+  }
+  // Counts the Jmp at pc, which goes back to a loop head.
+  void back_edge(size_t pc) {
+    const long long function = loop_at[pc];
+    if (function >= 0) {
+      count(function);
+    }
+  }
+
+  NativeStack &stack() { return native_stack; }
+
+  // One line per translated function, in the order they were ready.
+  void print_report(std::ostream &out);
+
+private:
+  void count(size_t function) {
+    if (++counters[function] == threshold) {
+      request(function);
+    }
+  }
+  void request(size_t function);
+  void work();
+
+private:
+  CodeView code;
+  const FunctionTable functions; // a copy, read by the worker
+  const unsigned threshold;
+  std::vector<long long> function_at; // function a Call to an index enters
+  std::vector<long long> loop_at;     // function of a backward Jmp
+  std::vector<unsigned> counters;     // by function, VM thread only
+  std::unique_ptr<std::atomic<NativeJIT *>[]> compiled; // by function
+  NativeStack native_stack;
+
+  std::thread worker; // started by the first request
+  std::mutex mutex;   // guards the members below
+  std::condition_variable wake;
+  std::deque<size_t> queue;
+  bool stopping = false;
+  std::vector<std::unique_ptr<NativeJIT>> units;
+  std::vector<std::string> report;
+};
+} // namespace pl0
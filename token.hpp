@@ -1,9 +1,12 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
+#include "./interner.hpp"
+
 namespace pl0 {
-enum class TokenType {
+enum class TokenType : uint8_t {
   Integer,
   Ident,
 
@@ -48,12 +51,13 @@ public:
   Token() : type(TokenType::TEOF) {}
   Token(TokenType type) : type(type) {}
   Token(long long integer) : type(TokenType::Integer), integer(integer) {}
-  Token(std::string &&ident) : type(TokenType::Ident), ident(ident) {}
+  Token(Symbol ident) : type(TokenType::Ident), ident(ident) {}
 
 public:
   TokenType type;
   long long integer;
-  std::string ident;
+  Symbol ident;
+
 };
 
 static std::ostream &operator<<(std::ostream &out, const TokenType type) {
@@ -133,7 +137,7 @@ static std::ostream &operator<<(std::ostream &out, const Token &token) {
   if (token.type == TokenType::Integer) {
     out << " " << token.integer;
   } else if (token.type == TokenType::Ident) {
-    out << " " << token.ident;
+    out << " " << Interner::global().name(token.ident);
   }
   return out;
 }
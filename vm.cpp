@@ -1,140 +1,445 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "./native_jit.hpp"
+#include "./tiered.hpp"
 #include "./vm.hpp"
-#include <iostream>
 
 using namespace pl0;
 
 // stack layout
 // 0 [ param       ]
 // 1 [ param       ]
-// 2 [ display pos ] <- display
-// 3 [ Return addr ]
+// 2 [ caller's fp ] <- fp (and display, if the function is reached by it)
+// 3 [ Return addr ] | saved display entry << 32
 // 4 [ local val   ]
 // 5 [ local val   ]
 // 6 [             ]
 
 // int lim = 0;
 
+#if defined(__GNUC__)
+#define PL0_COMPUTED_GOTO 1
+#else
+#define PL0_COMPUTED_GOTO 0
+#endif
+
+// Add, Sub, Mul and Neg wrap around on overflow: they are done on the
+// unsigned values, and this converts the result back.
+static inline long long wrap(unsigned long long value) {
+  return static_cast<long long>(value);
+}
+
+// Integer division that reports division by zero instead of trapping, so
+// that a faulty program does not take down a process running others.
+static inline long long divide(long long lhs, long long rhs) {
+  if (rhs == 0) {
+    throw "division by zero";
+  }
+  if (rhs == -1) {
+    // LLONG_MIN / -1 traps too; wrap around like the other operators.
+    return wrap(0ULL - static_cast<unsigned long long>(lhs));
+  }
+  return lhs / rhs;
+}
+
+static inline long long binary(Instruction op, long long lhs, long long rhs) {
+  switch (op) {
+  case Instruction::Add:
+    return wrap(static_cast<unsigned long long>(lhs) + rhs);
+  case Instruction::Sub:
+    return wrap(static_cast<unsigned long long>(lhs) - rhs);
+  case Instruction::Mul:
+    return wrap(static_cast<unsigned long long>(lhs) * rhs);
+  case Instruction::Div:
+    return divide(lhs, rhs);
+  case Instruction::Eq:
+    return lhs == rhs;
+  case Instruction::Neq:
+    return lhs != rhs;
+  case Instruction::Less:
+    return lhs < rhs;
+  case Instruction::LessEq:
+    return lhs <= rhs;
+  case Instruction::Greater:
+    return lhs > rhs;
+  case Instruction::GreaterEq:
+    return lhs >= rhs;
+  default:
+    // Unreachable: the compiler only emits operators, and check_code()
+    // rejects anything else in a .plzc file.
+    throw "invalid operator";
+  }
+}
+
+// The second slot of a frame: the return address, and the display entry
+// the call replaced if it set one. Code indices fit in 32 bits, and so must
+// the frames the display points at.
+static const size_t max_display_frame = UINT32_MAX;
+static inline long long frame_link(size_t pc, long long saved) {
+  return static_cast<long long>(static_cast<unsigned long long>(saved) << 32 |
+                                pc);
+}
+static inline size_t link_pc(long long slot) {
+  return static_cast<uint32_t>(slot);
+}
+static inline long long link_display(long long slot) {
+  return static_cast<long long>(static_cast<unsigned long long>(slot) >> 32);
+}
+
+bool VM::has_threaded_dispatch() { return PL0_COMPUTED_GOTO; }
+
 void VM::eval() {
+  if (dispatch == Dispatch::Threaded && has_threaded_dispatch()) {
+    run_with_hooks<true>();
+  } else {
+    run_with_hooks<false>();
+  }
+}
+
+template <bool Threaded> void VM::run_with_hooks() {
+  if (tier != nullptr) {
+    run<Threaded, TierUp>();
+    return;
+  }
+  if (call_profiler != nullptr) {
+    call_profiler->start();
+  }
+  if (profiler != nullptr && call_profiler != nullptr) {
+    run<Threaded, ProfileOpcodes | ProfileCalls>();
+  } else if (profiler != nullptr) {
+    run<Threaded, ProfileOpcodes>();
+  } else if (call_profiler != nullptr) {
+    run<Threaded, ProfileCalls>();
+  } else {
+    run<Threaded, 0>();
+  }
+  if (call_profiler != nullptr) {
+    call_profiler->finish();
+  }
+}
+
+// Each handler is written once and shared by both engines. In switch mode
+// TARGET is a case label and DISPATCH breaks back to the loop head. In
+// threaded mode DISPATCH jumps from the end of one handler straight to the
+// label of the next one, so there is no bounds check and no shared branch.
+// PROFILE records the fetched instruction; it is dead code unless Hooks
+// has ProfileOpcodes.
+#define PROFILE()                                                              \
+  if (Hooks & ProfileOpcodes) {                                                \
+    profiler->dispatch(inst->op);                                              \
+  }
+#if PL0_COMPUTED_GOTO
+#define TARGET(op)                                                             \
+  case Instruction::op:                                                        \
+  op_##op
+#define DISPATCH()                                                             \
+  if (Threaded) {                                                              \
+    inst = &code[pc++];                                                        \
+    PROFILE();                                                                 \
+    goto *labels[static_cast<size_t>(inst->op)];                               \
+  }                                                                            \
+  break
+#else
+#define TARGET(op) case Instruction::op
+#define DISPATCH() break
+#endif
+
+void VM::call_native(NativeJIT &native) {
+  // Only levels reached through the display are read, and main's is 0. The
+  // display may end below native.level() if the levels in between are not.
+  frames.resize(std::max(frames.size(), native.level()));
+  for (size_t level = 0; level < native.level(); level++) {
+    frames[level] =
+        level < display.size() ? stack.data() + display[level] : nullptr;
+  }
+  const size_t args = stack.size() - native.params();
+  long long value =
+      native.call(frames.data(), stack.data() + args, output, tier->stack());
+  stack.resize(args);
+  stack.push_back(value);
+}
+
+template <bool Threaded, unsigned Hooks> void VM::run() {
   long long lhs, rhs;
   long long level, addr;
   long long display_p, before_display;
-  while (pc < program.size()) {
-    Instruction inst = static_cast<Instruction>(program[pc++]);
-    switch (inst) {
-    case Instruction::Load:
-      level = program[pc++];
-      addr = program[pc++];
-      stack.push_back(stack[display[level] + addr]);
-      break;
-    case Instruction::Store:
-      lhs = pop();
 
-      level = program[pc++];
-      addr = program[pc++];
-      stack[display[level] + addr] = lhs;
-      break;
-    case Instruction::Call:
-      level = program[pc++];
-      addr = program[pc++];
-      stack.push_back(display[level]);
-      stack.push_back(pc);
-
-      display[level] = stack.size() - 2;
-
-      pc = addr;
-      break;
-    case Instruction::Ret:
+  // Keep the hot registers out of the object so the compiler does not have
+  // to reload them after every store into the stack.
+  const Code *code = this->code.data();
+  const size_t code_size = this->code.size();
+  long long *display = this->display.data();
+  size_t pc = this->pc;
+  size_t fp = this->fp;
+  const Code *inst;
+
+#if PL0_COMPUTED_GOTO
+  // Must follow the order of Instruction.
+  static void *const labels[] = {
+      &&op_Load,  &&op_Store,     &&op_Call,    &&op_Ret,      &&op_Literal,
+      &&op_Ict,   &&op_Jmp,       &&op_Jpc,     &&op_Neg,      &&op_Add,
+      &&op_Sub,   &&op_Mul,       &&op_Div,     &&op_Odd,      &&op_Eq,
+      &&op_Neq,   &&op_Less,      &&op_LessEq,  &&op_Greater,  &&op_GreaterEq,
+      &&op_Write, &&op_Writeln,   &&op_TailCall, &&op_LoadOp,  &&op_LiteralOp, &&op_LoadLoadOp,
+      &&op_CompareJump, &&op_LoadAddStore, &&op_LiteralCompareJump,
+      &&op_LoadLoadCompareJump, &&op_LoadLocal, &&op_StoreLocal,
+      &&op_LoadGlobal, &&op_StoreGlobal, &&op_Halt,
+  };
+  static_assert(sizeof(labels) / sizeof(labels[0]) ==
+                    static_cast<size_t>(Instruction::Halt) + 1,
+                "labels must cover every instruction");
+
+  if (Threaded) {
+    inst = &code[pc++];
+    PROFILE();
+    goto *labels[static_cast<size_t>(inst->op)];
+  }
+#endif
+
+  while (pc < code_size) {
+    inst = &code[pc++];
+    PROFILE();
+    switch (inst->op) {
+    TARGET(Load):
+      stack.push_back(stack[display[inst->level] + inst->addr]);
+      DISPATCH();
+    TARGET(Store):
+      stack[display[inst->level] + inst->addr] = pop();
+      DISPATCH();
+    TARGET(Call):
+      if (Hooks & ProfileCalls) {
+        call_profiler->call(inst->addr);
+      }
+      if (Hooks & TierUp) {
+        if (NativeJIT *native = tier->call(inst->addr)) {
+          call_native(*native);
+          DISPATCH();
+        }
+      }
+      level = inst->level;
+      display_p = stack.size(); // new frame
+      if (level != 0) {
+        if (static_cast<size_t>(display_p) > max_display_frame) {
+          throw "stack overflow";
+        }
+        addr = frame_link(pc, display[level]);
+        display[level] = display_p;
+      } else {
+        addr = pc;
+      }
+      before_display = fp;
+      stack.push_back(before_display);
+      stack.push_back(addr);
+      fp = display_p;
+
+      pc = inst->addr;
+      DISPATCH();
+    TARGET(Ret):
+      if (Hooks & ProfileCalls) {
+        call_profiler->ret();
+      }
       lhs = pop();
-      level = program[pc++];
-      display_p = display[level];
+      level = inst->level;
+      display_p = fp;
       addr = stack[display_p + 1];
 
-      display[level] = stack[display_p];
-      stack.resize(display_p + 1 - program[pc++]);
+      if (level != 0) {
+        display[level] = link_display(addr);
+      }
+      fp = stack[display_p];
+      stack.resize(display_p - inst->addr);
       stack.push_back(lhs);
 
-      pc = addr;
-      break;
-    case Instruction::Literal:
-      stack.push_back(program[pc++]);
-      break;
-    case Instruction::Ict:
-      stack.resize(stack.size() + program[pc++]);
-      break;
-    case Instruction::Jmp:
-      pc = program[pc];
-      break;
-    case Instruction::Jpc:
-      addr = program[pc++];
+      pc = link_pc(addr);
+      DISPATCH();
+    TARGET(Literal):
+      stack.push_back(inst->value);
+      DISPATCH();
+    TARGET(Ict):
+      stack.resize(stack.size() + inst->addr);
+      DISPATCH();
+    TARGET(Jmp):
+      if ((Hooks & TierUp) && static_cast<size_t>(inst->addr) < pc) {
+        tier->back_edge(pc - 1);
+      }
+      pc = inst->addr;
+      DISPATCH();
+    TARGET(Jpc):
       lhs = pop();
       if (!lhs) {
-        pc = addr;
+        pc = inst->addr;
       }
-      break;
-    case Instruction::Neg:
-      stack.back() -= 1;
-      break;
-    case Instruction::Add:
+      DISPATCH();
+    TARGET(Neg):
+      stack.back() =
+          wrap(0ULL - static_cast<unsigned long long>(stack.back()));
+      DISPATCH();
+    TARGET(Add):
       rhs = pop();
       lhs = pop();
-      stack.push_back(lhs + rhs);
-      break;
-    case Instruction::Sub:
+      stack.push_back(binary(Instruction::Add, lhs, rhs));
+      DISPATCH();
+    TARGET(Sub):
       rhs = pop();
       lhs = pop();
-      stack.push_back(lhs - rhs);
-      break;
-    case Instruction::Mul:
+      stack.push_back(binary(Instruction::Sub, lhs, rhs));
+      DISPATCH();
+    TARGET(Mul):
       rhs = pop();
       lhs = pop();
-      stack.push_back(lhs * rhs);
-      break;
-    case Instruction::Div:
+      stack.push_back(binary(Instruction::Mul, lhs, rhs));
+      DISPATCH();
+    TARGET(Div):
       rhs = pop();
       lhs = pop();
-      stack.push_back(lhs / rhs);
-      break;
-    case Instruction::Odd:
+      stack.push_back(divide(lhs, rhs));
+      DISPATCH();
+    TARGET(Odd):
       lhs = pop();
       stack.push_back(lhs % 2);
-      break;
-    case Instruction::Eq:
+      DISPATCH();
+    TARGET(Eq):
       rhs = pop();
       lhs = pop();
       stack.push_back(lhs == rhs);
-      break;
-    case Instruction::Neq:
+      DISPATCH();
+    TARGET(Neq):
       rhs = pop();
       lhs = pop();
       stack.push_back(lhs != rhs);
-      break;
-    case Instruction::Less:
+      DISPATCH();
+    TARGET(Less):
       rhs = pop();
       lhs = pop();
       stack.push_back(lhs < rhs);
-      break;
-    case Instruction::LessEq:
+      DISPATCH();
+    TARGET(LessEq):
       rhs = pop();
       lhs = pop();
       stack.push_back(lhs <= rhs);
-      break;
-    case Instruction::Greater:
+      DISPATCH();
+    TARGET(Greater):
       rhs = pop();
       lhs = pop();
       stack.push_back(lhs > rhs);
-      break;
-    case Instruction::GreaterEq:
+      DISPATCH();
+    TARGET(GreaterEq):
       rhs = pop();
       lhs = pop();
       stack.push_back(lhs >= rhs);
-      break;
-    case Instruction::Write:
+      DISPATCH();
+    TARGET(Write):
+      output.write(pop());
+      DISPATCH();
+    TARGET(Writeln):
+      output.writeln();
+      DISPATCH();
+    TARGET(TailCall):
+      if (Hooks & ProfileCalls) {
+        call_profiler->ret();
+        call_profiler->call(inst->addr);
+      }
+      // Return from the caller's frame as Ret would, but move the arguments
+      // to where its parameters were and call from there with the same
+      // return address, so the stack does not grow.
+      level = inst->caller.level;
+      display_p = fp;
+      before_display = stack[display_p];
+      addr = stack[display_p + 1];
+      if (level != 0) {
+        display[level] = link_display(addr);
+        addr = link_pc(addr);
+      }
+      fp = before_display;
+      lhs = display_p - inst->caller.params; // new frame base
+      rhs = stack.size() - inst->caller.args;
+      display_p = lhs + inst->caller.args;
+      // Usually a few arguments, moved down: a plain forward copy.
+      for (; lhs < display_p; lhs++, rhs++) {
+        stack[lhs] = stack[rhs];
+      }
+
+      if (Hooks & TierUp) {
+        if (NativeJIT *native = tier->call(inst->addr)) {
+          stack.resize(display_p);
+          call_native(*native);
+          pc = addr;
+          DISPATCH();
+        }
+      }
+      // The new frame ends no higher than the arguments did.
+      stack.resize(display_p + 2);
+      stack[display_p] = fp;
+      level = inst->level;
+      if (level != 0) {
+        if (static_cast<size_t>(display_p) > max_display_frame) {
+          throw "stack overflow";
+        }
+        stack[display_p + 1] = frame_link(addr, display[level]);
+        display[level] = display_p;
+      } else {
+        stack[display_p + 1] = addr;
+      }
+      fp = display_p;
+      pc = inst->addr;
+      DISPATCH();
+    TARGET(LoadOp):
+      rhs = stack[fp + inst->addr];
+      stack.back() = binary(inst->sub, stack.back(), rhs);
+      DISPATCH();
+    TARGET(LiteralOp):
+      stack.back() = binary(inst->sub, stack.back(), inst->value);
+      DISPATCH();
+    TARGET(LoadLoadOp):
+      lhs = stack[fp + inst->addr];
+      rhs = stack[fp + inst->rhs];
+      stack.push_back(binary(inst->sub, lhs, rhs));
+      DISPATCH();
+    TARGET(CompareJump):
+      rhs = pop();
+      lhs = pop();
+      if (!binary(inst->sub, lhs, rhs)) {
+        pc = inst->addr;
+      }
+      DISPATCH();
+    TARGET(LoadAddStore):
+      stack[fp + inst->addr] += inst->value;
+      DISPATCH();
+    TARGET(LiteralCompareJump):
       lhs = pop();
-      std::cout << lhs << std::endl;
-      break;
-    case Instruction::Writeln:
-      std::cout << std::endl;
-      break;
+      if (!binary(inst->sub, lhs, inst->value)) {
+        pc = inst->addr;
+      }
+      DISPATCH();
+    TARGET(LoadLoadCompareJump):
+      lhs = stack[fp + inst->vars.lhs];
+      rhs = stack[fp + inst->vars.rhs];
+      if (!binary(inst->sub, lhs, rhs)) {
+        pc = inst->addr;
+      }
+      DISPATCH();
+    TARGET(LoadLocal):
+      stack.push_back(stack[fp + inst->addr]);
+      DISPATCH();
+    TARGET(StoreLocal):
+      stack[fp + inst->addr] = pop();
+      DISPATCH();
+    TARGET(LoadGlobal):
+      stack.push_back(stack[inst->addr]);
+      DISPATCH();
+    TARGET(StoreGlobal):
+      stack[inst->addr] = pop();
+      DISPATCH();
+    TARGET(Halt):
+      output.flush();
+      this->pc = pc;
+      this->fp = fp;
+      return;
     }
   }
 }
+
+#undef TARGET
+#undef DISPATCH
+#undef PROFILE
@@ -1,18 +1,69 @@
 #pragma once
 
-#include "./instruction.hpp"
+#include "./code.hpp"
+#include "./output.hpp"
+#include "./profiler.hpp"
 #include <vector>
 
 namespace pl0 {
+class NativeJIT;
+class TieredCompiler;
+
+enum class Dispatch {
+  Switch,
+  Threaded,
+};
+
 class VM {
 public:
-  VM(const Program &program) : program(program) {
-    stack.push_back(0);
-    stack.push_back(program.size());
-  };
+  // Runs code in place, e.g. decoded or from a mapped .plzc file. code must
+  // end in Halt and outlive the VM.
+  VM(CodeView code, Output &output, Dispatch dispatch = default_dispatch())
+      : code(code), pc(0), fp(0), dispatch(dispatch), output(output) {
+    start();
+  }
   void eval();
 
+  // Records every dispatch in profiler, or every Call and Ret in
+  // call_profiler, while eval() runs. Without them, eval() runs a loop with
+  // the profiling compiled out.
+  void set_profiler(OpcodeProfiler *profiler) { this->profiler = profiler; }
+  void set_call_profiler(CallProfiler *profiler) {
+    this->call_profiler = profiler;
+  }
+  // Counts calls and loops in tier and makes calls through its native code
+  // once it has some. The profilers are not used then.
+  void set_tier(TieredCompiler *tier) { this->tier = tier; }
+
+  // Threaded dispatch needs the labels-as-values extension (GCC, Clang).
+  static bool has_threaded_dispatch();
+  static Dispatch default_dispatch() {
+    return has_threaded_dispatch() ? Dispatch::Threaded : Dispatch::Switch;
+  }
+
 private:
+  // Bits of run()'s Hooks parameter.
+  enum : unsigned {
+    ProfileOpcodes = 1,
+    ProfileCalls = 2,
+    TierUp = 4,
+  };
+
+  template <bool Threaded> void run_with_hooks();
+  template <bool Threaded, unsigned Hooks> void run();
+  // Replaces the arguments on top of the stack with the native call's
+  // value.
+  void call_native(NativeJIT &native);
+
+  // main's frame is at the bottom of the stack; its Ret goes to the final
+  // Halt. The display has an entry for every level the code uses, however
+  // deep.
+  void start() {
+    display.assign(display_size(code), 0);
+    stack.push_back(0);
+    stack.push_back(code.size() - 1);
+  }
+
   long long pop() {
     long long x = stack.back();
     stack.pop_back();
@@ -20,11 +71,18 @@ private:
   }
 
 private:
-  Program program;
+  CodeView code;
   size_t pc;
+  size_t fp; // stack index of the current frame
+  Dispatch dispatch;
+  Output &output;
+  OpcodeProfiler *profiler = nullptr;
+  CallProfiler *call_profiler = nullptr;
+  TieredCompiler *tier = nullptr;
 
   std::vector<long long> stack;
   size_t top;
-  long long display[100];
+  std::vector<long long> display;
+  std::vector<long long *> frames; // call_native's display
 };
 } // namespace pl0
@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <thread>
+
+#include "./work_pool.hpp"
+
+using namespace pl0;
+
+WorkStealingPool::WorkStealingPool(unsigned threads)
+    : threads(threads != 0 ? threads
+                           : std::max(1u, std::thread::hardware_concurrency())) {
+}
+
+void WorkStealingPool::run(size_t count,
+                           const std::function<void(size_t)> &task) {
+  const size_t workers = std::min<size_t>(threads, count);
+  if (workers <= 1) {
+    for (size_t i = 0; i < count; i++) {
+      task(i);
+    }
+    return;
+  }
+
+  queues.clear();
+  for (size_t w = 0; w < workers; w++) {
+    queues.emplace_back(new Queue);
+    for (size_t i = count * w / workers; i < count * (w + 1) / workers; i++) {
+      queues[w]->tasks.push_back(i);
+    }
+  }
+
+  // No task adds tasks, so a worker that finds every queue empty is done.
+  auto work = [&](size_t self) {
+    size_t i;
+    while (pop(*queues[self], i) || steal(self, i)) {
+      task(i);
+    }
+  };
+  std::vector<std::thread> pool;
+  for (size_t w = 1; w < workers; w++) {
+    pool.emplace_back(work, w);
+  }
+  work(0);
+  for (auto &thread : pool) {
+    thread.join();
+  }
+  queues.clear();
+}
+
+bool WorkStealingPool::pop(Queue &queue, size_t &task) {
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.tasks.empty()) {
+    return false;
+  }
+  task = queue.tasks.front();
+  queue.tasks.pop_front();
+  return true;
+}
+
+bool WorkStealingPool::steal(size_t self, size_t &task) {
+  for (size_t n = 1; n < queues.size(); n++) {
+    Queue &victim = *queues[(self + n) % queues.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = victim.tasks.back();
+      victim.tasks.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
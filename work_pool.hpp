@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace pl0 {
+// Fixed set of worker threads with one task queue each. The tasks of a run
+// are split into contiguous ranges, one per worker. A worker takes tasks
+// from the front of its own queue, and once that is empty it steals from
+// the back of the others', so a few slow tasks do not leave the remaining
+// workers idle.
+class WorkStealingPool {
+public:
+  // threads == 0 means one per hardware thread.
+  explicit WorkStealingPool(unsigned threads = 0);
+
+  unsigned size() const { return threads; }
+
+  // Calls task(i) for every i in [0, count), on up to size() threads, and
+  // returns once all calls have returned. task must not throw.
+  void run(size_t count, const std::function<void(size_t)> &task);
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<size_t> tasks;
+  };
+
+  bool pop(Queue &queue, size_t &task);
+  bool steal(size_t self, size_t &task);
+
+private:
+  unsigned threads;
+  std::vector<std::unique_ptr<Queue>> queues;
+};
+} // namespace pl0